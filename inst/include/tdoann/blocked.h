@@ -0,0 +1,219 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_BLOCKED_H
+#define TDOANN_BLOCKED_H
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "distance.h"
+
+namespace tdoann {
+
+constexpr std::size_t blocked_size = 32;
+
+// The distances from yj to the Width rows stored dimension by dimension at xb,
+// as finish(sum of term(x_d, y_d) over the dimensions d). With Width fixed
+// at compile time, the sums stay in registers
+template <std::size_t Width, typename Out, typename Term, typename Finish,
+          typename In>
+void block_distances(const In *xb, const In *yj, std::size_t ndim, Out *out) {
+  Term term;
+  Out sums[Width] = {};
+  for (std::size_t d = 0; d < ndim; d++) {
+    const In yjd = yj[d];
+    const In *xbd = xb + d * Width;
+    for (std::size_t r = 0; r < Width; r++) {
+      sums[r] += term(xbd[r], yjd);
+    }
+  }
+  Finish finish;
+  for (std::size_t r = 0; r < Width; r++) {
+    out[r] = finish(sums[r]);
+  }
+}
+
+// Data stored in blocks of blocked_size rows, with each block stored dimension
+// by dimension: the values of dimension d of the rows of block b are
+// blocks[(b * ndim + d) * blocked_size] onwards. The distances from one
+// item to every row of a block then only need vertical operations over
+// blocked_size consecutive values, rather than a sum over the dimensions of
+// each row. The rows of the last block that are past the end of the data are
+// zero
+template <typename In> struct BlockedData {
+  std::vector<In> blocks;
+  std::size_t ndim;
+  std::size_t n_rows;
+
+  BlockedData(const std::vector<In> &data, std::size_t ndim)
+      : blocks(((data.size() / ndim + blocked_size - 1) / blocked_size) *
+                   ndim * blocked_size,
+               In(0)),
+        ndim(ndim), n_rows(data.size() / ndim) {
+    for (std::size_t i = 0; i < n_rows; i++) {
+      std::size_t offset = (i / blocked_size) * ndim * blocked_size +
+                           i % blocked_size;
+      for (std::size_t d = 0; d < ndim; d++) {
+        blocks[offset + d * blocked_size] = data[i * ndim + d];
+      }
+    }
+  }
+
+  auto n_blocks() const -> std::size_t {
+    return blocks.size() / (ndim * blocked_size);
+  }
+
+  auto operator()(std::size_t i, std::size_t d) const -> In {
+    return blocks[(i / blocked_size) * ndim * blocked_size +
+                  d * blocked_size + i % blocked_size];
+  }
+};
+
+// Distances of the form finish(sum of term(x_d, y_d) over the dimensions d),
+// with x stored in blocks. For use with the brute force search, which
+// calculates the distances from each query to a whole block of the reference
+// data at once via block. Set Normalize for the cosine distance
+template <typename In, typename Out, typename Idx, typename Term,
+          typename Finish, bool Normalize = false>
+struct BlockedDistance {
+  const BlockedData<In> x;
+  const std::vector<In> y;
+  std::size_t ndim;
+  Idx nx;
+  Idx ny;
+
+  BlockedDistance(const std::vector<In> &data, std::size_t ndim)
+      : BlockedDistance(data, data, ndim) {}
+  BlockedDistance(const std::vector<In> &x, const std::vector<In> &y,
+                  std::size_t ndim)
+      : x(Normalize ? normalize(x, ndim) : x, ndim),
+        y(Normalize ? normalize(y, ndim) : y), ndim(ndim),
+        nx(x.size() / ndim), ny(y.size() / ndim) {}
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    Term term;
+    const In *yj = &y[ndim * j];
+    Out sum = 0.0;
+    for (std::size_t d = 0; d < ndim; d++) {
+      sum += term(x(i, d), yj[d]);
+    }
+    return Finish()(sum);
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    for (std::size_t k = 0; k < n; k++) {
+      out[k] = (*this)(is[k], j);
+    }
+  }
+
+  // the distances from row j of y to the blocked_size rows of block b of x.
+  // Rows past the end of x have a distance, which should be ignored
+  void block(Idx j, std::size_t b, Out *out) const {
+    block_distances<blocked_size, Out, Term, Finish>(
+        &x.blocks[b * ndim * blocked_size], &y[ndim * j], ndim, out);
+  }
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+};
+
+template <typename In, typename Out, typename Idx = uint32_t>
+using BlockedL2Sqr =
+    BlockedDistance<In, Out, Idx, SquaredDiff<Out>, Identity<Out>>;
+
+template <typename In, typename Out, typename Idx = uint32_t>
+using BlockedEuclidean =
+    BlockedDistance<In, Out, Idx, SquaredDiff<Out>, Sqrt<Out>>;
+
+template <typename In, typename Out, typename Idx = uint32_t>
+using BlockedManhattan =
+    BlockedDistance<In, Out, Idx, AbsDiff<Out>, Identity<Out>>;
+
+template <typename In, typename Out, typename Idx = uint32_t>
+using BlockedCosine =
+    BlockedDistance<In, Out, Idx, Product<Out>, OneMinus<Out>, true>;
+
+template <typename In, typename Out, typename Idx = uint32_t>
+using BlockedInnerProduct =
+    BlockedDistance<In, Out, Idx, Product<Out>, Negate<Out>>;
+
+template <typename Distance> struct IsBlocked : std::false_type {};
+template <typename In, typename Out, typename Idx, typename Term,
+          typename Finish, bool Normalize>
+struct IsBlocked<BlockedDistance<In, Out, Idx, Term, Finish, Normalize>>
+    : std::true_type {};
+
+// The Term and Finish of the dense distances that can use block_distances, for
+// data which isn't stored blocked, e.g. the leaves of the search trees
+template <typename Distance> struct DenseTerms : std::false_type {};
+template <typename In, typename Out, typename Idx>
+struct DenseTerms<Euclidean<In, Out, Idx>> : std::true_type {
+  using Term = SquaredDiff<Out>;
+  using Finish = Sqrt<Out>;
+};
+template <typename In, typename Out, typename Idx>
+struct DenseTerms<L2Sqr<In, Out, Idx>> : std::true_type {
+  using Term = SquaredDiff<Out>;
+  using Finish = Identity<Out>;
+};
+template <typename In, typename Out, typename Idx>
+struct DenseTerms<Manhattan<In, Out, Idx>> : std::true_type {
+  using Term = AbsDiff<Out>;
+  using Finish = Identity<Out>;
+};
+
+// The brute force search of the queries begin to end, one block of the
+// reference data at a time, so each block is reused by all the queries
+template <typename In, typename Out, typename Idx, typename Term,
+          typename Finish, bool Normalize, typename NbrHeap>
+void nnbf_query(
+    NbrHeap &neighbor_heap,
+    BlockedDistance<In, Out, Idx, Term, Finish, Normalize> &distance,
+    std::size_t begin, std::size_t end) {
+  const std::size_t n_ref_points = distance.nx;
+  Out dist[blocked_size];
+  for (std::size_t b = 0; b < distance.x.n_blocks(); b++) {
+    const std::size_t ref_begin = b * blocked_size;
+    const std::size_t n_block_refs =
+        std::min(blocked_size, n_ref_points - ref_begin);
+    for (std::size_t query = begin; query < end; query++) {
+      distance.block(query, b, dist);
+      for (std::size_t r = 0; r < n_block_refs; r++) {
+        if (neighbor_heap.accepts(query, dist[r])) {
+          neighbor_heap.unchecked_push(query, dist[r], ref_begin + r);
+        }
+      }
+    }
+  }
+}
+
+} // namespace tdoann
+
+#endif // TDOANN_BLOCKED_H
@@ -29,17 +29,18 @@
 
 #include <vector>
 
+#include "blocked.h"
 #include "heap.h"
 #include "nngraph.h"
 #include "parallel.h"
+#include "pivots.h"
 #include "progress.h"
 
 namespace tdoann {
 
-template <typename Distance>
-void nnbf_query(
-    NNHeap<typename Distance::Output, typename Distance::Index> &neighbor_heap,
-    Distance &distance, std::size_t begin, std::size_t end) {
+template <typename Distance, typename NbrHeap>
+void nnbf_query(NbrHeap &neighbor_heap, Distance &distance, std::size_t begin,
+                std::size_t end) {
 
   std::size_t n_ref_points = distance.nx;
   for (std::size_t ref = 0; ref < n_ref_points; ref++) {
@@ -52,12 +53,13 @@ void nnbf_query(
   }
 }
 
-template <typename Distance, typename Progress, typename Parallel>
+template <typename Distance, typename Progress, typename Parallel,
+          typename NbrHeap =
+              NNHeap<typename Distance::Output, typename Distance::Index>>
 auto nnbf_query(Distance &distance, typename Distance::Index n_nbrs,
                 std::size_t n_threads = 0, bool verbose = false)
     -> NNGraph<typename Distance::Output, typename Distance::Index> {
-  NNHeap<typename Distance::Output, typename Distance::Index> neighbor_heap(
-      distance.ny, n_nbrs);
+  NbrHeap neighbor_heap(distance.ny, n_nbrs);
   auto worker = [&](std::size_t begin, std::size_t end) {
     nnbf_query(neighbor_heap, distance, begin, end);
   };
@@ -70,12 +72,13 @@ auto nnbf_query(Distance &distance, typename Distance::Index n_nbrs,
   return heap_to_graph(neighbor_heap);
 }
 
-template <typename Distance, typename Progress>
+template <typename Distance, typename Progress,
+          typename NbrHeap =
+              NNHeap<typename Distance::Output, typename Distance::Index>>
 auto nnbf_query(Distance &distance, typename Distance::Index n_nbrs,
                 bool verbose)
     -> NNGraph<typename Distance::Output, typename Distance::Index> {
-  NNHeap<typename Distance::Output, typename Distance::Index> neighbor_heap(
-      distance.ny, n_nbrs);
+  NbrHeap neighbor_heap(distance.ny, n_nbrs);
   auto worker = [&](std::size_t begin, std::size_t end) {
     nnbf_query(neighbor_heap, distance, begin, end);
   };
@@ -86,11 +89,9 @@ auto nnbf_query(Distance &distance, typename Distance::Index n_nbrs,
   return heap_to_graph(neighbor_heap);
 }
 
-template <typename Distance>
-void nnbf_impl(
-    Distance &distance, typename Distance::Index n_nbrs, bool verbose,
-    NNHeap<typename Distance::Output, typename Distance::Index> &neighbor_heap,
-    std::size_t begin, std::size_t end) {
+template <typename Distance, typename NbrHeap>
+void nnbf_impl(Distance &distance, typename Distance::Index n_nbrs, bool verbose,
+               NbrHeap &neighbor_heap, std::size_t begin, std::size_t end) {
   const std::size_t n = neighbor_heap.n_points;
 
   // Convert from the upper triangular index k back to i, j (including diagonal)
@@ -100,8 +101,22 @@ void nnbf_impl(
   // k = 4  -> i = 0, j = 4
   // k = 5  -> i = 1, j = 1
   // k = 14 -> i = 4, j = 4
-  std::size_t i = n - 1 - int(sqrt(-8 * begin + 4 * n * (n + 1) - 7) / 2 - 0.5);
-  std::size_t j = begin - n * (n - 1) / 2 + (n - i) * ((n - i) - 1) / 2;
+  const double nd = static_cast<double>(n);
+  std::size_t i =
+      n - 1 -
+      static_cast<std::size_t>(
+          sqrt(4.0 * nd * (nd + 1.0) - 8.0 * static_cast<double>(begin) - 7.0) /
+              2.0 -
+          0.5);
+  // for large n the double precision sqrt can be out by a row
+  auto row_begin = [n](std::size_t r) { return r * n - r * (r - 1) / 2; };
+  while (i > 0 && row_begin(i) > begin) {
+    --i;
+  }
+  while (i + 1 < n && row_begin(i + 1) <= begin) {
+    ++i;
+  }
+  std::size_t j = begin - row_begin(i) + i;
   for (std::size_t k = begin; k < end; k++) {
     typename Distance::Output d = distance(i, j);
     if (neighbor_heap.accepts(i, d)) {
@@ -118,19 +133,20 @@ void nnbf_impl(
   }
 }
 
-template <typename Distance, typename Progress, typename Parallel>
-auto brute_force_build(const std::vector<typename Distance::Input> &data,
-                       std::size_t ndim, typename Distance::Index n_nbrs,
+template <typename Distance, typename Progress, typename Parallel,
+          typename NbrHeap =
+              NNHeap<typename Distance::Output, typename Distance::Index>>
+auto brute_force_build(Distance &distance, typename Distance::Index n_nbrs,
                        std::size_t n_threads = 0, bool verbose = false)
     -> NNGraph<typename Distance::Output, typename Distance::Index> {
-  Distance distance(data, ndim);
-
   if (n_threads > 0) {
-    return nnbf_query<Distance, Progress, Parallel>(distance, n_nbrs, n_threads,
-                                                    verbose);
+    return nnbf_query<Distance, Progress, Parallel, NbrHeap>(
+        distance, n_nbrs, n_threads, verbose);
+  } else if (IsBlocked<Distance>::value) {
+    // blocked distances are calculated a block at a time, not pair by pair
+    return nnbf_query<Distance, Progress, NbrHeap>(distance, n_nbrs, verbose);
   } else {
-    NNHeap<typename Distance::Output, typename Distance::Index> neighbor_heap(
-        distance.ny, n_nbrs);
+    NbrHeap neighbor_heap(distance.ny, n_nbrs);
     auto worker = [&](std::size_t begin, std::size_t end) {
       nnbf_impl(distance, n_nbrs, verbose, neighbor_heap, begin, end);
     };
@@ -147,7 +163,65 @@ auto brute_force_build(const std::vector<typename Distance::Input> &data,
   }
 }
 
-template <typename Distance, typename Progress, typename Parallel>
+template <typename Distance, typename Progress, typename Parallel,
+          typename NbrHeap =
+              NNHeap<typename Distance::Output, typename Distance::Index>>
+auto brute_force_query(Distance &distance, typename Distance::Index n_nbrs,
+                       std::size_t n_threads = 0, bool verbose = false)
+    -> NNGraph<typename Distance::Output, typename Distance::Index> {
+  if (n_threads > 0) {
+    return nnbf_query<Distance, Progress, Parallel, NbrHeap>(
+        distance, n_nbrs, n_threads, verbose);
+  } else {
+    return nnbf_query<Distance, Progress, NbrHeap>(distance, n_nbrs, verbose);
+  }
+}
+
+// As brute_force_query, but skipping the reference items which bounds shows
+// can't be neighbors of a query. Bound converts a lower bound on the Euclidean
+// distance into a lower bound on the distance, e.g. L2SqrBound
+template <typename Distance, typename Bound, typename Progress,
+          typename Parallel,
+          typename NbrHeap =
+              NNHeap<typename Distance::Output, typename Distance::Index>>
+auto brute_force_query(Distance &distance,
+                       const PivotBounds<typename Distance::Index> &bounds,
+                       typename Distance::Index n_nbrs,
+                       std::size_t n_threads = 0, bool verbose = false)
+    -> NNGraph<typename Distance::Output, typename Distance::Index> {
+  NbrHeap neighbor_heap(distance.ny, n_nbrs);
+  auto worker = [&](std::size_t begin, std::size_t end) {
+    nnbf_query<Bound>(neighbor_heap, distance, bounds, begin, end);
+  };
+  Progress progress(1, verbose);
+  const std::size_t block_size = 64;
+  if (n_threads > 0) {
+    const std::size_t grain_size = 1;
+    batch_parallel_for<Parallel>(worker, progress, neighbor_heap.n_points,
+                                 block_size, n_threads, grain_size);
+    sort_heap(neighbor_heap, block_size, n_threads, grain_size);
+  } else {
+    batch_serial_for(worker, progress, neighbor_heap.n_points, block_size);
+    sort_heap(neighbor_heap);
+  }
+  return heap_to_graph(neighbor_heap);
+}
+
+template <typename Distance, typename Progress, typename Parallel,
+          typename NbrHeap =
+              NNHeap<typename Distance::Output, typename Distance::Index>>
+auto brute_force_build(const std::vector<typename Distance::Input> &data,
+                       std::size_t ndim, typename Distance::Index n_nbrs,
+                       std::size_t n_threads = 0, bool verbose = false)
+    -> NNGraph<typename Distance::Output, typename Distance::Index> {
+  Distance distance(data, ndim);
+  return brute_force_build<Distance, Progress, Parallel, NbrHeap>(
+      distance, n_nbrs, n_threads, verbose);
+}
+
+template <typename Distance, typename Progress, typename Parallel,
+          typename NbrHeap =
+              NNHeap<typename Distance::Output, typename Distance::Index>>
 auto brute_force_query(const std::vector<typename Distance::Input> &reference,
                        std::size_t ndim,
                        const std::vector<typename Distance::Input> &query,
@@ -155,13 +229,8 @@ auto brute_force_query(const std::vector<typename Distance::Input> &reference,
                        std::size_t n_threads = 0, bool verbose = false)
     -> NNGraph<typename Distance::Output, typename Distance::Index> {
   Distance distance(reference, query, ndim);
-
-  if (n_threads > 0) {
-    return nnbf_query<Distance, Progress, Parallel>(distance, n_nbrs, n_threads,
-                                                    verbose);
-  } else {
-    return nnbf_query<Distance, Progress>(distance, n_nbrs, verbose);
-  }
+  return brute_force_query<Distance, Progress, Parallel, NbrHeap>(
+      distance, n_nbrs, n_threads, verbose);
 }
 
 } // namespace tdoann
@@ -0,0 +1,127 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_BUDGET_H
+#define TDOANN_BUDGET_H
+
+#include <chrono>
+#include <sstream>
+#include <string>
+
+namespace tdoann {
+
+// Limits on the work an optimization is allowed to do: max_time is the
+// wall-clock time in seconds since the budget was created and max_dist_evals
+// is the number of distance calculations. A limit of zero means no limit.
+// Once either limit is reached the budget stays exhausted.
+struct Budget {
+  using Clock = std::chrono::steady_clock;
+
+  double max_time;
+  double max_dist_evals;
+  Clock::time_point start;
+  double n_dist_evals;
+  bool exhausted;
+  std::string reason;
+
+  Budget(double max_time = 0.0, double max_dist_evals = 0.0)
+      : max_time(max_time), max_dist_evals(max_dist_evals),
+        start(Clock::now()), n_dist_evals(0.0), exhausted(false) {}
+
+  auto unlimited() const -> bool {
+    return max_time <= 0.0 && max_dist_evals <= 0.0;
+  }
+
+  auto elapsed() const -> double {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  void add_dist_evals(std::size_t n) {
+    n_dist_evals += static_cast<double>(n);
+  }
+
+  // returns true if the budget is exhausted
+  auto check() -> bool {
+    if (exhausted || unlimited()) {
+      return exhausted;
+    }
+    std::ostringstream os;
+    if (max_dist_evals > 0.0 && n_dist_evals >= max_dist_evals) {
+      os << "distance calculations = " << n_dist_evals
+         << " max = " << max_dist_evals;
+    } else if (max_time > 0.0 && elapsed() >= max_time) {
+      os << "time = " << elapsed() << "s max = " << max_time << "s";
+    } else {
+      return false;
+    }
+    exhausted = true;
+    reason = os.str();
+    return true;
+  }
+};
+
+// Wraps one of the NND progress types, treating an exhausted budget like an
+// interruption, so the optimization stops at the end of the current block and
+// the current graph is returned. The distance calculations are reported via
+// dist_evals.
+template <typename NNDProg> struct BudgetProgress {
+  NNDProg progress;
+  Budget &budget;
+
+  BudgetProgress(NNDProg &progress, Budget &budget)
+      : progress(progress), budget(budget) {}
+  void set_n_blocks(std::size_t n) { progress.set_n_blocks(n); }
+  void block_finished() { progress.block_finished(); }
+  void iter_finished() { progress.iter_finished(); }
+  void stopping_early() { progress.stopping_early(); }
+  auto check_interrupt() -> bool {
+    if (progress.check_interrupt()) {
+      return true;
+    }
+    if (budget.exhausted) {
+      return true;
+    }
+    if (budget.check()) {
+      progress.stopping_early();
+      log("Budget exhausted: " + budget.reason);
+      return true;
+    }
+    return false;
+  }
+  void converged(std::size_t n_updates, double tol) {
+    progress.converged(n_updates, tol);
+  }
+  void log(const std::string &msg) { progress.log(msg); }
+  template <typename NeighborHeap>
+  void heap_report(const NeighborHeap &neighbor_heap) {
+    progress.heap_report(neighbor_heap);
+  }
+  auto target_reached() -> bool { return progress.target_reached(); }
+  void dist_evals(std::size_t n) { budget.add_dist_evals(n); }
+};
+
+} // namespace tdoann
+#endif // TDOANN_BUDGET_H
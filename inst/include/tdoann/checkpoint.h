@@ -0,0 +1,229 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_CHECKPOINT_H
+#define TDOANN_CHECKPOINT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace tdoann {
+
+// Saves and restores the state of nearest neighbor descent at the end of an
+// iteration: the neighbor heap including its flags, the number of iterations
+// carried out, the state of the random number generator and the items used to
+// estimate the recall (each as a vector of 32-bit integers supplied by the
+// caller). The heap data is written in the native byte order, so a checkpoint
+// can only be read on the same type of platform that wrote it.
+
+struct NNDCheckpointHeader {
+  uint32_t index_size{0};
+  uint32_t distance_size{0};
+  uint64_t n_points{0};
+  uint64_t n_nbrs{0};
+  uint64_t n_iters_done{0};
+  uint64_t rng_state_size{0};
+  uint64_t recall_ids_size{0};
+};
+
+// identifies the file type and the version of its layout
+constexpr auto checkpoint_magic() -> const char * { return "TDOANNCK"; }
+constexpr auto checkpoint_version() -> uint32_t { return 2; }
+
+template <typename T> void write_value(std::ostream &os, const T &value) {
+  os.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T> auto read_value(std::istream &is, T &value) -> bool {
+  is.read(reinterpret_cast<char *>(&value), sizeof(T));
+  return static_cast<bool>(is);
+}
+
+// Returns false if the file can't be read or isn't a checkpoint
+inline auto read_nnd_checkpoint_header(std::istream &is,
+                                       NNDCheckpointHeader &header) -> bool {
+  char magic[8];
+  is.read(magic, sizeof(magic));
+  if (!is || std::memcmp(magic, checkpoint_magic(), sizeof(magic)) != 0) {
+    return false;
+  }
+  uint32_t version = 0;
+  if (!read_value(is, version) || version != checkpoint_version()) {
+    return false;
+  }
+  return read_value(is, header.index_size) &&
+         read_value(is, header.distance_size) &&
+         read_value(is, header.n_points) && read_value(is, header.n_nbrs) &&
+         read_value(is, header.n_iters_done) &&
+         read_value(is, header.rng_state_size) &&
+         read_value(is, header.recall_ids_size);
+}
+
+inline auto read_int32s(std::istream &is, std::vector<int32_t> &values,
+                        uint64_t n) -> bool {
+  values.resize(n);
+  for (auto &value : values) {
+    if (!read_value(is, value)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Reads everything but the heap
+inline auto read_nnd_checkpoint_state(std::istream &is,
+                                      NNDCheckpointHeader &header,
+                                      std::vector<int32_t> &rng_state,
+                                      std::vector<int32_t> &recall_ids)
+    -> bool {
+  return read_nnd_checkpoint_header(is, header) &&
+         read_int32s(is, rng_state, header.rng_state_size) &&
+         read_int32s(is, recall_ids, header.recall_ids_size);
+}
+
+inline auto read_nnd_checkpoint_state(const std::string &filename,
+                                      NNDCheckpointHeader &header,
+                                      std::vector<int32_t> &rng_state,
+                                      std::vector<int32_t> &recall_ids)
+    -> bool {
+  std::ifstream is(filename, std::ios::binary);
+  return is && read_nnd_checkpoint_state(is, header, rng_state, recall_ids);
+}
+
+inline auto read_nnd_checkpoint_header(const std::string &filename,
+                                       NNDCheckpointHeader &header) -> bool {
+  std::ifstream is(filename, std::ios::binary);
+  return is && read_nnd_checkpoint_header(is, header);
+}
+
+// The checkpoint is written to a temporary file which then replaces filename,
+// so an existing checkpoint is never left half-written. Returns false if the
+// file could not be written.
+template <typename NbrHeap>
+auto save_nnd_checkpoint(const std::string &filename, const NbrHeap &heap,
+                         std::size_t n_iters_done,
+                         const std::vector<int32_t> &rng_state,
+                         const std::vector<int32_t> &recall_ids) -> bool {
+  using Idx = typename NbrHeap::Index;
+  using DistOut = typename NbrHeap::DistanceOut;
+
+  const std::string tmp_filename = filename + ".tmp";
+  {
+    std::ofstream os(tmp_filename, std::ios::binary | std::ios::trunc);
+    if (!os) {
+      return false;
+    }
+    os.write(checkpoint_magic(), 8);
+    write_value(os, checkpoint_version());
+    write_value(os, static_cast<uint32_t>(sizeof(Idx)));
+    write_value(os, static_cast<uint32_t>(sizeof(DistOut)));
+    write_value(os, static_cast<uint64_t>(heap.n_points));
+    write_value(os, static_cast<uint64_t>(heap.n_nbrs));
+    write_value(os, static_cast<uint64_t>(n_iters_done));
+    write_value(os, static_cast<uint64_t>(rng_state.size()));
+    write_value(os, static_cast<uint64_t>(recall_ids.size()));
+    for (auto state : rng_state) {
+      write_value(os, state);
+    }
+    for (auto id : recall_ids) {
+      write_value(os, id);
+    }
+
+    // rows are written in heap order, so that the restored heap is identical
+    const std::size_t n_points = heap.n_points;
+    const std::size_t n_nbrs = heap.n_nbrs;
+    for (std::size_t i = 0; i < n_points; i++) {
+      for (std::size_t j = 0; j < n_nbrs; j++) {
+        write_value(os, heap.index(i, j));
+        write_value(os, heap.distance(i, j));
+        write_value(os, heap.flag(i, j));
+      }
+    }
+    if (!os) {
+      return false;
+    }
+  }
+  if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    // renaming over an existing file fails on some platforms
+    std::remove(filename.c_str());
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// heap must have the same dimensions and types as the saved heap. Returns
+// false if the file could not be read or doesn't match the heap.
+template <typename NbrHeap>
+auto load_nnd_checkpoint(const std::string &filename, NbrHeap &heap,
+                         std::size_t &n_iters_done,
+                         std::vector<int32_t> &rng_state,
+                         std::vector<int32_t> &recall_ids) -> bool {
+  using Idx = typename NbrHeap::Index;
+  using DistOut = typename NbrHeap::DistanceOut;
+
+  std::ifstream is(filename, std::ios::binary);
+  NNDCheckpointHeader header;
+  if (!is || !read_nnd_checkpoint_state(is, header, rng_state, recall_ids) ||
+      header.index_size != sizeof(Idx) ||
+      header.distance_size != sizeof(DistOut) ||
+      header.n_points != static_cast<uint64_t>(heap.n_points) ||
+      header.n_nbrs != static_cast<uint64_t>(heap.n_nbrs)) {
+    return false;
+  }
+
+  const std::size_t n_points = heap.n_points;
+  const std::size_t n_nbrs = heap.n_nbrs;
+  for (std::size_t i = 0; i < n_points; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      Idx index = 0;
+      DistOut d = 0;
+      char flag = 0;
+      if (!read_value(is, index) || !read_value(is, d) ||
+          !read_value(is, flag)) {
+        return false;
+      }
+      heap.set(i, j, d, index, flag);
+    }
+  }
+  n_iters_done = header.n_iters_done;
+  return true;
+}
+
+// Null object for when no checkpoints are wanted
+struct NullCheckpoint {
+  auto start_iter() const -> std::size_t { return 0; }
+  template <typename NbrHeap>
+  void iter_finished(const NbrHeap &, std::size_t) {}
+};
+
+} // namespace tdoann
+#endif // TDOANN_CHECKPOINT_H
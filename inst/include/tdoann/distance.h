@@ -27,11 +27,168 @@
 #ifndef TDOANN_DISTANCE_H
 #define TDOANN_DISTANCE_H
 
+#include <cmath>
+#include <type_traits>
 #include <vector>
 
 #include "bitvec.h"
+#include "halffloat.h"
+#include "quantize.h"
 
 namespace tdoann {
+
+// Each distance functor can calculate the distances from many items to one item
+// at once: batch(j, is, n, out) sets out[k] to the distance between is[k] (an
+// item in x) and j (an item in y) for k in [0, n), i.e. out[k] is the same as
+// calling the functor with (is[k], j). Callers should gather all the distances
+// they need to one item into a single call: the row of j is only looked up
+// once, and the row of each is[k] is fetched while the previous distance is
+// being calculated.
+
+// Hint that the memory at ptr will soon be read
+template <typename T> inline void prefetch(const T *ptr) {
+#if defined(__GNUC__)
+  __builtin_prefetch(ptr);
+#else
+  (void)ptr;
+#endif
+}
+
+// The sum of term(x[d], y[d]) over the ndim dimensions d
+template <typename Out, typename In, typename Term>
+auto dense_sum(const In *x, const In *y, std::size_t ndim, Term term) -> Out {
+  Out sum = 0.0;
+  for (std::size_t d = 0; d < ndim; d++) {
+    sum += term(x[d], y[d]);
+  }
+  return sum;
+}
+
+// For 16-bit data, blocks of dimensions are converted to float and each
+// dimension in the block is accumulated into its own sum, so the conversions
+// and the arithmetic of the block are independent of each other
+template <typename Out, typename Half, typename Term>
+auto half_dense_sum(const Half *x, const Half *y, std::size_t ndim, Term term)
+    -> Out {
+  constexpr std::size_t block_size = 8;
+  float xb[block_size];
+  float yb[block_size];
+  Out sums[block_size] = {};
+  std::size_t d = 0;
+  for (; d + block_size <= ndim; d += block_size) {
+    for (std::size_t b = 0; b < block_size; b++) {
+      xb[b] = x[d + b];
+      yb[b] = y[d + b];
+    }
+    for (std::size_t b = 0; b < block_size; b++) {
+      sums[b] += term(xb[b], yb[b]);
+    }
+  }
+  Out sum = 0.0;
+  for (std::size_t b = 0; b < block_size; b++) {
+    sum += sums[b];
+  }
+  for (; d < ndim; d++) {
+    sum += term(static_cast<float>(x[d]), static_cast<float>(y[d]));
+  }
+  return sum;
+}
+
+template <typename Out, typename Term>
+auto dense_sum(const Float16 *x, const Float16 *y, std::size_t ndim,
+               Term term) -> Out {
+  return half_dense_sum<Out>(x, y, ndim, term);
+}
+
+template <typename Out, typename Term>
+auto dense_sum(const BFloat16 *x, const BFloat16 *y, std::size_t ndim,
+               Term term) -> Out {
+  return half_dense_sum<Out>(x, y, ndim, term);
+}
+
+// The batched distance between the rows is[k] of x and the row j of y for
+// distances of the form finish(sum of term(x_d, y_d) over the dimensions d)
+template <typename In, typename Out, typename Idx, typename Term,
+          typename Finish>
+void dense_batch(const std::vector<In> &x, const std::vector<In> &y,
+                 std::size_t ndim, Idx j, const Idx *is, std::size_t n,
+                 Out *out, Term term, Finish finish) {
+  if (n == 0) {
+    return;
+  }
+  const In *yj = &y[ndim * j];
+  prefetch(&x[ndim * is[0]]);
+  for (std::size_t k = 0; k < n; k++) {
+    if (k + 1 < n) {
+      prefetch(&x[ndim * is[k + 1]]);
+    }
+    out[k] = finish(dense_sum<Out>(&x[ndim * is[k]], yj, ndim, term));
+  }
+}
+
+template <typename Out> struct SquaredDiff {
+  template <typename In> auto operator()(In xd, In yd) const -> Out {
+    Out diff = xd - yd;
+    return diff * diff;
+  }
+};
+
+template <typename Out> struct AbsDiff {
+  template <typename In> auto operator()(In xd, In yd) const -> Out {
+    return std::abs(xd - yd);
+  }
+};
+
+template <typename Out> struct Product {
+  template <typename In> auto operator()(In xd, In yd) const -> Out {
+    return xd * yd;
+  }
+};
+
+// The product of x_d and y_d after subtracting the mean of their rows
+template <typename Out> struct CenteredProduct {
+  Out xmean;
+  Out ymean;
+
+  template <typename In> auto operator()(In xd, In yd) const -> Out {
+    return (xd - xmean) * (yd - ymean);
+  }
+};
+
+template <typename Out> struct Identity {
+  auto operator()(Out sum) const -> Out { return sum; }
+};
+
+template <typename Out> struct Sqrt {
+  auto operator()(Out sum) const -> Out { return std::sqrt(sum); }
+};
+
+template <typename Out> struct OneMinus {
+  auto operator()(Out sum) const -> Out { return 1.0 - sum; }
+};
+
+template <typename Out> struct Negate {
+  auto operator()(Out sum) const -> Out { return -sum; }
+};
+
+// Gathers the items whose distances to one item are needed, so they can be
+// calculated with one call to batch. Reusing the same DistanceBatch avoids
+// reallocating its storage
+template <typename Out, typename Idx> struct DistanceBatch {
+  std::vector<Idx> idx;
+  std::vector<Out> dist;
+
+  void clear() { idx.clear(); }
+  void add(Idx i) { idx.push_back(i); }
+  auto size() const -> std::size_t { return idx.size(); }
+
+  // the distances from each gathered item to j end up in dist
+  template <typename Distance> void calculate(const Distance &distance, Idx j) {
+    dist.resize(idx.size());
+    distance.batch(j, idx.data(), idx.size(), dist.data());
+  }
+};
+
 template <typename In, typename Out, typename Idx = uint32_t> struct Euclidean {
   Euclidean(const std::vector<In> &data, std::size_t ndim)
       : x(data), y(data), ndim(ndim), nx(data.size() / ndim),
@@ -42,16 +199,12 @@ template <typename In, typename Out, typename Idx = uint32_t> struct Euclidean {
       : x(x), y(y), ndim(ndim), nx(x.size() / ndim), ny(y.size() / ndim) {}
 
   auto operator()(Idx i, Idx j) const -> Out {
-    Out sum = 0.0;
-    std::size_t di = ndim * i;
-    std::size_t dj = ndim * j;
-
-    for (std::size_t d = 0; d < ndim; d++) {
-      Out diff = x[di + d] - y[dj + d];
-      sum += diff * diff;
-    }
+    return std::sqrt(
+        dense_sum<Out>(&x[ndim * i], &y[ndim * j], ndim, SquaredDiff<Out>()));
+  }
 
-    return std::sqrt(sum);
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    dense_batch(x, y, ndim, j, is, n, out, SquaredDiff<Out>(), Sqrt<Out>());
   }
 
   const std::vector<In> x;
@@ -73,16 +226,12 @@ template <typename In, typename Out, typename Idx = uint32_t> struct L2Sqr {
       : x(x), y(y), ndim(ndim), nx(x.size() / ndim), ny(y.size() / ndim) {}
 
   auto operator()(Idx i, Idx j) const -> Out {
-    Out sum = 0.0;
-    std::size_t di = ndim * i;
-    std::size_t dj = ndim * j;
-
-    for (std::size_t d = 0; d < ndim; d++) {
-      Out diff = x[di + d] - y[dj + d];
-      sum += diff * diff;
-    }
+    return dense_sum<Out>(&x[ndim * i], &y[ndim * j], ndim, SquaredDiff<Out>());
+  }
 
-    return sum;
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    dense_batch(x, y, ndim, j, is, n, out, SquaredDiff<Out>(),
+                Identity<Out>());
   }
 
   const std::vector<In> x;
@@ -99,19 +248,20 @@ template <typename In, typename Out, typename Idx = uint32_t> struct L2Sqr {
 // relies on NRVO to avoid a copy
 template <typename T>
 auto normalize(const std::vector<T> &vec, std::size_t ndim) -> std::vector<T> {
+  using Compute = typename ComputeType<T>::type;
   std::vector<T> normalized(vec.size());
   std::size_t npoints = vec.size() / ndim;
   for (std::size_t i = 0; i < npoints; i++) {
     std::size_t di = ndim * i;
-    T norm = 0.0;
+    Compute norm = 0.0;
 
     for (std::size_t d = 0; d < ndim; d++) {
-      auto val = vec[di + d];
+      Compute val = vec[di + d];
       norm += val * val;
     }
     norm = std::sqrt(norm) + 1e-30;
     for (std::size_t d = 0; d < ndim; d++) {
-      normalized[di + d] = vec[di + d] / norm;
+      normalized[di + d] = static_cast<Compute>(vec[di + d]) / norm;
     }
   }
   return normalized;
@@ -120,15 +270,7 @@ auto normalize(const std::vector<T> &vec, std::size_t ndim) -> std::vector<T> {
 template <typename In, typename Out, typename Idx = uint32_t>
 auto cosine_impl(const std::vector<In> &x, Idx i, const std::vector<In> &y,
                  Idx j, std::size_t ndim) -> Out {
-  std::size_t di = ndim * i;
-  std::size_t dj = ndim * j;
-
-  Out sum = 0.0;
-  for (std::size_t d = 0; d < ndim; d++) {
-    sum += x[di + d] * y[dj + d];
-  }
-
-  return 1.0 - sum;
+  return 1.0 - dense_sum<Out>(&x[ndim * i], &y[ndim * j], ndim, Product<Out>());
 }
 
 template <typename In, typename Out, typename Idx = uint32_t>
@@ -145,6 +287,10 @@ struct CosineSelf {
     return cosine_impl<In, Out, Idx>(x, i, x, j, ndim);
   }
 
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    dense_batch(x, x, ndim, j, is, n, out, Product<Out>(), OneMinus<Out>());
+  }
+
   using Input = In;
   using Output = Out;
   using Index = Idx;
@@ -167,9 +313,219 @@ struct CosineQuery {
     return cosine_impl<In, Out, Idx>(x_, i, y_, j, ndim);
   }
 
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    dense_batch(x_, y_, ndim, j, is, n, out, Product<Out>(), OneMinus<Out>());
+  }
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+};
+
+// The mean of each row and the inverse of the norm of each row once its mean
+// is subtracted, so the correlation distance can be calculated from the
+// uncentered data
+template <typename Out> struct RowMoments {
+  std::vector<Out> mean;
+  std::vector<Out> inv_norm;
+
+  template <typename In>
+  RowMoments(const std::vector<In> &vec, std::size_t ndim)
+      : mean(vec.size() / ndim), inv_norm(vec.size() / ndim) {
+    using Compute = typename ComputeType<In>::type;
+    for (std::size_t i = 0; i < mean.size(); i++) {
+      std::size_t di = ndim * i;
+      Compute sum = 0.0;
+      for (std::size_t d = 0; d < ndim; d++) {
+        sum += static_cast<Compute>(vec[di + d]);
+      }
+      Compute row_mean = sum / ndim;
+      Compute norm = 0.0;
+      for (std::size_t d = 0; d < ndim; d++) {
+        Compute val = static_cast<Compute>(vec[di + d]) - row_mean;
+        norm += val * val;
+      }
+      mean[i] = row_mean;
+      inv_norm[i] = 1.0 / (std::sqrt(norm) + 1e-30);
+    }
+  }
+};
+
+template <typename In, typename Out, typename Idx = uint32_t>
+auto correlation_impl(const std::vector<In> &x, const RowMoments<Out> &xm,
+                      Idx i, const std::vector<In> &y,
+                      const RowMoments<Out> &ym, Idx j, std::size_t ndim)
+    -> Out {
+  return 1.0 - dense_sum<Out>(&x[ndim * i], &y[ndim * j], ndim,
+                              CenteredProduct<Out>{xm.mean[i], ym.mean[j]}) *
+                   xm.inv_norm[i] * ym.inv_norm[j];
+}
+
+template <typename In, typename Out, typename Idx>
+void correlation_batch(const std::vector<In> &x, const RowMoments<Out> &xm,
+                       const std::vector<In> &y, const RowMoments<Out> &ym,
+                       std::size_t ndim, Idx j, const Idx *is, std::size_t n,
+                       Out *out) {
+  if (n == 0) {
+    return;
+  }
+  prefetch(&x[ndim * is[0]]);
+  for (std::size_t k = 0; k < n; k++) {
+    if (k + 1 < n) {
+      prefetch(&x[ndim * is[k + 1]]);
+    }
+    out[k] = correlation_impl(x, xm, is[k], y, ym, j, ndim);
+  }
+}
+
+// 1 minus the Pearson correlation, i.e. the cosine distance of the centered
+// rows, with the centering applied as the distance is calculated rather than
+// to a copy of the data
+template <typename In, typename Out, typename Idx = uint32_t>
+struct CorrelationSelf {
+  const std::vector<In> x;
+  const RowMoments<Out> xm;
+  std::size_t ndim;
+  Idx nx;
+  Idx ny;
+
+  CorrelationSelf(const std::vector<In> &data, std::size_t ndim)
+      : x(data), xm(data, ndim), ndim(ndim), nx(data.size() / ndim), ny(nx) {}
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    return correlation_impl(x, xm, i, x, xm, j, ndim);
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    correlation_batch(x, xm, x, xm, ndim, j, is, n, out);
+  }
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+};
+
+template <typename In, typename Out, typename Idx = uint32_t>
+struct CorrelationQuery {
+  const std::vector<In> x;
+  const std::vector<In> y;
+  const RowMoments<Out> xm;
+  const RowMoments<Out> ym;
+  std::size_t ndim;
+  Idx nx;
+  Idx ny;
+
+  CorrelationQuery(const std::vector<In> &x, const std::vector<In> &y,
+                   std::size_t ndim)
+      : x(x), y(y), xm(x, ndim), ym(y, ndim), ndim(ndim), nx(x.size() / ndim),
+        ny(y.size() / ndim) {}
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    return correlation_impl(x, xm, i, y, ym, j, ndim);
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    correlation_batch(x, xm, y, ym, ndim, j, is, n, out);
+  }
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+};
+
+// The negative inner product, so that the items with the largest inner
+// product are the nearest
+template <typename In, typename Out, typename Idx = uint32_t>
+struct InnerProduct {
+  InnerProduct(const std::vector<In> &data, std::size_t ndim)
+      : x(data), y(data), ndim(ndim), nx(data.size() / ndim),
+        ny(data.size() / ndim) {}
+  InnerProduct(const std::vector<In> &x, const std::vector<In> &y,
+               std::size_t ndim)
+      : x(x), y(y), ndim(ndim), nx(x.size() / ndim), ny(y.size() / ndim) {}
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    return -dense_sum<Out>(&x[ndim * i], &y[ndim * j], ndim, Product<Out>());
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    dense_batch(x, y, ndim, j, is, n, out, Product<Out>(), Negate<Out>());
+  }
+
+  const std::vector<In> x;
+  const std::vector<In> y;
+  std::size_t ndim;
+  Idx nx;
+  Idx ny;
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+};
+
+template <typename In, typename Out>
+auto squared_norms(const std::vector<In> &vec, std::size_t ndim)
+    -> std::vector<Out> {
+  std::vector<Out> norms(vec.size() / ndim);
+  for (std::size_t i = 0; i < norms.size(); i++) {
+    norms[i] = dense_sum<Out>(&vec[ndim * i], &vec[ndim * i], ndim,
+                              Product<Out>());
+  }
+  return norms;
+}
+
+// offset - 2 * sum, which can be slightly negative due to rounding
+template <typename Out> struct ReducedL2Sqr {
+  Out offset;
+
+  auto operator()(Out sum) const -> Out {
+    Out dist = offset - 2.0 * sum;
+    return dist > 0 ? dist : 0;
+  }
+};
+
+// Maximum inner product search reduced to a squared Euclidean distance search.
+// Each row of x is extended by one dimension with the value
+// sqrt(M^2 - |x_i|^2), where M is the largest norm of a row of x, and each row
+// of y with 0, so the squared Euclidean distance between the extended rows,
+// M^2 + |y_j|^2 - 2 x_i . y_j, orders the rows of x in the same way as
+// InnerProduct, but is a non-negative distance that graph search can bound.
+// The extended rows are never stored
+template <typename In, typename Out, typename Idx = uint32_t>
+struct InnerProductL2 {
+  const std::vector<In> x;
+  const std::vector<In> y;
+  const std::vector<Out> y_sq_norms;
+  Out max_x_sq_norm;
+  std::size_t ndim;
+  Idx nx;
+  Idx ny;
+
+  InnerProductL2(const std::vector<In> &x, const std::vector<In> &y,
+                 std::size_t ndim)
+      : x(x), y(y), y_sq_norms(squared_norms<In, Out>(y, ndim)),
+        max_x_sq_norm(0), ndim(ndim), nx(x.size() / ndim), ny(y.size() / ndim) {
+    for (const auto &x_sq_norm : squared_norms<In, Out>(x, ndim)) {
+      if (x_sq_norm > max_x_sq_norm) {
+        max_x_sq_norm = x_sq_norm;
+      }
+    }
+  }
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    return ReducedL2Sqr<Out>{max_x_sq_norm + y_sq_norms[j]}(
+        dense_sum<Out>(&x[ndim * i], &y[ndim * j], ndim, Product<Out>()));
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    dense_batch(x, y, ndim, j, is, n, out, Product<Out>(),
+                ReducedL2Sqr<Out>{max_x_sq_norm + y_sq_norms[j]});
+  }
+
   using Input = In;
   using Output = Out;
   using Index = Idx;
+  using Exact = InnerProduct<In, Out, Idx>;
 };
 
 template <typename In, typename Out, typename Idx = uint32_t> struct Manhattan {
@@ -181,15 +537,11 @@ template <typename In, typename Out, typename Idx = uint32_t> struct Manhattan {
       : x(x), y(y), ndim(ndim), nx(x.size() / ndim), ny(y.size() / ndim) {}
 
   auto operator()(Idx i, Idx j) const -> Out {
-    Out sum = 0.0;
-    std::size_t di = ndim * i;
-    std::size_t dj = ndim * j;
-
-    for (std::size_t d = 0; d < ndim; d++) {
-      sum += std::abs(x[di + d] - y[dj + d]);
-    }
+    return dense_sum<Out>(&x[ndim * i], &y[ndim * j], ndim, AbsDiff<Out>());
+  }
 
-    return sum;
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    dense_batch(x, y, ndim, j, is, n, out, AbsDiff<Out>(), Identity<Out>());
   }
 
   const std::vector<In> x;
@@ -203,6 +555,200 @@ template <typename In, typename Out, typename Idx = uint32_t> struct Manhattan {
   using Index = Idx;
 };
 
+// The batched distance between the rows is[k] of the codes of x and the row j
+// of the codes of y for distances of the form finish(sum of the codes)
+template <typename Out, typename Idx, typename Sum, typename Finish>
+void code_batch(const QuantizedData &codes, Idx j, const Idx *is,
+                std::size_t n, Out *out, Sum sum, Finish finish) {
+  if (n == 0) {
+    return;
+  }
+  const uint8_t *yj = codes.yrow(j);
+  prefetch(codes.xrow(is[0]));
+  for (std::size_t k = 0; k < n; k++) {
+    if (k + 1 < n) {
+      prefetch(codes.xrow(is[k + 1]));
+    }
+    out[k] = finish(sum(codes.xrow(is[k]), yj, codes.ndim));
+  }
+}
+
+template <typename Out> struct Scaled {
+  Out scale;
+  auto operator()(uint64_t sum) const -> Out { return scale * sum; }
+};
+
+template <typename Out> struct ScaledSqrt {
+  Out scale;
+  auto operator()(uint64_t sum) const -> Out {
+    return scale * std::sqrt(static_cast<Out>(sum));
+  }
+};
+
+// Distances calculated from the data quantized to one byte per dimension, which
+// are only approximate: the neighbors found with them should be re-ranked with
+// the Exact distance. Only the codes are stored
+template <typename In, typename Out, typename Idx = uint32_t>
+struct QuantizedL2Sqr {
+  QuantizedL2Sqr(const std::vector<In> &data, std::size_t ndim)
+      : codes(data, ndim),
+        finish{codes.quantizer.scale * codes.quantizer.scale}, nx(codes.nx),
+        ny(codes.ny) {}
+  QuantizedL2Sqr(const std::vector<In> &x, const std::vector<In> &y,
+                 std::size_t ndim)
+      : codes(x, y, ndim),
+        finish{codes.quantizer.scale * codes.quantizer.scale}, nx(codes.nx),
+        ny(codes.ny) {}
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    return finish(CodeL2Sqr()(codes.xrow(i), codes.yrow(j), codes.ndim));
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    code_batch(codes, j, is, n, out, CodeL2Sqr(), finish);
+  }
+
+  const QuantizedData codes;
+  const Scaled<Out> finish;
+  Idx nx;
+  Idx ny;
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+  using Exact = L2Sqr<In, Out, Idx>;
+};
+
+template <typename In, typename Out, typename Idx = uint32_t>
+struct QuantizedEuclidean {
+  QuantizedEuclidean(const std::vector<In> &data, std::size_t ndim)
+      : codes(data, ndim), finish{codes.quantizer.scale}, nx(codes.nx),
+        ny(codes.ny) {}
+  QuantizedEuclidean(const std::vector<In> &x, const std::vector<In> &y,
+                     std::size_t ndim)
+      : codes(x, y, ndim), finish{codes.quantizer.scale}, nx(codes.nx),
+        ny(codes.ny) {}
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    return finish(CodeL2Sqr()(codes.xrow(i), codes.yrow(j), codes.ndim));
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    code_batch(codes, j, is, n, out, CodeL2Sqr(), finish);
+  }
+
+  const QuantizedData codes;
+  const ScaledSqrt<Out> finish;
+  Idx nx;
+  Idx ny;
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+  using Exact = Euclidean<In, Out, Idx>;
+};
+
+template <typename In, typename Out, typename Idx = uint32_t>
+struct QuantizedManhattan {
+  QuantizedManhattan(const std::vector<In> &data, std::size_t ndim)
+      : codes(data, ndim), finish{codes.quantizer.scale}, nx(codes.nx),
+        ny(codes.ny) {}
+  QuantizedManhattan(const std::vector<In> &x, const std::vector<In> &y,
+                     std::size_t ndim)
+      : codes(x, y, ndim), finish{codes.quantizer.scale}, nx(codes.nx),
+        ny(codes.ny) {}
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    return finish(CodeL1()(codes.xrow(i), codes.yrow(j), codes.ndim));
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    code_batch(codes, j, is, n, out, CodeL1(), finish);
+  }
+
+  const QuantizedData codes;
+  const Scaled<Out> finish;
+  Idx nx;
+  Idx ny;
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+  using Exact = Manhattan<In, Out, Idx>;
+};
+
+// For normalized vectors, the cosine distance is half the squared Euclidean
+// distance, so the quantized cosine distances use the same sum of the codes
+template <typename In, typename Out, typename Idx = uint32_t>
+struct QuantizedCosineSelf {
+  QuantizedCosineSelf(const std::vector<In> &data, std::size_t ndim)
+      : codes(normalize(data, ndim), ndim),
+        finish{0.5F * codes.quantizer.scale * codes.quantizer.scale},
+        nx(codes.nx), ny(codes.ny) {}
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    return finish(CodeL2Sqr()(codes.xrow(i), codes.yrow(j), codes.ndim));
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    code_batch(codes, j, is, n, out, CodeL2Sqr(), finish);
+  }
+
+  const QuantizedData codes;
+  const Scaled<Out> finish;
+  Idx nx;
+  Idx ny;
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+  using Exact = CosineSelf<In, Out, Idx>;
+};
+
+template <typename In, typename Out, typename Idx = uint32_t>
+struct QuantizedCosineQuery {
+  QuantizedCosineQuery(const std::vector<In> &x, const std::vector<In> &y,
+                       std::size_t ndim)
+      : codes(normalize(x, ndim), normalize(y, ndim), ndim),
+        finish{0.5F * codes.quantizer.scale * codes.quantizer.scale},
+        nx(codes.nx), ny(codes.ny) {}
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    return finish(CodeL2Sqr()(codes.xrow(i), codes.yrow(j), codes.ndim));
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    code_batch(codes, j, is, n, out, CodeL2Sqr(), finish);
+  }
+
+  const QuantizedData codes;
+  const Scaled<Out> finish;
+  Idx nx;
+  Idx ny;
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+  using Exact = CosineQuery<In, Out, Idx>;
+};
+
+// true for the distances whose neighbors should be re-ranked with their Exact
+// distance: the quantized distances, and distances which only preserve the
+// order of the exact distance
+template <typename Distance> struct NeedsRerank : std::false_type {};
+template <typename In, typename Out, typename Idx>
+struct NeedsRerank<QuantizedL2Sqr<In, Out, Idx>> : std::true_type {};
+template <typename In, typename Out, typename Idx>
+struct NeedsRerank<QuantizedEuclidean<In, Out, Idx>> : std::true_type {};
+template <typename In, typename Out, typename Idx>
+struct NeedsRerank<QuantizedManhattan<In, Out, Idx>> : std::true_type {};
+template <typename In, typename Out, typename Idx>
+struct NeedsRerank<QuantizedCosineSelf<In, Out, Idx>> : std::true_type {};
+template <typename In, typename Out, typename Idx>
+struct NeedsRerank<QuantizedCosineQuery<In, Out, Idx>> : std::true_type {};
+template <typename In, typename Out, typename Idx>
+struct NeedsRerank<InnerProductL2<In, Out, Idx>> : std::true_type {};
+
 template <typename Out, typename Idx = uint32_t>
 auto hamming_impl(const BitVec &x, Idx i, const BitVec &y, Idx j,
                   std::size_t len) -> Out {
@@ -233,6 +779,12 @@ struct HammingSelf {
     return hamming_impl<Out>(bitvec, i, bitvec, j, vec_len);
   }
 
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    for (std::size_t k = 0; k < n; k++) {
+      out[k] = hamming_impl<Out>(bitvec, is[k], bitvec, j, vec_len);
+    }
+  }
+
   using Input = In;
   using Output = Out;
   using Index = Idx;
@@ -257,6 +809,12 @@ struct HammingQuery {
     return hamming_impl<Out>(bx, i, by, j, vec_len);
   }
 
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    for (std::size_t k = 0; k < n; k++) {
+      out[k] = hamming_impl<Out>(bx, is[k], by, j, vec_len);
+    }
+  }
+
   using Input = In;
   using Output = Out;
   using Index = Idx;
@@ -0,0 +1,243 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_FIXEDHEAP_H
+#define TDOANN_FIXEDHEAP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "heap.h"
+
+namespace tdoann {
+
+// Neighbor heaps with the number of neighbors, K, fixed at compile time. These
+// are drop-in replacements for NNDHeap and NNHeap using the same binary max
+// heap layout and row operations, but with K as the row width, so the loop
+// bounds in the sift operations are known to the compiler, so the comparisons
+// can be unrolled and the row offsets folded into constants.
+
+template <typename DistOut, typename Idx, std::size_t K> struct FixedNNDHeap {
+  using DistanceOut = DistOut;
+  using Index = Idx;
+
+  static constexpr auto npos() -> Idx { return static_cast<Idx>(-1); }
+
+  Idx n_points;
+  Idx n_nbrs;
+  std::vector<Idx> idx;
+  std::vector<DistOut> dist;
+  std::vector<char> flags;
+
+  // the n_nbrs argument is only for compatibility with the other heaps and
+  // is ignored
+  FixedNNDHeap(std::size_t n_points, std::size_t /* n_nbrs */)
+      : n_points(n_points), n_nbrs(K), idx(n_points * K, npos()),
+        dist(n_points * K, (std::numeric_limits<DistOut>::max)()),
+        flags(n_points * K, 0) {}
+
+  auto contains(Idx row, Idx index) const -> bool {
+    return heap_row_contains(&idx[row * K], K, index);
+  }
+
+  // returns true if either p or q would accept a neighbor with distance d
+  auto accepts_either(Idx p, Idx q, DistOut d) const -> bool {
+    return (p < n_points && d < dist[p * K]) ||
+           (p != q && q < n_points && d < dist[q * K]);
+  }
+
+  // returns true if p would accept a neighbor with distance d
+  auto accepts(Idx p, DistOut d) const -> bool {
+    return p < n_points && d < dist[p * K];
+  }
+
+  auto checked_push_pair(Idx row, DistOut weight, Idx idx, char flag = 1)
+      -> std::size_t {
+    std::size_t c = checked_push(row, weight, idx, flag);
+    if (row != idx) {
+      c += checked_push(idx, weight, row, flag);
+    }
+    return c;
+  }
+
+  auto checked_push(Idx row, DistOut weight, Idx idx, char flag = 1)
+      -> std::size_t {
+    if (!accepts(row, weight) || contains(row, idx)) {
+      return 0;
+    }
+
+    return unchecked_push(row, weight, idx, flag);
+  }
+
+  auto unchecked_push(Idx row, DistOut weight, Idx index, char flag = 1)
+      -> std::size_t {
+    DistOut *dr = &dist[row * K];
+    Idx *ir = &idx[row * K];
+    char *fr = &flags[row * K];
+    auto move = [&](std::size_t from, std::size_t to) {
+      dr[to] = dr[from];
+      ir[to] = ir[from];
+      fr[to] = fr[from];
+    };
+    const std::size_t i = heap_siftdown_root(dr, K, weight, move);
+
+    dr[i] = weight;
+    ir[i] = index;
+    fr[i] = flag;
+
+    return 1;
+  }
+
+  void deheap_sort() {
+    for (Idx i = 0; i < n_points; i++) {
+      deheap_sort(i);
+    }
+  }
+
+  void deheap_sort(Idx i) {
+    DistOut *dr = &dist[i * K];
+    Idx *ir = &idx[i * K];
+    auto swap = [&](std::size_t a, std::size_t b) {
+      std::swap(dr[a], dr[b]);
+      std::swap(ir[a], ir[b]);
+    };
+    heap_sort_row(dr, K, swap);
+  }
+
+  auto index(Idx i, Idx j) const -> Idx { return idx[i * K + j]; }
+
+  auto distance(Idx i, Idx j) const -> DistOut { return dist[i * K + j]; }
+
+  auto flag(Idx i, Idx j) const -> char { return flags[i * K + j]; }
+  void set_flag(Idx i, Idx j, char flag) { flags[i * K + j] = flag; }
+
+  // overwrite the neighbor at position j of row i, e.g. when restoring a saved
+  // heap: the caller is responsible for the heap property of the row
+  void set(Idx i, Idx j, DistOut d, Idx index, char flag) {
+    dist[i * K + j] = d;
+    idx[i * K + j] = index;
+    flags[i * K + j] = flag;
+  }
+
+  auto max_distance(Idx i) const -> DistOut { return dist[i * K]; }
+
+  auto is_full(Idx i) const -> bool { return idx[i * K] != npos(); }
+};
+
+// Like FixedNNDHeap, but no flags
+template <typename DistOut, typename Idx, std::size_t K> struct FixedNNHeap {
+  using DistanceOut = DistOut;
+  using Index = Idx;
+
+  static constexpr auto npos() -> Idx { return static_cast<Idx>(-1); }
+
+  Idx n_points;
+  Idx n_nbrs;
+  std::vector<Idx> idx;
+  std::vector<DistOut> dist;
+
+  // the n_nbrs argument is only for compatibility with the other heaps and
+  // is ignored
+  FixedNNHeap(std::size_t n_points, std::size_t /* n_nbrs */)
+      : n_points(n_points), n_nbrs(K), idx(n_points * K, npos()),
+        dist(n_points * K, (std::numeric_limits<DistOut>::max)()) {}
+
+  auto contains(Idx row, Idx index) const -> bool {
+    return heap_row_contains(&idx[row * K], K, index);
+  }
+
+  // returns true if either p or q would accept a neighbor with distance d
+  auto accepts_either(Idx p, Idx q, DistOut d) const -> bool {
+    return (p < n_points && d < dist[p * K]) ||
+           (p != q && q < n_points && d < dist[q * K]);
+  }
+
+  // returns true if p would accept a neighbor with distance d
+  auto accepts(Idx p, DistOut d) const -> bool {
+    return p < n_points && d < dist[p * K];
+  }
+
+  auto checked_push_pair(std::size_t row, DistOut weight, Idx idx)
+      -> std::size_t {
+    std::size_t c = checked_push(row, weight, idx);
+    if (row != idx) {
+      c += checked_push(idx, weight, row);
+    }
+    return c;
+  }
+
+  auto checked_push(Idx row, DistOut weight, Idx idx) -> std::size_t {
+    if (!accepts(row, weight) || contains(row, idx)) {
+      return 0;
+    }
+
+    return unchecked_push(row, weight, idx);
+  }
+
+  auto unchecked_push(Idx row, DistOut weight, Idx index) -> std::size_t {
+    DistOut *dr = &dist[row * K];
+    Idx *ir = &idx[row * K];
+    auto move = [&](std::size_t from, std::size_t to) {
+      dr[to] = dr[from];
+      ir[to] = ir[from];
+    };
+    const std::size_t i = heap_siftdown_root(dr, K, weight, move);
+
+    dr[i] = weight;
+    ir[i] = index;
+
+    return 1;
+  }
+
+  void deheap_sort() {
+    for (Idx i = 0; i < n_points; i++) {
+      deheap_sort(i);
+    }
+  }
+
+  void deheap_sort(Idx i) {
+    DistOut *dr = &dist[i * K];
+    Idx *ir = &idx[i * K];
+    auto swap = [&](std::size_t a, std::size_t b) {
+      std::swap(dr[a], dr[b]);
+      std::swap(ir[a], ir[b]);
+    };
+    heap_sort_row(dr, K, swap);
+  }
+
+  auto index(Idx i, Idx j) const -> Idx { return idx[i * K + j]; }
+
+  auto distance(Idx i, Idx j) const -> DistOut { return dist[i * K + j]; }
+
+  auto max_distance(Idx i) const -> DistOut { return dist[i * K]; }
+
+  auto is_full(Idx i) const -> bool { return idx[i * K] != npos(); }
+};
+
+} // namespace tdoann
+#endif // TDOANN_FIXEDHEAP_H
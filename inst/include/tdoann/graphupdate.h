@@ -27,9 +27,11 @@
 #ifndef TDOANN_GRAPHUPDATE_H
 #define TDOANN_GRAPHUPDATE_H
 
+#include <algorithm>
 #include <unordered_set>
 #include <vector>
 
+#include "distance.h"
 #include "heap.h"
 
 namespace tdoann {
@@ -51,14 +53,14 @@ template <typename DistOut, typename Idx> struct Update {
 template <typename DistOut, typename Idx> struct GraphCacheConstructionInit {
   using DistanceOut = DistOut;
   using Index = Idx;
-  static void init(const NNDHeap<DistOut, Idx> &neighbor_heap,
+  template <typename NbrHeap>
+  static void init(const NbrHeap &neighbor_heap,
                    std::vector<std::unordered_set<Idx>> &seen) {
     const auto n_points = neighbor_heap.n_points;
     const auto n_nbrs = neighbor_heap.n_nbrs;
     for (Idx i = 0; i < n_points; i++) {
-      std::size_t innbrs = i * n_nbrs;
       for (std::size_t j = 0; j < n_nbrs; j++) {
-        auto p = neighbor_heap.idx[innbrs + j];
+        auto p = neighbor_heap.index(i, j);
         if (i > p) {
           seen[p].emplace(i);
         } else {
@@ -72,14 +74,14 @@ template <typename DistOut, typename Idx> struct GraphCacheConstructionInit {
 template <typename DistOut, typename Idx> struct GraphCacheQueryInit {
   using DistanceOut = DistOut;
   using Index = Idx;
-  static void init(const NNDHeap<DistOut, Idx> &neighbor_heap,
+  template <typename NbrHeap>
+  static void init(const NbrHeap &neighbor_heap,
                    std::vector<std::unordered_set<Idx>> &seen) {
     const auto n_points = neighbor_heap.n_points;
     const auto n_nbrs = neighbor_heap.n_nbrs;
     for (std::size_t q = 0; q < n_points; q++) {
-      std::size_t qnnbrs = q * n_nbrs;
       for (std::size_t k = 0; k < n_nbrs; k++) {
-        std::size_t r = neighbor_heap.idx[qnnbrs + k];
+        std::size_t r = neighbor_heap.index(q, k);
         seen[q].emplace(r);
       }
     }
@@ -92,8 +94,8 @@ template <typename DistOut, typename Idx,
 struct GraphCache {
   std::vector<std::unordered_set<Idx>> seen;
 
-  GraphCache(const NNDHeap<DistOut, Idx> &neighbor_heap)
-      : seen(neighbor_heap.n_points) {
+  template <typename NbrHeap>
+  GraphCache(const NbrHeap &neighbor_heap) : seen(neighbor_heap.n_points) {
     GraphCacheInit<DistOut, Idx>::init(neighbor_heap, seen);
   }
 
@@ -112,25 +114,52 @@ struct GraphCache {
   }
 };
 
-template <typename Distance> struct Batch {
+// remove the items q from qs where the pair (p, q) has already been seen
+template <typename Cache, typename DistOut, typename Idx>
+void remove_seen(const Cache &seen, Idx p,
+                 DistanceBatch<DistOut, Idx> &qs) {
+  auto unseen_end = std::remove_if(qs.idx.begin(), qs.idx.end(), [&](Idx q) {
+    Idx pp = p > q ? q : p;
+    Idx qq = p > q ? p : q;
+    return seen.contains(pp, qq);
+  });
+  qs.idx.erase(unseen_end, qs.idx.end());
+}
+
+template <typename Distance,
+          typename NbrHeap = NNDHeap<typename Distance::Output,
+                                     typename Distance::Index>>
+struct Batch {
   using DistOut = typename Distance::Output;
   using Idx = typename Distance::Index;
 
-  NNDHeap<DistOut, Idx> &current_graph;
+  NbrHeap &current_graph;
   const Distance &distance;
   std::vector<std::vector<Update<DistOut, Idx>>> updates;
 
-  Batch(NNDHeap<DistOut, Idx> &current_graph, const Distance &distance)
+  Batch(NbrHeap &current_graph, const Distance &distance)
       : current_graph(current_graph), distance(distance),
         updates(current_graph.n_points) {}
 
-  void generate(Idx p, DistOut q, std::size_t key) {
+  void generate(Idx p, Idx q, std::size_t key) {
     auto d = distance(p, q);
     if (current_graph.accepts_either(p, q, d)) {
       updates[key].emplace_back(p, q, d);
     }
   }
 
+  // the same as calling generate(p, q, key) for each q in qs
+  void generate(Idx p, DistanceBatch<DistOut, Idx> &qs, std::size_t key) {
+    qs.calculate(distance, p);
+    for (std::size_t k = 0; k < qs.size(); k++) {
+      const Idx q = qs.idx[k];
+      const DistOut d = qs.dist[k];
+      if (current_graph.accepts_either(p, q, d)) {
+        updates[key].emplace_back(p, q, d);
+      }
+    }
+  }
+
   auto apply() -> std::size_t {
     std::size_t c = 0;
     const auto n_points = updates.size();
@@ -146,16 +175,19 @@ template <typename Distance> struct Batch {
   }
 };
 
-template <typename Distance> struct BatchHiMem {
+template <typename Distance,
+          typename NbrHeap = NNDHeap<typename Distance::Output,
+                                     typename Distance::Index>>
+struct BatchHiMem {
   using DistOut = typename Distance::Output;
   using Idx = typename Distance::Index;
 
-  NNDHeap<DistOut, Idx> &current_graph;
+  NbrHeap &current_graph;
   const Distance &distance;
   GraphCache<DistOut, Idx, GraphCacheConstructionInit> seen;
   std::vector<std::vector<Update<DistOut, Idx>>> updates;
 
-  BatchHiMem(NNDHeap<DistOut, Idx> &current_graph, const Distance &distance)
+  BatchHiMem(NbrHeap &current_graph, const Distance &distance)
       : current_graph(current_graph), distance(distance), seen(current_graph),
         updates(current_graph.n_points) {}
 
@@ -173,6 +205,20 @@ template <typename Distance> struct BatchHiMem {
     }
   }
 
+  // the same as calling generate(p, q, key) for each q in qs: the distances
+  // are only calculated for pairs which haven't been seen
+  void generate(Idx p, DistanceBatch<DistOut, Idx> &qs, std::size_t key) {
+    remove_seen(seen, p, qs);
+    qs.calculate(distance, p);
+    for (std::size_t k = 0; k < qs.size(); k++) {
+      const Idx q = qs.idx[k];
+      const DistOut d = qs.dist[k];
+      if (current_graph.accepts_either(p, q, d)) {
+        updates[key].emplace_back(p > q ? q : p, p > q ? p : q, d);
+      }
+    }
+  }
+
   auto apply() -> std::size_t {
     std::size_t c = 0;
     const auto n_points = updates.size();
@@ -212,17 +258,20 @@ template <typename Distance> struct BatchHiMem {
   }
 };
 
-template <typename Distance> struct Serial {
+template <typename Distance,
+          typename NbrHeap = NNDHeap<typename Distance::Output,
+                                     typename Distance::Index>>
+struct Serial {
   using DistOut = typename Distance::Output;
   using Idx = typename Distance::Index;
 
-  NNDHeap<DistOut, Idx> &current_graph;
+  NbrHeap &current_graph;
   const Distance &distance;
   Idx upd_p;
   Idx upd_q;
   DistOut upd_d;
 
-  Serial(NNDHeap<DistOut, Idx> &current_graph, const Distance &distance)
+  Serial(NbrHeap &current_graph, const Distance &distance)
       : current_graph(current_graph), distance(distance),
         upd_p(current_graph.npos()), upd_q(current_graph.npos()), upd_d(0) {}
 
@@ -231,6 +280,21 @@ template <typename Distance> struct Serial {
     return apply();
   }
 
+  // the same as calling generate_and_apply(p, q) for each q in qs
+  auto generate_and_apply(Idx p, DistanceBatch<DistOut, Idx> &qs)
+      -> std::size_t {
+    qs.calculate(distance, p);
+    std::size_t c = 0;
+    for (std::size_t k = 0; k < qs.size(); k++) {
+      const Idx q = qs.idx[k];
+      const DistOut d = qs.dist[k];
+      if (current_graph.accepts_either(p, q, d)) {
+        c += current_graph.checked_push_pair(p, d, q);
+      }
+    }
+    return c;
+  }
+
   void generate(Idx p, Idx q, std::size_t) {
     auto d = distance(p, q);
     if (current_graph.accepts_either(p, q, d)) {
@@ -250,17 +314,20 @@ template <typename Distance> struct Serial {
   }
 };
 
-template <typename Distance> struct SerialHiMem {
+template <typename Distance,
+          typename NbrHeap = NNDHeap<typename Distance::Output,
+                                     typename Distance::Index>>
+struct SerialHiMem {
   using DistOut = typename Distance::Output;
   using Idx = typename Distance::Index;
 
-  NNDHeap<DistOut, Idx> &current_graph;
+  NbrHeap &current_graph;
   const Distance &distance;
   GraphCache<DistOut, Idx, GraphCacheConstructionInit> seen;
   Idx upd_p;
   Idx upd_q;
 
-  SerialHiMem(NNDHeap<DistOut, Idx> &current_graph, const Distance &distance)
+  SerialHiMem(NbrHeap &current_graph, const Distance &distance)
       : current_graph(current_graph), distance(distance), seen(current_graph),
         upd_p(current_graph.npos()), upd_q(current_graph.npos()) {}
 
@@ -269,6 +336,24 @@ template <typename Distance> struct SerialHiMem {
     return apply();
   }
 
+  // the same as calling generate_and_apply(p, q) for each q in qs: the
+  // distances are only calculated for pairs which haven't been seen
+  auto generate_and_apply(Idx p, DistanceBatch<DistOut, Idx> &qs)
+      -> std::size_t {
+    remove_seen(seen, p, qs);
+    qs.calculate(distance, p);
+    std::size_t c = 0;
+    for (std::size_t k = 0; k < qs.size(); k++) {
+      generate(p, qs.idx[k]);
+      // the same item can be both a new and an old candidate
+      if (seen.contains(upd_p, upd_q)) {
+        continue;
+      }
+      c += apply(qs.dist[k]);
+    }
+    return c;
+  }
+
   void generate(Idx p, Idx q) {
     // canonicalize the order of (p, q) so that qq >= pp
     auto pp = p > q ? q : p;
@@ -279,13 +364,14 @@ template <typename Distance> struct SerialHiMem {
   }
 
   auto apply() -> std::size_t {
-    std::size_t c = 0;
-
     if (seen.contains(upd_p, upd_q)) {
-      return c;
+      return 0;
     }
+    return apply(distance(upd_p, upd_q));
+  }
 
-    auto d = distance(upd_p, upd_q);
+  auto apply(DistOut d) -> std::size_t {
+    std::size_t c = 0;
 
     if (current_graph.accepts(upd_p, d)) {
       current_graph.unchecked_push(upd_p, d, upd_q);
@@ -318,17 +404,20 @@ template <typename Idx> struct UnorderedNeighborSet {
   void clear() { seen.clear(); }
 };
 
-template <typename Distance> struct QuerySerial {
+template <typename Distance,
+          typename NbrHeap = NNDHeap<typename Distance::Output,
+                                     typename Distance::Index>>
+struct QuerySerial {
   using DistOut = typename Distance::Output;
   using Idx = typename Distance::Index;
 
-  NNDHeap<DistOut, Idx> &current_graph;
+  NbrHeap &current_graph;
   const Distance &distance;
   Idx ref;
   Idx query;
   DistOut dist;
 
-  QuerySerial(NNDHeap<DistOut, Idx> &current_graph, const Distance &distance)
+  QuerySerial(NbrHeap &current_graph, const Distance &distance)
       : current_graph(current_graph), distance(distance),
         ref(current_graph.npos()), query(current_graph.npos()), dist(0) {}
 
@@ -358,18 +447,20 @@ template <typename Distance> struct QuerySerial {
   using NeighborSet = NullNeighborSet<Idx>;
 };
 
-template <typename Distance> struct QuerySerialHiMem {
+template <typename Distance,
+          typename NbrHeap = NNDHeap<typename Distance::Output,
+                                     typename Distance::Index>>
+struct QuerySerialHiMem {
   using DistOut = typename Distance::Output;
   using Idx = typename Distance::Index;
 
-  NNDHeap<DistOut, Idx> &current_graph;
+  NbrHeap &current_graph;
   const Distance &distance;
   GraphCache<DistOut, Idx, GraphCacheQueryInit> seen;
   Idx ref_;
   Idx query_;
 
-  QuerySerialHiMem(NNDHeap<DistOut, Idx> &current_graph,
-                   const Distance &distance)
+  QuerySerialHiMem(NbrHeap &current_graph, const Distance &distance)
       : current_graph(current_graph), distance(distance), seen(current_graph),
         ref_(current_graph.npos()), query_(current_graph.npos()) {}
 
@@ -402,15 +493,14 @@ template <typename Distance> struct QuerySerialHiMem {
 
 // Template aliases can't be declared inside a function, so this struct is
 // necessary to avoid wanting to write e.g.:
-// template <typename T>
-// using  = Serial<T>;
+// template <typename T, typename H>
+// using  = Serial<T, H>;
 // which won't compile.
-template <template <typename> class Impl> struct Factory {
-  template <typename Distance>
-  static auto create(NNDHeap<typename Distance::Output,
-                             typename Distance::Index> &current_graph,
-                     Distance &distance) -> Impl<Distance> {
-    return Impl<Distance>(current_graph, distance);
+template <template <typename, typename> class Impl> struct Factory {
+  template <typename Distance, typename NbrHeap>
+  static auto create(NbrHeap &current_graph, Distance &distance)
+      -> Impl<Distance, NbrHeap> {
+    return Impl<Distance, NbrHeap>(current_graph, distance);
   }
 };
 } // namespace upd
@@ -0,0 +1,139 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+
+#ifndef TDOANN_HALFFLOAT_H
+#define TDOANN_HALFFLOAT_H
+
+#include <cstdint>
+#include <cstring>
+
+namespace tdoann {
+
+// 16-bit floating point types for storing data in half the memory of float.
+// Values are rounded to the nearest representable value (ties to even) when
+// they are stored and converted back to float for all arithmetic, so the
+// distance functors can use them as their Input type unchanged. The
+// conversions only use integer and float operations so that the compiler can
+// vectorize loops over the data.
+
+inline auto float_to_bits(float f) -> uint32_t {
+  uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+inline auto bits_to_float(uint32_t bits) -> float {
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+// IEEE 754 binary16: 5 exponent bits and 10 mantissa bits. Values larger than
+// 65504 in magnitude become infinite
+inline auto float_to_half(float f) -> uint16_t {
+  const uint32_t f32_infinity = 255U << 23;
+  // the smallest float which overflows binary16
+  const uint32_t f16_overflow = (127U + 16U) << 23;
+  // adding this to a float which is a binary16 subnormal leaves the binary16
+  // mantissa in the low bits
+  const uint32_t denorm_magic = ((127U - 15U) + (23U - 10U) + 1U) << 23;
+
+  uint32_t bits = float_to_bits(f);
+  const uint32_t sign = bits & 0x80000000U;
+  bits ^= sign;
+
+  uint16_t half = 0;
+  if (bits >= f16_overflow) {
+    // infinity stays infinity, NaN becomes a quiet NaN
+    half = bits > f32_infinity ? 0x7e00 : 0x7c00;
+  } else if (bits < (113U << 23)) {
+    // binary16 subnormal or zero
+    const float sum = bits_to_float(bits) + bits_to_float(denorm_magic);
+    half = static_cast<uint16_t>(float_to_bits(sum) - denorm_magic);
+  } else {
+    const uint32_t mantissa_odd = (bits >> 13) & 1U;
+    // rebias the exponent and round the mantissa
+    bits += ((15U - 127U) << 23) + 0xfffU + mantissa_odd;
+    half = static_cast<uint16_t>(bits >> 13);
+  }
+  return half | static_cast<uint16_t>(sign >> 16);
+}
+
+inline auto half_to_float(uint16_t half) -> float {
+  // multiplying by 2^112 rebiases the exponent, including for subnormals
+  const float rebias = bits_to_float((254U - 15U) << 23);
+  const float f16_overflow = bits_to_float((127U + 16U) << 23);
+
+  const float f = bits_to_float((half & 0x7fffU) << 13) * rebias;
+  // infinity or NaN
+  const uint32_t inf_nan = f >= f16_overflow ? 255U << 23 : 0U;
+  const uint32_t sign = static_cast<uint32_t>(half & 0x8000U) << 16;
+  return bits_to_float(float_to_bits(f) | inf_nan | sign);
+}
+
+// bfloat16: the top 16 bits of a float, so it has the range of float but only
+// 7 mantissa bits
+inline auto float_to_bfloat16(float f) -> uint16_t {
+  uint32_t bits = float_to_bits(f);
+  if ((bits & 0x7fffffffU) > 0x7f800000U) {
+    // quiet NaN
+    return static_cast<uint16_t>((bits >> 16) | 0x40U);
+  }
+  bits += 0x7fffU + ((bits >> 16) & 1U);
+  return static_cast<uint16_t>(bits >> 16);
+}
+
+inline auto bfloat16_to_float(uint16_t bf) -> float {
+  return bits_to_float(static_cast<uint32_t>(bf) << 16);
+}
+
+struct Float16 {
+  uint16_t bits{0};
+
+  Float16() = default;
+  Float16(float f) : bits(float_to_half(f)) {}
+
+  operator float() const { return half_to_float(bits); }
+};
+
+struct BFloat16 {
+  uint16_t bits{0};
+
+  BFloat16() = default;
+  BFloat16(float f) : bits(float_to_bfloat16(f)) {}
+
+  operator float() const { return bfloat16_to_float(bits); }
+};
+
+// The type that arithmetic on stored values of type T is carried out in
+template <typename T> struct ComputeType { using type = T; };
+template <> struct ComputeType<Float16> { using type = float; };
+template <> struct ComputeType<BFloat16> { using type = float; };
+
+} // namespace tdoann
+
+#endif // TDOANN_HALFFLOAT_H
@@ -28,6 +28,7 @@
 #define TDOANN_HEAP_H
 
 #include <algorithm>
+#include <cstdint>
 #include <limits>
 #include <vector>
 
@@ -35,8 +36,261 @@
 
 namespace tdoann {
 
+// The neighbor indices, distances and (optionally) flags of the heaps, for
+// n_points rows of n_nbrs neighbors, each stored in its own row-major vector
+template <typename DistOut, typename Idx> struct HeapStorage {
+  std::size_t n_nbrs;
+  std::vector<Idx> idx;
+  std::vector<DistOut> dist;
+  std::vector<char> flags;
+
+  HeapStorage(std::size_t n_points, std::size_t n_nbrs, Idx init_idx,
+                   DistOut init_dist, bool with_flags)
+      : n_nbrs(n_nbrs), idx(n_points * n_nbrs, init_idx),
+        dist(n_points * n_nbrs, init_dist),
+        flags(with_flags ? n_points * n_nbrs : 0, 0) {}
+
+  auto index(std::size_t i, std::size_t j) const -> Idx {
+    return idx[i * n_nbrs + j];
+  }
+  auto index(std::size_t i, std::size_t j) -> Idx & {
+    return idx[i * n_nbrs + j];
+  }
+
+  auto distance(std::size_t i, std::size_t j) const -> DistOut {
+    return dist[i * n_nbrs + j];
+  }
+  auto distance(std::size_t i, std::size_t j) -> DistOut & {
+    return dist[i * n_nbrs + j];
+  }
+
+  auto flag(std::size_t i, std::size_t j) const -> char {
+    return flags[i * n_nbrs + j];
+  }
+
+  auto index_row(std::size_t i) const -> const Idx * {
+    return &idx[i * n_nbrs];
+  }
+  auto distance_row(std::size_t i) const -> const DistOut * {
+    return &dist[i * n_nbrs];
+  }
+  void set_flag(std::size_t i, std::size_t j, char flag) {
+    flags[i * n_nbrs + j] = flag;
+  }
+
+  void set(std::size_t i, std::size_t j, DistOut d, Idx index) {
+    const std::size_t ij = i * n_nbrs + j;
+    dist[ij] = d;
+    idx[ij] = index;
+  }
+
+  // copy the index and distance in row i from position from to position to
+  void move(std::size_t i, std::size_t from, std::size_t to) {
+    const std::size_t r0 = i * n_nbrs;
+    dist[r0 + to] = dist[r0 + from];
+    idx[r0 + to] = idx[r0 + from];
+  }
+
+  void move_flag(std::size_t i, std::size_t from, std::size_t to) {
+    const std::size_t r0 = i * n_nbrs;
+    flags[r0 + to] = flags[r0 + from];
+  }
+
+  // swap the index and distance in row i at positions j1 and j2
+  void swap(std::size_t i, std::size_t j1, std::size_t j2) {
+    const std::size_t r0 = i * n_nbrs;
+    std::swap(idx[r0 + j1], idx[r0 + j2]);
+    std::swap(dist[r0 + j1], dist[r0 + j2]);
+  }
+};
+
+// Open addressing hash (multi)set of the neighbor indices in each row of a
+// heap, so that checking for an existing neighbor doesn't require a scan of
+// the whole row. Each row gets its own power-of-two sized table, at least twice
+// the number of neighbors so there is always an empty slot. Collisions are
+// resolved by linear probing, and removal uses backward shift deletion to avoid
+// tombstones.
+template <typename Idx> struct HeapRowIndex {
+  static constexpr auto empty() -> Idx { return static_cast<Idx>(-1); }
+
+  std::size_t capacity;
+  std::size_t mask;
+  std::size_t shift;
+  std::vector<Idx> slots;
+
+  HeapRowIndex() : capacity(0), mask(0), shift(0), slots() {}
+
+  HeapRowIndex(std::size_t n_points, std::size_t n_nbrs)
+      : capacity(table_size(n_nbrs)), mask(capacity - 1),
+        shift(64 - log2(capacity)), slots(n_points * capacity, empty()) {}
+
+  static auto table_size(std::size_t n_nbrs) -> std::size_t {
+    std::size_t size = 2;
+    while (size < 2 * n_nbrs) {
+      size <<= 1;
+    }
+    return size;
+  }
+
+  static auto log2(std::size_t size) -> std::size_t {
+    std::size_t bits = 0;
+    while (size > 1) {
+      size >>= 1;
+      ++bits;
+    }
+    return bits;
+  }
+
+  // Fibonacci hashing: take the top bits of the product
+  auto home(Idx index) const -> std::size_t {
+    return static_cast<std::size_t>(
+        (static_cast<uint64_t>(index) * uint64_t{0x9E3779B97F4A7C15}) >>
+        shift);
+  }
+
+  auto contains(std::size_t row, Idx index) const -> bool {
+    const Idx *table = &slots[row * capacity];
+    for (std::size_t s = home(index);; s = (s + 1) & mask) {
+      if (table[s] == index) {
+        return true;
+      }
+      if (table[s] == empty()) {
+        return false;
+      }
+    }
+  }
+
+  void insert(std::size_t row, Idx index) {
+    Idx *table = &slots[row * capacity];
+    std::size_t s = home(index);
+    while (table[s] != empty()) {
+      s = (s + 1) & mask;
+    }
+    table[s] = index;
+  }
+
+  // removes one occurrence of index from row, which must be present
+  void erase(std::size_t row, Idx index) {
+    Idx *table = &slots[row * capacity];
+    std::size_t hole = home(index);
+    while (table[hole] != index) {
+      hole = (hole + 1) & mask;
+    }
+    // move any later entries in the probe sequence back into the hole if that
+    // doesn't put them before their home slot
+    for (std::size_t s = (hole + 1) & mask; table[s] != empty();
+         s = (s + 1) & mask) {
+      const std::size_t h = home(table[s]);
+      if (((s - h) & mask) >= ((s - hole) & mask)) {
+        table[hole] = table[s];
+        hole = s;
+      }
+    }
+    table[hole] = empty();
+  }
+};
+
+// Operations on one row of a heap, a binary max heap of n_nbrs neighbors
+// ordered by distance. They are shared by the heaps here and the fixed size
+// heaps in fixedheap.h, which pass n_nbrs as a compile time constant so the
+// loop bounds can be folded into the code.
+
+template <typename Idx>
+auto heap_row_contains(const Idx *row, std::size_t n_nbrs, Idx index) -> bool {
+  for (std::size_t j = 0; j < n_nbrs; j++) {
+    if (row[j] == index) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Find the position for a new item with distance weight, descending the heap
+// from the root and moving items up until the max heap criterion is met for
+// the new item. move(from, to) copies the item at from to to.
+template <typename DistOut, typename Move>
+auto heap_siftdown_root(const DistOut *dist, std::size_t n_nbrs,
+                        DistOut weight, Move move) -> std::size_t {
+  std::size_t i = 0;
+  while (true) {
+    const std::size_t ic1 = 2 * i + 1;
+    const std::size_t ic2 = ic1 + 1;
+    std::size_t i_swap = 0;
+
+    if (ic1 >= n_nbrs) {
+      break;
+    } else if (ic2 >= n_nbrs) {
+      if (dist[ic1] >= weight) {
+        i_swap = ic1;
+      } else {
+        break;
+      }
+    } else if (dist[ic1] >= dist[ic2]) {
+      if (weight < dist[ic1]) {
+        i_swap = ic1;
+      } else {
+        break;
+      }
+    } else {
+      if (weight < dist[ic2]) {
+        i_swap = ic2;
+      } else {
+        break;
+      }
+    }
+
+    move(i_swap, i);
+    i = i_swap;
+  }
+  return i;
+}
+
+// Restore the heap property for the first len items after the root has been
+// replaced. swap(a, b) swaps the items at a and b.
+template <typename DistOut, typename Swap>
+void heap_siftdown(const DistOut *dist, std::size_t len, Swap swap) {
+  std::size_t elt = 0;
+  std::size_t e21 = elt * 2 + 1;
+
+  while (e21 < len) {
+    std::size_t left_child = e21;
+    std::size_t right_child = left_child + 1;
+    std::size_t swap_elt = elt;
+
+    if (dist[swap_elt] < dist[left_child]) {
+      swap_elt = left_child;
+    }
+
+    if (right_child < len && dist[swap_elt] < dist[right_child]) {
+      swap_elt = right_child;
+    }
+
+    if (swap_elt == elt) {
+      break;
+    }
+    swap(elt, swap_elt);
+    elt = swap_elt;
+    e21 = elt * 2 + 1;
+  }
+}
+
+// Sort a row of n_nbrs items into increasing distance order
+template <typename DistOut, typename Swap>
+void heap_sort_row(const DistOut *dist, std::size_t n_nbrs, Swap swap) {
+  for (std::size_t j = 0; j + 1 < n_nbrs; j++) {
+    const std::size_t n1j = n_nbrs - 1 - j;
+    swap(0, n1j);
+    heap_siftdown(dist, n1j, swap);
+  }
+}
+
+// Number of neighbors above which the heaps maintain a HeapRowIndex. Below
+// this a linear scan of the row is faster than hashing.
+constexpr auto heap_row_index_threshold() -> std::size_t { return 96; }
+
 // Base class storing neighbor data as a series of heaps
-template <typename DistOut = float, typename Idx = uint32_t> struct NNDHeap {
+template <typename DistOut = float, typename Idx = uint32_t>
+struct NNDHeap {
   using DistanceOut = DistOut;
   using Index = Idx;
 
@@ -44,39 +298,39 @@ template <typename DistOut = float, typename Idx = uint32_t> struct NNDHeap {
 
   Idx n_points;
   Idx n_nbrs;
-  std::vector<Idx> idx;
-  std::vector<DistOut> dist;
-  Idx n_nbrs1;
-  std::vector<char> flags;
+  HeapStorage<DistOut, Idx> storage;
+  // if true, row_index tracks the neighbors in each row for contains
+  bool indexed;
+  HeapRowIndex<Idx> row_index;
 
   NNDHeap(std::size_t n_points, std::size_t n_nbrs)
-      : n_points(n_points), n_nbrs(n_nbrs), idx(n_points * n_nbrs, npos()),
-        dist(n_points * n_nbrs, (std::numeric_limits<DistOut>::max)()),
-        n_nbrs1(n_nbrs - 1), flags(n_points * n_nbrs, 0) {}
+      : n_points(n_points), n_nbrs(n_nbrs),
+        storage(n_points, n_nbrs, npos(),
+                (std::numeric_limits<DistOut>::max)(), true),
+        indexed(n_nbrs > heap_row_index_threshold()),
+        row_index(indexed ? HeapRowIndex<Idx>(n_points, n_nbrs)
+                          : HeapRowIndex<Idx>()) {}
 
   NNDHeap(const NNDHeap &) = default;
   ~NNDHeap() = default;
   auto operator=(const NNDHeap &) -> NNDHeap & = default;
 
   auto contains(Idx row, Idx index) const -> bool {
-    std::size_t rnnbrs = row * n_nbrs;
-    for (std::size_t i = 0; i < n_nbrs; i++) {
-      if (index == idx[rnnbrs + i]) {
-        return true;
-      }
+    if (indexed && index != npos()) {
+      return row_index.contains(row, index);
     }
-    return false;
+    return heap_row_contains(storage.index_row(row), n_nbrs, index);
   }
 
   // returns true if either p or q would accept a neighbor with distance d
   auto accepts_either(Idx p, Idx q, DistOut d) const -> bool {
-    return (p < n_points && d < dist[p * n_nbrs]) ||
-           (p != q && q < n_points && d < dist[q * n_nbrs]);
+    return (p < n_points && d < storage.distance(p, 0)) ||
+           (p != q && q < n_points && d < storage.distance(q, 0));
   }
 
   // returns true if p would accept a neighbor with distance d
   auto accepts(Idx p, DistOut d) const -> bool {
-    return p < n_points && d < dist[p * n_nbrs];
+    return p < n_points && d < storage.distance(p, 0);
   }
 
   auto checked_push_pair(Idx row, DistOut weight, Idx idx, char flag = 1)
@@ -100,57 +354,32 @@ template <typename DistOut = float, typename Idx = uint32_t> struct NNDHeap {
   // This differs from the pynndescent version as it is truly unchecked
   auto unchecked_push(Idx row, DistOut weight, Idx index, char flag = 1)
       -> std::size_t {
-    std::size_t r0 = row * n_nbrs;
-
-    // insert val at position zero
-    dist[r0] = weight;
-    idx[r0] = index;
-    flags[r0] = flag;
+    if (indexed) {
+      update_row_index(row, index);
+    }
 
-    // descend the heap, swapping values until the max heap criterion is met
-    std::size_t i = 0;
-    std::size_t i_swap = 0;
-    while (true) {
-      std::size_t ic1 = 2 * i + 1;
-      std::size_t ic2 = ic1 + 1;
+    auto move = [&](std::size_t from, std::size_t to) {
+      storage.move(row, from, to);
+      storage.move_flag(row, from, to);
+    };
+    const std::size_t i =
+        heap_siftdown_root(storage.distance_row(row), n_nbrs, weight, move);
 
-      if (ic1 >= n_nbrs) {
-        break;
-      } else if (ic2 >= n_nbrs) {
-        if (dist[r0 + ic1] >= weight) {
-          i_swap = ic1;
-        } else {
-          break;
-        }
-      } else if (dist[r0 + ic1] >= dist[r0 + ic2]) {
-        if (weight < dist[r0 + ic1]) {
-          i_swap = ic1;
-        } else {
-          break;
-        }
-      } else {
-        if (weight < dist[r0 + ic2]) {
-          i_swap = ic2;
-        } else {
-          break;
-        }
-      }
+    storage.set(row, i, weight, index);
+    storage.set_flag(row, i, flag);
 
-      std::size_t r0i = r0 + i;
-      std::size_t r0is = r0 + i_swap;
-      dist[r0i] = dist[r0is];
-      idx[r0i] = idx[r0is];
-      flags[r0i] = flags[r0is];
+    return 1;
+  }
 
-      i = i_swap;
+  // the current root of the heap is about to be replaced by index
+  void update_row_index(Idx row, Idx index) {
+    const Idx evicted = storage.index(row, 0);
+    if (evicted != npos()) {
+      row_index.erase(row, evicted);
+    }
+    if (index != npos()) {
+      row_index.insert(row, index);
     }
-
-    std::size_t r0i = r0 + i;
-    dist[r0i] = weight;
-    idx[r0i] = index;
-    flags[r0i] = flag;
-
-    return 1;
   }
 
   void deheap_sort() {
@@ -160,60 +389,43 @@ template <typename DistOut = float, typename Idx = uint32_t> struct NNDHeap {
   }
 
   void deheap_sort(Idx i) {
-    std::size_t r0 = i * n_nbrs;
-    for (std::size_t j = 0; j < n_nbrs1; j++) {
-      std::size_t n1j = n_nbrs1 - j;
-      std::size_t r0nn1 = r0 + n1j;
-      std::swap(idx[r0], idx[r0nn1]);
-      std::swap(dist[r0], dist[r0nn1]);
-      siftdown(r0, n1j);
-    }
+    auto swap = [&](std::size_t a, std::size_t b) { storage.swap(i, a, b); };
+    heap_sort_row(storage.distance_row(i), n_nbrs, swap);
   }
 
-  void siftdown(std::size_t r0, std::size_t len) {
-    std::size_t elt = 0;
-    std::size_t e21 = elt * 2 + 1;
+  auto index(Idx i, Idx j) const -> Idx { return storage.index(i, j); }
 
-    while (e21 < len) {
-      std::size_t left_child = e21;
-      std::size_t right_child = left_child + 1;
-      std::size_t swap = elt;
+  auto distance(Idx i, Idx j) const -> DistOut {
+    return storage.distance(i, j);
+  }
 
-      if (dist[r0 + swap] < dist[r0 + left_child]) {
-        swap = left_child;
-      }
+  auto flag(Idx i, Idx j) const -> char { return storage.flag(i, j); }
+  void set_flag(Idx i, Idx j, char flag) { storage.set_flag(i, j, flag); }
 
-      if (right_child < len && dist[r0 + swap] < dist[r0 + right_child]) {
-        swap = right_child;
+  // overwrite the neighbor at position j of row i, e.g. when restoring a saved
+  // heap: the caller is responsible for the heap property of the row
+  void set(Idx i, Idx j, DistOut d, Idx index, char flag) {
+    if (indexed) {
+      const Idx old_index = storage.index(i, j);
+      if (old_index != npos()) {
+        row_index.erase(i, old_index);
       }
-
-      if (swap == elt) {
-        break;
-      } else {
-        std::swap(dist[r0 + elt], dist[r0 + swap]);
-        std::swap(idx[r0 + elt], idx[r0 + swap]);
-        elt = swap;
+      if (index != npos()) {
+        row_index.insert(i, index);
       }
-      e21 = elt * 2 + 1;
     }
+    storage.set(i, j, d, index);
+    storage.set_flag(i, j, flag);
   }
 
-  auto index(Idx i, Idx j) const -> Idx { return idx[i * n_nbrs + j]; }
-  auto index(Idx i, Idx j) -> Idx & { return idx[i * n_nbrs + j]; }
+  auto max_distance(Idx i) const -> DistOut { return storage.distance(i, 0); }
 
-  auto distance(Idx i, Idx j) const -> DistOut { return dist[i * n_nbrs + j]; }
-  auto distance(Idx i, Idx j) -> DistOut & { return dist[i * n_nbrs + j]; }
-
-  auto flag(Idx i, Idx j) const -> char { return flags[i * n_nbrs + j]; }
-  auto flag(Idx i, Idx j) -> char & { return flags[i * n_nbrs + j]; }
-
-  auto max_distance(Idx i) const -> DistOut { return dist[i * n_nbrs]; }
-
-  auto is_full(Idx i) const -> bool { return idx[i * n_nbrs] != npos(); }
+  auto is_full(Idx i) const -> bool { return storage.index(i, 0) != npos(); }
 };
 
-// Like NNDHeap, but no flag vector
-template <typename DistOut = float, typename Idx = uint32_t> struct NNHeap {
+// Like NNDHeap, but no flags
+template <typename DistOut = float, typename Idx = uint32_t>
+struct NNHeap {
   using DistanceOut = DistOut;
   using Index = Idx;
 
@@ -221,38 +433,39 @@ template <typename DistOut = float, typename Idx = uint32_t> struct NNHeap {
 
   Idx n_points;
   Idx n_nbrs;
-  std::vector<Idx> idx;
-  std::vector<DistOut> dist;
-  Idx n_nbrs1;
-
-  NNHeap(Idx n_points, Idx n_nbrs)
-      : n_points(n_points), n_nbrs(n_nbrs), idx(n_points * n_nbrs, npos()),
-        dist(n_points * n_nbrs, (std::numeric_limits<DistOut>::max)()),
-        n_nbrs1(n_nbrs - 1) {}
+  HeapStorage<DistOut, Idx> storage;
+  // if true, row_index tracks the neighbors in each row for contains
+  bool indexed;
+  HeapRowIndex<Idx> row_index;
+
+  NNHeap(std::size_t n_points, std::size_t n_nbrs)
+      : n_points(n_points), n_nbrs(n_nbrs),
+        storage(n_points, n_nbrs, npos(),
+                (std::numeric_limits<DistOut>::max)(), false),
+        indexed(n_nbrs > heap_row_index_threshold()),
+        row_index(indexed ? HeapRowIndex<Idx>(n_points, n_nbrs)
+                          : HeapRowIndex<Idx>()) {}
 
   NNHeap(const NNHeap &) = default;
   ~NNHeap() = default;
   auto operator=(const NNHeap &) -> NNHeap & = default;
 
   auto contains(Idx row, Idx index) const -> bool {
-    std::size_t rnnbrs = row * n_nbrs;
-    for (std::size_t i = 0; i < n_nbrs; i++) {
-      if (index == idx[rnnbrs + i]) {
-        return true;
-      }
+    if (indexed && index != npos()) {
+      return row_index.contains(row, index);
     }
-    return false;
+    return heap_row_contains(storage.index_row(row), n_nbrs, index);
   }
 
   // returns true if either p or q would accept a neighbor with distance d
   auto accepts_either(Idx p, Idx q, DistOut d) const -> bool {
-    return (p < n_points && d < dist[p * n_nbrs]) ||
-           (p != q && q < n_points && d < dist[q * n_nbrs]);
+    return (p < n_points && d < storage.distance(p, 0)) ||
+           (p != q && q < n_points && d < storage.distance(q, 0));
   }
 
   // returns true if p would accept a neighbor with distance d
   auto accepts(Idx p, DistOut d) const -> bool {
-    return p < n_points && d < dist[p * n_nbrs];
+    return p < n_points && d < storage.distance(p, 0);
   }
 
   auto checked_push_pair(std::size_t row, DistOut weight, Idx idx)
@@ -273,54 +486,41 @@ template <typename DistOut = float, typename Idx = uint32_t> struct NNHeap {
   }
 
   auto unchecked_push(Idx row, DistOut weight, Idx index) -> std::size_t {
-    std::size_t r0 = row * n_nbrs;
+    if (indexed) {
+      update_row_index(row, index);
+    }
 
-    // insert val at position zero
-    dist[r0] = weight;
-    idx[r0] = index;
+    auto move = [&](std::size_t from, std::size_t to) {
+      storage.move(row, from, to);
+    };
+    const std::size_t i =
+        heap_siftdown_root(storage.distance_row(row), n_nbrs, weight, move);
 
-    // descend the heap, swapping values until the max heap criterion is met
-    std::size_t i = 0;
-    std::size_t i_swap = 0;
-    while (true) {
-      std::size_t ic1 = 2 * i + 1;
-      std::size_t ic2 = ic1 + 1;
+    storage.set(row, i, weight, index);
 
-      if (ic1 >= n_nbrs) {
-        break;
-      } else if (ic2 >= n_nbrs) {
-        if (dist[r0 + ic1] >= weight) {
-          i_swap = ic1;
-        } else {
-          break;
-        }
-      } else if (dist[r0 + ic1] >= dist[r0 + ic2]) {
-        if (weight < dist[r0 + ic1]) {
-          i_swap = ic1;
-        } else {
-          break;
-        }
-      } else {
-        if (weight < dist[r0 + ic2]) {
-          i_swap = ic2;
-        } else {
-          break;
-        }
-      }
-
-      std::size_t r0i = r0 + i;
-      std::size_t r0is = r0 + i_swap;
-      dist[r0i] = dist[r0is];
-      idx[r0i] = idx[r0is];
+    return 1;
+  }
 
-      i = i_swap;
+  // remove all the neighbors from row i
+  void clear(Idx i) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      const Idx index = storage.index(i, j);
+      if (indexed && index != npos()) {
+        row_index.erase(i, index);
+      }
+      storage.set(i, j, (std::numeric_limits<DistOut>::max)(), npos());
     }
+  }
 
-    std::size_t r0i = r0 + i;
-    dist[r0i] = weight;
-    idx[r0i] = index;
-
-    return 1;
+  // the current root of the heap is about to be replaced by index
+  void update_row_index(Idx row, Idx index) {
+    const Idx evicted = storage.index(row, 0);
+    if (evicted != npos()) {
+      row_index.erase(row, evicted);
+    }
+    if (index != npos()) {
+      row_index.insert(row, index);
+    }
   }
 
   void deheap_sort() {
@@ -330,51 +530,19 @@ template <typename DistOut = float, typename Idx = uint32_t> struct NNHeap {
   }
 
   void deheap_sort(Idx i) {
-    std::size_t r0 = i * n_nbrs;
-    for (std::size_t j = 0; j < n_nbrs1; j++) {
-      std::size_t n1j = n_nbrs1 - j;
-      std::size_t r0nn1 = r0 + n1j;
-      std::swap(idx[r0], idx[r0nn1]);
-      std::swap(dist[r0], dist[r0nn1]);
-      siftdown(r0, n1j);
-    }
+    auto swap = [&](std::size_t a, std::size_t b) { storage.swap(i, a, b); };
+    heap_sort_row(storage.distance_row(i), n_nbrs, swap);
   }
 
-  void siftdown(std::size_t r0, std::size_t len) {
-    std::size_t elt = 0;
-    std::size_t e21 = elt * 2 + 1;
-
-    while (e21 < len) {
-      std::size_t left_child = e21;
-      std::size_t right_child = left_child + 1;
-      std::size_t swap = elt;
+  auto index(Idx i, Idx j) const -> Idx { return storage.index(i, j); }
 
-      if (dist[r0 + swap] < dist[r0 + left_child]) {
-        swap = left_child;
-      }
-
-      if (right_child < len && dist[r0 + swap] < dist[r0 + right_child]) {
-        swap = right_child;
-      }
-
-      if (swap == elt) {
-        break;
-      } else {
-        std::swap(dist[r0 + elt], dist[r0 + swap]);
-        std::swap(idx[r0 + elt], idx[r0 + swap]);
-        elt = swap;
-      }
-      e21 = elt * 2 + 1;
-    }
+  auto distance(Idx i, Idx j) const -> DistOut {
+    return storage.distance(i, j);
   }
 
-  auto index(Idx i, Idx j) const -> Idx { return idx[i * n_nbrs + j]; }
+  auto max_distance(Idx i) const -> DistOut { return storage.distance(i, 0); }
 
-  auto distance(Idx i, Idx j) const -> DistOut { return dist[i * n_nbrs + j]; }
-
-  auto max_distance(Idx i) const -> DistOut { return dist[i * n_nbrs]; }
-
-  auto is_full(Idx i) const -> bool { return idx[i * n_nbrs] != npos(); }
+  auto is_full(Idx i) const -> bool { return storage.index(i, 0) != npos(); }
 };
 
 template <typename NbrHeap, typename Parallel = NoParallel>
@@ -431,5 +599,43 @@ template <typename NbrHeap> auto reverse_heap(const NbrHeap &heap) -> NbrHeap {
   return reverse_heap(heap, heap.n_nbrs, heap.n_nbrs);
 }
 
+// Recalculate the distances from each item to its neighbors in heap with
+// distance, e.g. the exact distance when heap was built with an approximate
+// one, returning the n_nbrs nearest of them by their new distances in a new
+// heap. If n_nbrs is 0, all the neighbors are kept
+template <typename Parallel = NoParallel, typename NbrHeap, typename Distance>
+auto rerank_heap(const NbrHeap &heap, const Distance &distance,
+                 std::size_t n_threads, std::size_t n_nbrs = 0)
+    -> NNHeap<typename Distance::Output, typename Distance::Index> {
+  using Out = typename Distance::Output;
+  using Idx = typename Distance::Index;
+  NNHeap<Out, Idx> reranked(heap.n_points, n_nbrs == 0 ? heap.n_nbrs : n_nbrs);
+
+  NullProgress progress;
+  auto rerank_worker = [&](std::size_t begin, std::size_t end) {
+    std::vector<Idx> nbrs;
+    std::vector<Out> dists;
+    for (auto i = begin; i < end; i++) {
+      nbrs.clear();
+      for (std::size_t j = 0; j < heap.n_nbrs; j++) {
+        const Idx nbr = heap.index(i, j);
+        if (nbr != heap.npos()) {
+          nbrs.push_back(nbr);
+        }
+      }
+      dists.resize(nbrs.size());
+      distance.batch(static_cast<Idx>(i), nbrs.data(), nbrs.size(),
+                     dists.data());
+      for (std::size_t j = 0; j < nbrs.size(); j++) {
+        reranked.checked_push(i, dists[j], nbrs[j]);
+      }
+    }
+  };
+  const std::size_t grain_size = 1;
+  batch_parallel_for<Parallel>(rerank_worker, progress, heap.n_points,
+                               n_threads, grain_size);
+  return reranked;
+}
+
 } // namespace tdoann
 #endif // TDOANN_HEAP_H
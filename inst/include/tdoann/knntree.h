@@ -0,0 +1,440 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_KNNTREE_H
+#define TDOANN_KNNTREE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "blocked.h"
+#include "heap.h"
+#include "nngraph.h"
+#include "parallel.h"
+#include "pivots.h"
+#include "progressbase.h"
+
+namespace tdoann {
+
+// Exact k-nearest neighbors with a space partitioning tree, for data with a
+// small number of dimensions, where most of the tree can be ruled out for
+// each query. The nodes of the trees are contiguous ranges of indices: a range
+// is split in two, with the position of the split calculated from the range,
+// so no node structure is stored and the two halves can be built independently
+
+// A vantage point tree: an internal node [begin, end) has its vantage point at
+// indices[begin], and the items within radius[begin] of the vantage point in
+// [begin + 1, mid), with the rest in [mid, end). Only needs the distance to
+// obey the triangle inequality
+template <typename Out, typename Idx> struct VpTree {
+  std::vector<Idx> indices;
+  std::vector<Out> radius;
+  std::size_t leaf_size;
+
+  static constexpr std::size_t child_offset = 1;
+
+  VpTree(std::size_t n, std::size_t leaf_size)
+      : indices(n), radius(n), leaf_size(leaf_size) {
+    std::iota(indices.begin(), indices.end(), 0);
+  }
+
+  auto is_leaf(std::size_t begin, std::size_t end) const -> bool {
+    return end - begin <= leaf_size;
+  }
+
+  auto mid(std::size_t begin, std::size_t end) const -> std::size_t {
+    return begin + 1 + (end - begin - 1) / 2;
+  }
+
+  // the item in the middle of the range is the vantage point: as the ranges
+  // are partitioned by distance it is effectively a random choice
+  template <typename Distance>
+  auto split(const Distance &distance, std::size_t begin, std::size_t end)
+      -> std::size_t {
+    std::swap(indices[begin], indices[begin + (end - begin) / 2]);
+    const Idx vantage = indices[begin];
+    std::vector<std::pair<Out, Idx>> dists;
+    dists.reserve(end - begin - 1);
+    for (std::size_t p = begin + 1; p < end; p++) {
+      dists.emplace_back(distance(indices[p], vantage), indices[p]);
+    }
+    const std::size_t m = mid(begin, end);
+    auto nth = dists.begin() + (m - begin - 1);
+    std::nth_element(dists.begin(), nth, dists.end());
+    radius[begin] = nth->first;
+    for (std::size_t p = begin + 1; p < end; p++) {
+      indices[p] = dists[p - begin - 1].second;
+    }
+    return m;
+  }
+
+  template <typename Distance, typename Leaves, typename NbrHeap>
+  void search(const Distance &distance, const Leaves &leaves, Idx query,
+              NbrHeap &heap, std::size_t begin, std::size_t end) const {
+    if (is_leaf(begin, end)) {
+      leaves.scan(distance, indices.data(), query, heap, begin, end);
+      return;
+    }
+    const Idx vantage = indices[begin];
+    const Out d = distance(vantage, query);
+    if (heap.accepts(query, d)) {
+      heap.unchecked_push(query, d, vantage);
+    }
+    // by the triangle inequality, the items inside the radius are at least
+    // d - radius from the query, and the items outside are at least
+    // radius - d from it (written to also work with unsigned distances). The
+    // bounds get the same slack as the pivot bounds, so rounding in the
+    // distances can't prune a neighbor
+    const Out r = radius[begin];
+    const std::size_t m = mid(begin, end);
+    if (d < r) {
+      search(distance, leaves, query, heap, begin + 1, m);
+      if (slack_bound(r - d) <= heap.max_distance(query)) {
+        search(distance, leaves, query, heap, m, end);
+      }
+    } else {
+      search(distance, leaves, query, heap, m, end);
+      if (slack_bound(d - r) <= heap.max_distance(query)) {
+        search(distance, leaves, query, heap, begin + 1, m);
+      }
+    }
+  }
+};
+
+// A k-d tree: an internal node [begin, end) is split at mid by the value
+// split_val[mid] of the dimension split_dim[mid] with the largest spread. The
+// coordinates come from the x (reference) and y (query) data of the distance,
+// and PlaneTerm gives a lower bound on the distance between items on opposite
+// sides of the split from the difference of their values in the split
+// dimension, e.g. AbsDiff for Euclidean or Manhattan distances, and
+// SquaredDiff for squared Euclidean distances
+template <typename In, typename Out, typename Idx, typename PlaneTerm>
+struct KdTree {
+  std::vector<Idx> indices;
+  std::vector<std::size_t> split_dim;
+  std::vector<In> split_val;
+  std::size_t leaf_size;
+
+  static constexpr std::size_t child_offset = 0;
+
+  KdTree(std::size_t n, std::size_t leaf_size)
+      : indices(n), split_dim(n), split_val(n), leaf_size(leaf_size) {
+    std::iota(indices.begin(), indices.end(), 0);
+  }
+
+  auto is_leaf(std::size_t begin, std::size_t end) const -> bool {
+    return end - begin <= leaf_size;
+  }
+
+  auto mid(std::size_t begin, std::size_t end) const -> std::size_t {
+    return begin + (end - begin) / 2;
+  }
+
+  template <typename Distance>
+  auto split(const Distance &distance, std::size_t begin, std::size_t end)
+      -> std::size_t {
+    const std::vector<In> &x = distance.x;
+    const std::size_t ndim = distance.ndim;
+    std::size_t dim = 0;
+    In max_spread = 0;
+    for (std::size_t d = 0; d < ndim; d++) {
+      In lo = x[ndim * indices[begin] + d];
+      In hi = lo;
+      for (std::size_t p = begin + 1; p < end; p++) {
+        const In val = x[ndim * indices[p] + d];
+        lo = std::min(lo, val);
+        hi = std::max(hi, val);
+      }
+      if (hi - lo > max_spread) {
+        max_spread = hi - lo;
+        dim = d;
+      }
+    }
+    const std::size_t m = mid(begin, end);
+    std::nth_element(indices.begin() + begin, indices.begin() + m,
+                     indices.begin() + end, [&](Idx a, Idx b) {
+                       return x[ndim * a + dim] < x[ndim * b + dim];
+                     });
+    split_dim[m] = dim;
+    split_val[m] = x[ndim * indices[m] + dim];
+    return m;
+  }
+
+  template <typename Distance, typename Leaves, typename NbrHeap>
+  void search(const Distance &distance, const Leaves &leaves, Idx query,
+              NbrHeap &heap, std::size_t begin, std::size_t end) const {
+    if (is_leaf(begin, end)) {
+      leaves.scan(distance, indices.data(), query, heap, begin, end);
+      return;
+    }
+    const std::size_t m = mid(begin, end);
+    const In val = distance.y[distance.ndim * query + split_dim[m]];
+    const double bound = slack_bound(PlaneTerm()(val, split_val[m]));
+    if (val < split_val[m]) {
+      search(distance, leaves, query, heap, begin, m);
+      if (bound <= heap.max_distance(query)) {
+        search(distance, leaves, query, heap, m, end);
+      }
+    } else {
+      search(distance, leaves, query, heap, m, end);
+      if (bound <= heap.max_distance(query)) {
+        search(distance, leaves, query, heap, begin, m);
+      }
+    }
+  }
+};
+
+template <typename Tree, typename Distance>
+void build_subtree(Tree &tree, const Distance &distance, std::size_t begin,
+                   std::size_t end) {
+  if (tree.is_leaf(begin, end)) {
+    return;
+  }
+  const std::size_t m = tree.split(distance, begin, end);
+  build_subtree(tree, distance, begin + Tree::child_offset, m);
+  build_subtree(tree, distance, m, end);
+}
+
+template <typename Tree, typename Visit>
+void for_each_leaf(const Tree &tree, std::size_t begin, std::size_t end,
+                   Visit &visit) {
+  if (tree.is_leaf(begin, end)) {
+    visit(begin, end);
+    return;
+  }
+  const std::size_t m = tree.mid(begin, end);
+  for_each_leaf(tree, begin + Tree::child_offset, m, visit);
+  for_each_leaf(tree, m, end, visit);
+}
+
+// Scans the leaves of a tree one distance at a time
+template <typename Distance> struct PairwiseLeaves {
+  using Idx = typename Distance::Index;
+
+  template <typename Tree> PairwiseLeaves(const Tree &, const Distance &) {}
+
+  template <typename NbrHeap>
+  void scan(const Distance &distance, const Idx *indices, Idx query,
+            NbrHeap &heap, std::size_t begin, std::size_t end) const {
+    for (std::size_t p = begin; p < end; p++) {
+      const auto d = distance(indices[p], query);
+      if (heap.accepts(query, d)) {
+        heap.unchecked_push(query, d, indices[p]);
+      }
+    }
+  }
+};
+
+// The reference data copied into the order of the tree indices, with each leaf
+// split into chunks of leaf_block_size items, padded at the end of the leaf,
+// and each chunk stored dimension by dimension, so the distances from a query
+// to a chunk are calculated together with block_distances, as in the blocked
+// brute force search. Leaves are small, so the chunks are narrower than
+// blocked_size
+constexpr std::size_t leaf_block_size = 8;
+
+template <typename Distance> struct BlockedLeaves {
+  using In = typename Distance::Input;
+  using Out = typename Distance::Output;
+  using Idx = typename Distance::Index;
+  using Term = typename DenseTerms<Distance>::Term;
+  using Finish = typename DenseTerms<Distance>::Finish;
+
+  std::vector<In> data;
+  // the start in data of the leaf beginning at each tree index
+  std::vector<std::size_t> offsets;
+
+  template <typename Tree>
+  BlockedLeaves(const Tree &tree, const Distance &distance)
+      : offsets(tree.indices.size()) {
+    const std::size_t ndim = distance.ndim;
+    auto copy_leaf = [&](std::size_t begin, std::size_t end) {
+      const std::size_t n_chunks =
+          (end - begin + leaf_block_size - 1) / leaf_block_size;
+      offsets[begin] = data.size();
+      data.resize(data.size() + n_chunks * ndim * leaf_block_size);
+      In *leaf = &data[offsets[begin]];
+      for (std::size_t r = 0; r < end - begin; r++) {
+        const In *xr = &distance.x[ndim * tree.indices[begin + r]];
+        In *chunk = leaf + (r / leaf_block_size) * ndim * leaf_block_size;
+        for (std::size_t d = 0; d < ndim; d++) {
+          chunk[d * leaf_block_size + r % leaf_block_size] = xr[d];
+        }
+      }
+    };
+    for_each_leaf(tree, 0, tree.indices.size(), copy_leaf);
+  }
+
+  template <typename NbrHeap>
+  void scan(const Distance &distance, const Idx *indices, Idx query,
+            NbrHeap &heap, std::size_t begin, std::size_t end) const {
+    const std::size_t ndim = distance.ndim;
+    const std::size_t n = end - begin;
+    const In *leaf = &data[offsets[begin]];
+    const In *yq = &distance.y[ndim * query];
+    Out dist[leaf_block_size];
+    for (std::size_t c = 0; c < n; c += leaf_block_size) {
+      block_distances<leaf_block_size, Out, Term, Finish>(leaf + c * ndim, yq,
+                                                          ndim, dist);
+      // the padding at the end of the leaf is ignored
+      const std::size_t n_chunk = (std::min)(leaf_block_size, n - c);
+      for (std::size_t r = 0; r < n_chunk; r++) {
+        if (heap.accepts(query, dist[r])) {
+          heap.unchecked_push(query, dist[r], indices[begin + c + r]);
+        }
+      }
+    }
+  }
+};
+
+template <typename Distance>
+using LeafScan =
+    typename std::conditional<DenseTerms<Distance>::value,
+                              BlockedLeaves<Distance>,
+                              PairwiseLeaves<Distance>>::type;
+
+// The top of the tree is split serially until there are enough subtrees to
+// build them in parallel
+template <typename Parallel, typename Tree, typename Distance>
+void build_tree(Tree &tree, const Distance &distance, std::size_t n_threads) {
+  using Range = std::pair<std::size_t, std::size_t>;
+  std::vector<Range> ranges{Range(0, tree.indices.size())};
+  bool any_split = true;
+  while (ranges.size() < 4 * n_threads && any_split) {
+    any_split = false;
+    std::vector<Range> children;
+    for (const auto &range : ranges) {
+      if (tree.is_leaf(range.first, range.second)) {
+        children.push_back(range);
+        continue;
+      }
+      const std::size_t m = tree.split(distance, range.first, range.second);
+      children.emplace_back(range.first + Tree::child_offset, m);
+      children.emplace_back(m, range.second);
+      any_split = true;
+    }
+    ranges.swap(children);
+  }
+
+  auto worker = [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; i++) {
+      build_subtree(tree, distance, ranges[i].first, ranges[i].second);
+    }
+  };
+  if (n_threads > 0) {
+    const std::size_t grain_size = 1;
+    Parallel::parallel_for(0, ranges.size(), worker, n_threads, grain_size);
+  } else {
+    worker(0, ranges.size());
+  }
+}
+
+// Search tree for the neighbors of every item of the query data of distance,
+// in parallel batches of queries, each filling its own rows of the heap
+template <typename Progress, typename Parallel, typename NbrHeap,
+          typename Tree, typename Distance>
+auto tree_query(const Tree &tree, const Distance &distance,
+                typename Distance::Index n_nbrs, std::size_t n_threads,
+                bool verbose)
+    -> NNGraph<typename Distance::Output, typename Distance::Index> {
+  NbrHeap neighbor_heap(distance.ny, n_nbrs);
+  const std::size_t n_ref = tree.indices.size();
+  const LeafScan<Distance> leaves(tree, distance);
+  auto worker = [&](std::size_t begin, std::size_t end) {
+    for (std::size_t query = begin; query < end; query++) {
+      tree.search(distance, leaves, query, neighbor_heap, 0, n_ref);
+    }
+  };
+  Progress progress(1, verbose);
+  const std::size_t block_size = 1024;
+  if (n_threads > 0) {
+    const std::size_t grain_size = 1;
+    batch_parallel_for<Parallel>(worker, progress, neighbor_heap.n_points,
+                                 block_size, n_threads, grain_size);
+    sort_heap<NbrHeap, Parallel>(neighbor_heap, block_size, n_threads,
+                                 grain_size);
+  } else {
+    batch_serial_for(worker, progress, neighbor_heap.n_points, block_size);
+    sort_heap(neighbor_heap);
+  }
+  return heap_to_graph(neighbor_heap);
+}
+
+// The k-nearest neighbors of the items of the query data of distance from
+// its reference data, with a vantage point tree built with ref_distance: a
+// distance between the items of the reference data
+template <typename Distance, typename Progress, typename Parallel,
+          typename NbrHeap =
+              NNHeap<typename Distance::Output, typename Distance::Index>,
+          typename RefDistance>
+auto vp_tree_query(const RefDistance &ref_distance, const Distance &distance,
+                   typename Distance::Index n_nbrs, std::size_t leaf_size,
+                   std::size_t n_threads = 0, bool verbose = false)
+    -> NNGraph<typename Distance::Output, typename Distance::Index> {
+  VpTree<typename Distance::Output, typename Distance::Index> tree(
+      distance.nx, leaf_size);
+  build_tree<Parallel>(tree, ref_distance, n_threads);
+  return tree_query<Progress, Parallel, NbrHeap>(tree, distance, n_nbrs,
+                                                 n_threads, verbose);
+}
+
+template <typename Distance, typename Progress, typename Parallel,
+          typename NbrHeap =
+              NNHeap<typename Distance::Output, typename Distance::Index>>
+auto vp_tree_build(const Distance &distance, typename Distance::Index n_nbrs,
+                   std::size_t leaf_size, std::size_t n_threads = 0,
+                   bool verbose = false)
+    -> NNGraph<typename Distance::Output, typename Distance::Index> {
+  return vp_tree_query<Distance, Progress, Parallel, NbrHeap>(
+      distance, distance, n_nbrs, leaf_size, n_threads, verbose);
+}
+
+// The k-nearest neighbors with a k-d tree, which needs a distance with the
+// coordinates of the data in x (reference) and y (query), such as Euclidean
+template <typename PlaneTerm, typename Distance, typename Progress,
+          typename Parallel,
+          typename NbrHeap =
+              NNHeap<typename Distance::Output, typename Distance::Index>>
+auto kd_tree_query(const Distance &distance, typename Distance::Index n_nbrs,
+                   std::size_t leaf_size, std::size_t n_threads = 0,
+                   bool verbose = false)
+    -> NNGraph<typename Distance::Output, typename Distance::Index> {
+  KdTree<typename Distance::Input, typename Distance::Output,
+         typename Distance::Index, PlaneTerm>
+      tree(distance.nx, leaf_size);
+  build_tree<Parallel>(tree, distance, n_threads);
+  return tree_query<Progress, Parallel, NbrHeap>(tree, distance, n_nbrs,
+                                                 n_threads, verbose);
+}
+
+} // namespace tdoann
+
+#endif // TDOANN_KNNTREE_H
@@ -0,0 +1,338 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_NNDDISTRIBUTED_H
+#define TDOANN_NNDDISTRIBUTED_H
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "distance.h"
+#include "graphupdate.h"
+#include "heap.h"
+#include "nndescent.h"
+#include "philox.h"
+#include "progress.h"
+
+namespace tdoann {
+
+// Nearest neighbor descent split over several workers, each of which owns a
+// contiguous block of rows of the data and of the neighbor graph. Each
+// iteration is carried out in five steps, with the messages produced by each
+// step delivered to the relevant worker before the next step starts. How the
+// messages are delivered is up to the caller:
+//
+// 1. candidates: sample the candidate neighbors of the owned rows. The reverse
+//    candidates are sent to the owner of the neighbor.
+// 2. requests: receive the reverse candidates. The indices of the candidates
+//    owned by other workers are sent to their owners as a request for their
+//    rows of the data.
+// 3. rows: send the rows of the data requested by each worker.
+// 4. join: receive the requested rows, then carry out the local join of the
+//    owned rows. Each update (p, q, d) is sent to the owners of p and q.
+// 5. apply: receive the updates and apply those for the owned rows.
+//
+// The distance bound of every row, used to filter the updates in the join
+// step, must also be sent to all workers after each apply step.
+
+// Divides n_points rows into n_workers contiguous blocks
+struct RowPartition {
+  std::size_t n_points;
+  std::size_t n_workers;
+  std::size_t chunk_size;
+
+  RowPartition(std::size_t n_points, std::size_t n_workers)
+      : n_points(n_points), n_workers(n_workers),
+        chunk_size((n_points + n_workers - 1) / n_workers) {}
+
+  auto owner(std::size_t i) const -> std::size_t { return i / chunk_size; }
+  auto begin(std::size_t worker) const -> std::size_t {
+    return (std::min)(worker * chunk_size, n_points);
+  }
+  auto end(std::size_t worker) const -> std::size_t {
+    return (std::min)((worker + 1) * chunk_size, n_points);
+  }
+};
+
+// Asks the owner of row to consider nbr as a candidate neighbor
+template <typename Idx> struct CandidateMessage {
+  Idx row{0};
+  Idx nbr{0};
+  double priority{0};
+  char flag{0};
+
+  CandidateMessage() = default;
+  CandidateMessage(Idx row, Idx nbr, double priority, char flag)
+      : row(row), nbr(nbr), priority(priority), flag(flag) {}
+
+  // the order in which the candidates of a row are pushed, so the candidates
+  // don't depend on the order the messages arrive in
+  auto operator<(const CandidateMessage &other) const -> bool {
+    if (row != other.row) {
+      return row < other.row;
+    }
+    if (priority != other.priority) {
+      return priority < other.priority;
+    }
+    return nbr < other.nbr;
+  }
+};
+
+namespace upd {
+// The graph updater for the local join of a worker: the candidates are global
+// indices, but the distances are calculated with the rows of the data held by
+// the worker. Updates which pass the distance bounds are sent to the owners of
+// p and q rather than applied.
+template <typename Worker> struct Distributed {
+  using DistOut = typename Worker::DistOut;
+  using Idx = typename Worker::Idx;
+
+  const Worker &worker;
+  const typename Worker::Distance &distance;
+  std::vector<std::vector<Update<DistOut, Idx>>> outbox;
+  DistanceBatch<DistOut, Idx> local_qs;
+
+  Distributed(const Worker &worker,
+              const typename Worker::Distance &distance)
+      : worker(worker), distance(distance),
+        outbox(worker.partition.n_workers) {}
+
+  // nothing is applied to the graph here, so this always returns 0
+  auto generate_and_apply(Idx p, DistanceBatch<DistOut, Idx> &qs)
+      -> std::size_t {
+    local_qs.clear();
+    for (auto q : qs.idx) {
+      local_qs.add(worker.data_index(q));
+    }
+    local_qs.calculate(distance, worker.data_index(p));
+    for (std::size_t k = 0; k < qs.size(); k++) {
+      generate(p, qs.idx[k], local_qs.dist[k]);
+    }
+    return 0;
+  }
+
+  void generate(Idx p, Idx q, DistOut d) {
+    const auto &bounds = worker.bounds;
+    if (!(d < bounds[p] || (p != q && d < bounds[q]))) {
+      return;
+    }
+    const auto owner_p = worker.partition.owner(p);
+    const auto owner_q = worker.partition.owner(q);
+    outbox[owner_p].emplace_back(p, q, d);
+    if (owner_q != owner_p) {
+      outbox[owner_q].emplace_back(p, q, d);
+    }
+  }
+};
+} // namespace upd
+
+template <typename D> struct NNDWorker {
+  using Distance = D;
+  using DistIn = typename Distance::Input;
+  using DistOut = typename Distance::Output;
+  using Idx = typename Distance::Index;
+  using Update = upd::Update<DistOut, Idx>;
+
+  RowPartition partition;
+  std::size_t worker;
+  std::size_t row_begin;
+  std::size_t ndim;
+  std::size_t max_candidates;
+  // the owned rows of the data, followed by the rows of the other workers
+  // requested for the current iteration
+  std::vector<DistIn> data;
+  std::vector<Idx> remote_ids;
+  // owned rows only, indexed from row_begin, but neighbors are global indices
+  NNDHeap<DistOut, Idx> current_graph;
+  NNHeap<DistOut, Idx> new_nbrs;
+  NNHeap<DistOut, Idx> old_nbrs;
+  std::vector<CandidateMessage<Idx>> own_candidates;
+  // max distance of every row of the graph, as of the last apply step
+  std::vector<DistOut> bounds;
+
+  NNDWorker(const std::vector<DistIn> &data, std::size_t ndim,
+            const RowPartition &partition, std::size_t worker,
+            std::size_t n_nbrs, std::size_t max_candidates)
+      : partition(partition), worker(worker),
+        row_begin(partition.begin(worker)), ndim(ndim),
+        max_candidates(max_candidates), data(data),
+        current_graph(partition.end(worker) - row_begin, n_nbrs),
+        new_nbrs(0, max_candidates), old_nbrs(0, max_candidates),
+        bounds(partition.n_points, (std::numeric_limits<DistOut>::max)()) {}
+
+  auto n_rows() const -> std::size_t { return current_graph.n_points; }
+
+  auto owns(Idx i) const -> bool { return partition.owner(i) == worker; }
+
+  auto local(Idx i) const -> Idx { return i - row_begin; }
+
+  // the row of data which holds item i: only valid for the owned rows and
+  // the rows received for the current iteration
+  auto data_index(Idx i) const -> Idx {
+    if (owns(i)) {
+      return local(i);
+    }
+    auto it = std::lower_bound(remote_ids.begin(), remote_ids.end(), i);
+    return static_cast<Idx>(n_rows() + (it - remote_ids.begin()));
+  }
+
+  // Step 1. Candidates are pushed for both ends of each edge of the graph
+  // (row, nbr), with the same priority, which depends only on seed and the
+  // edge
+  auto candidates(uint64_t seed)
+      -> std::vector<std::vector<CandidateMessage<Idx>>> {
+    std::vector<std::vector<CandidateMessage<Idx>>> outbox(
+        partition.n_workers);
+    own_candidates.clear();
+
+    const std::size_t n_nbrs = current_graph.n_nbrs;
+    for (std::size_t li = 0; li < n_rows(); li++) {
+      const Idx i = row_begin + li;
+      for (std::size_t j = 0; j < n_nbrs; j++) {
+        auto nbr = current_graph.index(li, j);
+        if (nbr == current_graph.npos()) {
+          continue;
+        }
+        char flag = current_graph.flag(li, j);
+        auto priority = i < nbr ? PhiloxRand(seed, i, nbr).unif()
+                                : PhiloxRand(seed, nbr, i).unif();
+        own_candidates.emplace_back(i, nbr, priority, flag);
+        if (owns(nbr)) {
+          own_candidates.emplace_back(nbr, i, priority, flag);
+        } else {
+          outbox[partition.owner(nbr)].emplace_back(nbr, i, priority, flag);
+        }
+      }
+    }
+    return outbox;
+  }
+
+  // Step 2: receive the reverse candidates sent to this worker, returning the
+  // indices of the rows of the data needed from each of the other workers
+  auto requests(const std::vector<CandidateMessage<Idx>> &inbox)
+      -> std::vector<std::vector<Idx>> {
+    own_candidates.insert(own_candidates.end(), inbox.begin(), inbox.end());
+    std::sort(own_candidates.begin(), own_candidates.end());
+    new_nbrs = NNHeap<DistOut, Idx>(n_rows(), max_candidates);
+    old_nbrs = NNHeap<DistOut, Idx>(n_rows(), max_candidates);
+    for (const auto &msg : own_candidates) {
+      auto &nbrs = msg.flag == 1 ? new_nbrs : old_nbrs;
+      nbrs.checked_push(local(msg.row), static_cast<DistOut>(msg.priority),
+                        msg.nbr);
+    }
+    own_candidates.clear();
+    flag_retained_new_candidates(current_graph, new_nbrs);
+
+    remote_ids.clear();
+    for (const auto *nbrs : {&new_nbrs, &old_nbrs}) {
+      for (std::size_t li = 0; li < n_rows(); li++) {
+        for (std::size_t j = 0; j < max_candidates; j++) {
+          auto q = nbrs->index(li, j);
+          if (q != nbrs->npos() && !owns(q)) {
+            remote_ids.push_back(q);
+          }
+        }
+      }
+    }
+    std::sort(remote_ids.begin(), remote_ids.end());
+    remote_ids.erase(std::unique(remote_ids.begin(), remote_ids.end()),
+                     remote_ids.end());
+
+    std::vector<std::vector<Idx>> outbox(partition.n_workers);
+    for (auto q : remote_ids) {
+      outbox[partition.owner(q)].push_back(q);
+    }
+    return outbox;
+  }
+
+  // Step 3: the owned rows of the data requested by another worker
+  auto rows(const std::vector<Idx> &ids) const -> std::vector<DistIn> {
+    std::vector<DistIn> result;
+    result.reserve(ids.size() * ndim);
+    for (auto i : ids) {
+      auto begin = data.begin() + local(i) * ndim;
+      result.insert(result.end(), begin, begin + ndim);
+    }
+    return result;
+  }
+
+  // Step 4: the local join over the owned rows, once the rows requested from
+  // each worker have been received, in the order of the workers
+  auto join(const std::vector<std::vector<DistIn>> &inbox)
+      -> std::vector<std::vector<Update>> {
+    std::vector<DistIn> local_data(data.begin(),
+                                   data.begin() + n_rows() * ndim);
+    for (const auto &received : inbox) {
+      local_data.insert(local_data.end(), received.begin(), received.end());
+    }
+    if (local_data.size() != (n_rows() + remote_ids.size()) * ndim) {
+      throw std::runtime_error("Bad number of rows received for local join");
+    }
+    data.swap(local_data);
+
+    const Distance distance(data, ndim);
+    upd::Distributed<NNDWorker> graph_updater(*this, distance);
+    NullProgress null_progress;
+    NNDProgress<NullProgress> progress(null_progress);
+    local_join(graph_updater, new_nbrs, old_nbrs, progress);
+
+    // the candidates and remote rows are not needed until the next iteration
+    data.resize(n_rows() * ndim);
+    remote_ids.clear();
+    new_nbrs = NNHeap<DistOut, Idx>(0, max_candidates);
+    old_nbrs = NNHeap<DistOut, Idx>(0, max_candidates);
+    return std::move(graph_updater.outbox);
+  }
+
+  // Step 5: apply the updates sent to this worker, returning the number of
+  // changes made to the owned rows
+  auto apply(const std::vector<Update> &inbox) -> std::size_t {
+    std::size_t c = 0;
+    for (const auto &update : inbox) {
+      if (owns(update.p)) {
+        c += current_graph.checked_push(local(update.p), update.d, update.q);
+      }
+      if (update.p != update.q && owns(update.q)) {
+        c += current_graph.checked_push(local(update.q), update.d, update.p);
+      }
+    }
+    return c;
+  }
+
+  // distance bounds of the owned rows, to be sent to all workers
+  auto max_distances() const -> std::vector<DistOut> {
+    std::vector<DistOut> result(n_rows());
+    for (std::size_t li = 0; li < n_rows(); li++) {
+      result[li] = current_graph.max_distance(li);
+    }
+    return result;
+  }
+};
+
+} // namespace tdoann
+#endif // TDOANN_NNDDISTRIBUTED_H
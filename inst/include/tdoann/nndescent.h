@@ -27,38 +27,267 @@
 #ifndef TDOANN_NNDESCENT_H
 #define TDOANN_NNDESCENT_H
 
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <vector>
+
+#include "checkpoint.h"
+#include "distance.h"
 #include "heap.h"
 
 namespace tdoann {
 // mark any neighbor in the current graph that was retained in the new
 // candidates as false
-template <typename DistOut, typename Idx>
-void flag_retained_new_candidates(NNDHeap<DistOut, Idx> &current_graph,
-                                  const NNHeap<DistOut, Idx> &new_nbrs,
+template <typename NbrHeap, typename CandidateHeap>
+void flag_retained_new_candidates(NbrHeap &current_graph,
+                                  const CandidateHeap &new_nbrs,
                                   std::size_t begin, std::size_t end) {
   const std::size_t n_nbrs = current_graph.n_nbrs;
-  std::size_t innbrs = 0;
-  std::size_t ij = 0;
   for (auto i = begin; i < end; i++) {
-    innbrs = i * n_nbrs;
     for (std::size_t j = 0; j < n_nbrs; j++) {
-      ij = innbrs + j;
-      if (new_nbrs.contains(i, current_graph.idx[ij])) {
-        current_graph.flags[ij] = 0;
+      if (new_nbrs.contains(i, current_graph.index(i, j))) {
+        current_graph.set_flag(i, j, 0);
       }
     }
   }
 }
 
 // overload for serial processing case which does entire graph in one chunk
-template <typename DistOut, typename Idx>
-void flag_retained_new_candidates(
-    NNDHeap<DistOut, Idx> &current_graph,
-    const NNHeap<DistOut, Idx> &new_candidate_neighbors) {
+template <typename NbrHeap, typename CandidateHeap>
+void flag_retained_new_candidates(NbrHeap &current_graph,
+                                  const CandidateHeap &new_candidate_neighbors) {
   flag_retained_new_candidates(current_graph, new_candidate_neighbors, 0,
                                current_graph.n_points);
 }
 
+// The number of distance calculations carried out by the local join over the
+// candidates of items begin to end. This is an upper bound if the graph updater
+// skips pairs it has already seen.
+template <typename CandidateHeap>
+auto local_join_size(const CandidateHeap &new_nbrs,
+                     const CandidateHeap &old_nbrs, std::size_t begin,
+                     std::size_t end) -> std::size_t {
+  const std::size_t max_candidates = new_nbrs.n_nbrs;
+  std::size_t n_evals = 0;
+  for (auto i = begin; i < end; i++) {
+    std::size_t n_new = 0;
+    std::size_t n_old = 0;
+    for (std::size_t j = 0; j < max_candidates; j++) {
+      if (new_nbrs.index(i, j) != new_nbrs.npos()) {
+        ++n_new;
+      }
+      if (old_nbrs.index(i, j) != old_nbrs.npos()) {
+        ++n_old;
+      }
+    }
+    n_evals += (n_new * (n_new + 1)) / 2 + n_new * n_old;
+  }
+  return n_evals;
+}
+
+// Gather the candidates to compare with the jth new candidate of i in the
+// local join: the new candidates from j onwards, then all the old candidates
+template <typename CandidateHeap, typename DistOut, typename Idx>
+void local_join_candidates(const CandidateHeap &new_nbrs,
+                           const CandidateHeap &old_nbrs, std::size_t i,
+                           std::size_t j, DistanceBatch<DistOut, Idx> &qs) {
+  const std::size_t max_candidates = new_nbrs.n_nbrs;
+  qs.clear();
+  for (std::size_t k = j; k < max_candidates; k++) {
+    auto q = new_nbrs.index(i, k);
+    if (q != new_nbrs.npos()) {
+      qs.add(q);
+    }
+  }
+  for (std::size_t k = 0; k < max_candidates; k++) {
+    auto q = old_nbrs.index(i, k);
+    if (q != old_nbrs.npos()) {
+      qs.add(q);
+    }
+  }
+}
+
+// true if idx is a neighbor of i with the given flag
+template <typename NbrHeap>
+auto has_nbr_with_flag(const NbrHeap &current_graph, std::size_t i,
+                       typename NbrHeap::Index idx, char flag) -> bool {
+  for (std::size_t j = 0; j < current_graph.n_nbrs; j++) {
+    if (current_graph.index(i, j) == idx) {
+      return current_graph.flag(i, j) == flag;
+    }
+  }
+  return false;
+}
+
+// The number of times each item appears with the given flag in the neighbor
+// lists of the other items (its k-occurrence)
+template <typename NbrHeap>
+auto k_occurrences(const NbrHeap &current_graph, char flag)
+    -> std::vector<std::size_t> {
+  const std::size_t n_points = current_graph.n_points;
+  const std::size_t n_nbrs = current_graph.n_nbrs;
+  std::vector<std::size_t> k_occ(n_points, 0);
+  for (std::size_t i = 0; i < n_points; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      auto nbr = current_graph.index(i, j);
+      if (nbr == current_graph.npos() || nbr == i ||
+          current_graph.flag(i, j) != flag) {
+        continue;
+      }
+      ++k_occ[nbr];
+    }
+  }
+  return k_occ;
+}
+
+// The number of distance calculations the local join would carry out if all
+// the neighbors were used as candidates (subject to max_candidates), based on
+// the flags of current_graph before the candidates are built.
+template <typename NbrHeap>
+auto full_local_join_size(const NbrHeap &current_graph,
+                          std::size_t max_candidates) -> std::size_t {
+  const std::size_t n_points = current_graph.n_points;
+  const std::size_t n_nbrs = current_graph.n_nbrs;
+  std::vector<std::size_t> n_new(n_points, 0);
+  std::vector<std::size_t> n_old(n_points, 0);
+  for (std::size_t i = 0; i < n_points; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      auto nbr = current_graph.index(i, j);
+      if (nbr == current_graph.npos()) {
+        continue;
+      }
+      const char flag = current_graph.flag(i, j);
+      auto &counts = flag == 1 ? n_new : n_old;
+      ++counts[i];
+      // a reverse neighbor is only new if nbr doesn't already have it
+      if (nbr != i && !has_nbr_with_flag(current_graph, nbr, i, flag)) {
+        ++counts[nbr];
+      }
+    }
+  }
+  std::size_t n_evals = 0;
+  for (std::size_t i = 0; i < n_points; i++) {
+    const std::size_t n_new_i = (std::min)(n_new[i], max_candidates);
+    const std::size_t n_old_i = (std::min)(n_old[i], max_candidates);
+    n_evals += (n_new_i * (n_new_i + 1)) / 2 + n_new_i * n_old_i;
+  }
+  return n_evals;
+}
+
+// Controls the candidates used in each iteration of nearest neighbor descent.
+// Each new neighbor is used as a candidate with probability sample_rate (see
+// build_candidates_full). If adaptive is true, the first iteration uses half
+// of max_candidates, and after each iteration the number of candidates grows
+// by a factor of 2 minus the fraction of the graph which was updated, up to
+// max_candidates: while most of the graph is changing, the neighbors (and so
+// the candidates) are poor and are about to be replaced anyway, so using all
+// of them is mostly wasted effort.
+// If max_reverse is not zero, an item which appears in the neighbor lists of
+// more than max_reverse other items (a hub) only uses each of them as a
+// reverse candidate with probability max_reverse divided by its k-occurrence,
+// so it is sent around max_reverse reverse candidates. New and old neighbors
+// are counted separately, as they go into separate candidate lists. Items
+// which aren't hubs are unaffected.
+// If log_each_iter is true, and either the sampling, the adaptive schedule or
+// the reverse candidate limit is in use, the number of distance calculations
+// in the local join and the number saved compared to using all the candidates
+// are logged.
+struct CandidateSchedule {
+  std::size_t max_candidates;
+  double sample_rate;
+  bool adaptive;
+  bool log_each_iter;
+  std::size_t max_reverse;
+  // the maximum number of candidates for the next iteration
+  std::size_t n_candidates;
+  // the full and actual number of local join distance calculations for the
+  // current iteration
+  std::size_t n_full_evals;
+  std::size_t n_evals;
+  // the probability of each item being used as a new or old reverse candidate
+  // in the current iteration: empty if there is no limit on the reverse
+  // candidates
+  std::vector<double> new_reverse_rates;
+  std::vector<double> old_reverse_rates;
+
+  CandidateSchedule(std::size_t max_candidates, double sample_rate = 1.0,
+                    bool adaptive = false, bool log_each_iter = false,
+                    std::size_t max_reverse = 0)
+      : max_candidates(max_candidates), sample_rate(sample_rate),
+        adaptive(adaptive), log_each_iter(log_each_iter),
+        max_reverse(max_reverse),
+        n_candidates(adaptive ? (max_candidates + 1) / 2 : max_candidates),
+        n_full_evals(0), n_evals(0) {}
+
+  auto is_full() const -> bool {
+    return sample_rate >= 1.0 && !adaptive && max_reverse == 0;
+  }
+
+  auto reports() const -> bool { return log_each_iter && !is_full(); }
+
+  // the probability of using a new or old neighbor of item i as a reverse
+  // candidate
+  auto reverse_rate(std::size_t i, bool is_new) const -> double {
+    const auto &rates = is_new ? new_reverse_rates : old_reverse_rates;
+    return rates.empty() ? 1.0 : rates[i];
+  }
+
+  // call before building the candidates
+  template <typename NbrHeap> void start_iter(const NbrHeap &current_graph) {
+    if (reports()) {
+      n_full_evals = full_local_join_size(current_graph, max_candidates);
+    }
+    if (max_reverse > 0) {
+      new_reverse_rates = reverse_rates(current_graph, 1);
+      old_reverse_rates = reverse_rates(current_graph, 0);
+    }
+  }
+
+  template <typename NbrHeap>
+  auto reverse_rates(const NbrHeap &current_graph, char flag) const
+      -> std::vector<double> {
+    auto k_occ = k_occurrences(current_graph, flag);
+    std::vector<double> rates(k_occ.size(), 1.0);
+    for (std::size_t i = 0; i < k_occ.size(); i++) {
+      if (k_occ[i] > max_reverse) {
+        rates[i] = static_cast<double>(max_reverse) / k_occ[i];
+      }
+    }
+    return rates;
+  }
+
+  // call after building the candidates
+  template <typename CandidateHeap>
+  void candidates_built(const CandidateHeap &new_nbrs,
+                        const CandidateHeap &old_nbrs) {
+    if (reports()) {
+      n_evals = local_join_size(new_nbrs, old_nbrs, 0, new_nbrs.n_points);
+    }
+  }
+
+  // call at the end of an iteration which carried out n_updates updates
+  template <typename Progress>
+  void iter_finished(std::size_t n_updates, std::size_t n_points,
+                     std::size_t n_nbrs, Progress &progress) {
+    if (reports()) {
+      std::ostringstream os;
+      os << "max candidates = " << n_candidates
+         << " distance calculations = " << n_evals << " saved = "
+         << (n_full_evals > n_evals ? n_full_evals - n_evals : 0);
+      progress.log(os.str());
+    }
+    if (!adaptive) {
+      return;
+    }
+    const double update_rate = (std::min)(
+        1.0, static_cast<double>(n_updates) / (n_points * n_nbrs));
+    const double scaled = std::ceil(n_candidates * (2.0 - update_rate));
+    n_candidates =
+        (std::min)(max_candidates, static_cast<std::size_t>(scaled));
+  }
+};
+
 // This corresponds to the construction of new, old, new' and old' in
 // Algorithm 2, with some minor differences:
 // 1. old' and new' (the reverse candidates) are built at the same time as old
@@ -66,100 +295,133 @@ void flag_retained_new_candidates(
 // then i is a reverse candidate of new[j]. This saves on building the entire
 // reverse candidates list and then down-sampling.
 // 2. Not all old members of current KNN are retained in the old candidates
-// list, nor are rho * K new candidates sampled. Instead, the current members
-// of the KNN are assigned into old and new based on their flag value, with the
-// size of the final candidate list controlled by the maximum size of
-// the candidates neighbors lists.
-template <typename DistOut, typename Idx, typename Rand>
-void build_candidates_full(NNDHeap<DistOut, Idx> &current_graph,
-                           NNHeap<DistOut, Idx> &new_nbrs,
-                           decltype(new_nbrs) &old_nbrs, Rand &rand) {
+// list. Instead, the current members of the KNN are assigned into old and new
+// based on their flag value, with the size of the final candidate list
+// controlled by the maximum size of the candidates neighbors lists.
+// 3. Rather than sampling rho * K new candidates, each new neighbor is used
+// with probability sample_rate (i.e. rho). The priority of a candidate is
+// already a uniform random number, so a new neighbor is sampled if its
+// priority is less than sample_rate. New neighbors which aren't sampled keep
+// their flag, so they can be sampled in a later iteration.
+// 4. In the same way, i is only a reverse candidate of its neighbor nbr if the
+// priority is less than the reverse rate of nbr (see CandidateSchedule).
+template <typename NbrHeap, typename CandidateHeap, typename Rand>
+void build_candidates_full(NbrHeap &current_graph, CandidateHeap &new_nbrs,
+                           CandidateHeap &old_nbrs, Rand &rand,
+                           const CandidateSchedule &schedule) {
   const std::size_t n_points = current_graph.n_points;
   const std::size_t n_nbrs = current_graph.n_nbrs;
-  std::size_t innbrs = 0;
-  std::size_t ij = 0;
+  const double sample_rate = schedule.sample_rate;
 
   for (std::size_t i = 0; i < n_points; i++) {
-    innbrs = i * n_nbrs;
     for (std::size_t j = 0; j < n_nbrs; j++) {
-      ij = innbrs + j;
-      auto &nbrs = current_graph.flags[ij] == 1 ? new_nbrs : old_nbrs;
-      if (current_graph.idx[ij] == nbrs.npos()) {
+      const bool is_new = current_graph.flag(i, j) == 1;
+      auto &nbrs = is_new ? new_nbrs : old_nbrs;
+      auto nbr = current_graph.index(i, j);
+      if (nbr == nbrs.npos()) {
         continue;
       }
       auto d = rand.unif();
-      nbrs.checked_push_pair(i, d, current_graph.idx[ij]);
+      if (is_new && d >= sample_rate) {
+        continue;
+      }
+      nbrs.checked_push(i, d, nbr);
+      if (nbr != i && d < schedule.reverse_rate(nbr, is_new)) {
+        nbrs.checked_push(nbr, d, i);
+      }
     }
   }
   flag_retained_new_candidates(current_graph, new_nbrs);
 }
 
+template <typename NbrHeap, typename CandidateHeap, typename Rand>
+void build_candidates_full(NbrHeap &current_graph, CandidateHeap &new_nbrs,
+                           CandidateHeap &old_nbrs, Rand &rand) {
+  CandidateSchedule schedule(new_nbrs.n_nbrs);
+  build_candidates_full(current_graph, new_nbrs, old_nbrs, rand, schedule);
+}
+
 inline auto is_converged(std::size_t n_updates, double tol) -> bool {
   return static_cast<double>(n_updates) <= tol;
 }
 
 // Pretty close to the NNDescentFull algorithm (#2 in the paper)
-template <template <typename> class GraphUpdater, typename Distance,
-          typename Progress, typename Rand>
-void nnd_build(GraphUpdater<Distance> &graph_updater,
-               std::size_t max_candidates, std::size_t n_iters, double delta,
-               Rand &rand, Progress &progress) {
-  using DistOut = typename Distance::Output;
-  using Idx = typename Distance::Index;
+// Iterations start from checkpoint.start_iter(), and checkpoint.iter_finished
+// is called at the end of every iteration that doesn't converge, so that a run
+// can be resumed.
+template <typename GraphUpdater, typename Progress, typename Rand,
+          typename Checkpoint>
+void nnd_build(GraphUpdater &graph_updater, CandidateSchedule &schedule,
+               std::size_t n_iters, double delta, Rand &rand,
+               Progress &progress, Checkpoint &checkpoint) {
+  using DistOut = typename GraphUpdater::DistOut;
+  using Idx = typename GraphUpdater::Idx;
   auto &nn_heap = graph_updater.current_graph;
   const std::size_t n_points = nn_heap.n_points;
   const double tol = delta * nn_heap.n_nbrs * n_points;
 
-  for (std::size_t n = 0; n < n_iters; n++) {
-    NNHeap<DistOut, Idx> new_nbrs(n_points, max_candidates);
-    decltype(new_nbrs) old_nbrs(n_points, max_candidates);
+  for (std::size_t n = checkpoint.start_iter(); n < n_iters; n++) {
+    NNHeap<DistOut, Idx> new_nbrs(n_points, schedule.n_candidates);
+    decltype(new_nbrs) old_nbrs(n_points, schedule.n_candidates);
 
-    build_candidates_full(nn_heap, new_nbrs, old_nbrs, rand);
+    schedule.start_iter(nn_heap);
+    build_candidates_full(nn_heap, new_nbrs, old_nbrs, rand, schedule);
+    schedule.candidates_built(new_nbrs, old_nbrs);
     std::size_t c = local_join(graph_updater, new_nbrs, old_nbrs, progress);
 
     TDOANN_ITERFINISHED();
+    schedule.iter_finished(c, n_points, nn_heap.n_nbrs, progress);
     progress.heap_report(nn_heap);
     TDOANN_CHECKCONVERGENCE();
+    checkpoint.iter_finished(nn_heap, n + 1);
   }
 }
 
+template <typename GraphUpdater, typename Progress, typename Rand,
+          typename Checkpoint>
+void nnd_build(GraphUpdater &graph_updater, std::size_t max_candidates,
+               std::size_t n_iters, double delta, Rand &rand,
+               Progress &progress, Checkpoint &checkpoint) {
+  CandidateSchedule schedule(max_candidates);
+  nnd_build(graph_updater, schedule, n_iters, delta, rand, progress,
+            checkpoint);
+}
+
+template <typename GraphUpdater, typename Progress, typename Rand>
+void nnd_build(GraphUpdater &graph_updater, std::size_t max_candidates,
+               std::size_t n_iters, double delta, Rand &rand,
+               Progress &progress) {
+  NullCheckpoint checkpoint;
+  nnd_build(graph_updater, max_candidates, n_iters, delta, rand, progress,
+            checkpoint);
+}
+
 // Local join update: instead of updating item i with the neighbors of the
 // candidates of i, explore pairs (p, q) of candidates and treat q as a
 // candidate for p, and vice versa.
-template <template <typename> class GraphUpdater, typename Distance,
-          typename Progress>
-auto local_join(
-    GraphUpdater<Distance> &graph_updater,
-    const NNHeap<typename Distance::Output, typename Distance::Index> &new_nbrs,
-    decltype(new_nbrs) &old_nbrs, Progress &progress) -> std::size_t {
-
-  using Idx = typename Distance::Index;
+template <typename GraphUpdater, typename Progress>
+auto local_join(GraphUpdater &graph_updater,
+                const NNHeap<typename GraphUpdater::DistOut,
+                             typename GraphUpdater::Idx> &new_nbrs,
+                decltype(new_nbrs) &old_nbrs, Progress &progress)
+    -> std::size_t {
+
+  using Idx = typename GraphUpdater::Idx;
   const auto n_points = new_nbrs.n_points;
   const auto max_candidates = new_nbrs.n_nbrs;
   progress.set_n_blocks(n_points);
   std::size_t c = 0;
+  DistanceBatch<typename GraphUpdater::DistOut, Idx> qs;
   for (Idx i = 0; i < n_points; i++) {
     for (Idx j = 0; j < max_candidates; j++) {
       auto p = new_nbrs.index(i, j);
       if (p == new_nbrs.npos()) {
         continue;
       }
-      for (Idx k = j; k < max_candidates; k++) {
-        auto q = new_nbrs.index(i, k);
-        if (q == new_nbrs.npos()) {
-          continue;
-        }
-        c += graph_updater.generate_and_apply(p, q);
-      }
-
-      for (Idx k = 0; k < max_candidates; k++) {
-        auto q = old_nbrs.index(i, k);
-        if (q == old_nbrs.npos()) {
-          continue;
-        }
-        c += graph_updater.generate_and_apply(p, q);
-      }
+      local_join_candidates(new_nbrs, old_nbrs, i, j, qs);
+      c += graph_updater.generate_and_apply(p, qs);
     }
+    progress.dist_evals(local_join_size(new_nbrs, old_nbrs, i, i + 1));
     TDOANN_BLOCKFINISHED();
   }
   return c;
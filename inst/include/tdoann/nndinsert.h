@@ -0,0 +1,261 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_NNDINSERT_H
+#define TDOANN_NNDINSERT_H
+
+#include <vector>
+
+#include "heap.h"
+#include "nndescent.h"
+
+namespace tdoann {
+
+// A set of point indices which remembers the order of insertion, so that
+// each member can be given a compact row in a candidate heap
+template <typename Idx> struct TouchedSet {
+  static constexpr auto npos() -> Idx { return static_cast<Idx>(-1); }
+
+  // slot[i] is the position of i in items or npos if not in the set
+  std::vector<Idx> slot;
+  std::vector<Idx> items;
+
+  TouchedSet(std::size_t n_points) : slot(n_points, npos()), items() {}
+
+  auto contains(Idx i) const -> bool { return slot[i] != npos(); }
+
+  void insert(Idx i) {
+    if (!contains(i)) {
+      slot[i] = static_cast<Idx>(items.size());
+      items.push_back(i);
+    }
+  }
+
+  void clear() {
+    for (auto i : items) {
+      slot[i] = npos();
+    }
+    items.clear();
+  }
+
+  auto size() const -> std::size_t { return items.size(); }
+};
+
+template <typename NbrHeap>
+auto has_new_nbrs(const NbrHeap &current_graph, std::size_t i) -> bool {
+  const std::size_t n_nbrs = current_graph.n_nbrs;
+  for (std::size_t j = 0; j < n_nbrs; j++) {
+    if (current_graph.flag(i, j) == 1 &&
+        current_graph.index(i, j) != current_graph.npos()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Flag the edges of the current graph for a refinement: an edge is new if
+// either end of it is a seed point. Returns the points with at least one new
+// edge.
+template <typename NbrHeap, typename IsSeed>
+auto flag_seeded(NbrHeap &current_graph, IsSeed is_seed)
+    -> std::vector<typename NbrHeap::Index> {
+  using Idx = typename NbrHeap::Index;
+  const std::size_t n_points = current_graph.n_points;
+  const std::size_t n_nbrs = current_graph.n_nbrs;
+
+  std::vector<Idx> active;
+  for (std::size_t i = 0; i < n_points; i++) {
+    bool is_active = false;
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      auto nbr = current_graph.index(i, j);
+      bool is_new = nbr != current_graph.npos() && (is_seed(i) || is_seed(nbr));
+      current_graph.set_flag(i, j, is_new ? 1 : 0);
+      is_active = is_active || is_new;
+    }
+    if (is_active) {
+      active.push_back(static_cast<Idx>(i));
+    }
+  }
+  return active;
+}
+
+// Build the new and old candidates of the touched points. Rows of the
+// candidate heaps are indexed by the position of the point in touched, but
+// their contents are the original indices.
+template <typename NbrHeap, typename CandidateHeap, typename Rand>
+void build_insert_candidates(
+    const NbrHeap &current_graph,
+    const TouchedSet<typename NbrHeap::Index> &touched,
+    CandidateHeap &new_nbrs, CandidateHeap &old_nbrs, Rand &rand) {
+  const std::size_t n_nbrs = current_graph.n_nbrs;
+
+  for (std::size_t s = 0; s < touched.size(); s++) {
+    auto i = touched.items[s];
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      auto nbr = current_graph.index(i, j);
+      if (nbr == current_graph.npos()) {
+        continue;
+      }
+      auto d = rand.unif();
+      if (current_graph.flag(i, j) == 1) {
+        new_nbrs.checked_push(s, d, nbr);
+        if (touched.contains(nbr)) {
+          new_nbrs.checked_push(touched.slot[nbr], d, i);
+        }
+      } else {
+        old_nbrs.checked_push(s, d, nbr);
+        if (touched.contains(nbr)) {
+          old_nbrs.checked_push(touched.slot[nbr], d, i);
+        }
+      }
+    }
+  }
+}
+
+// Nearest neighbor descent restricted to the neighborhoods of n_seeds seed
+// points, for which is_seed(i) returns true. The rest of the graph is assumed
+// to already be good. Each iteration the local join is carried out over the
+// "touched" points (those with a new neighbor plus the points they are a new
+// neighbor of), so the number of distance calculations depends on the number
+// of seed points, not the size of the whole graph.
+template <typename GraphUpdater, typename IsSeed, typename Progress,
+          typename Rand>
+void nnd_refine(GraphUpdater &graph_updater, IsSeed is_seed,
+                std::size_t n_seeds, std::size_t max_candidates,
+                std::size_t n_iters, double delta, Rand &rand,
+                Progress &progress) {
+  using DistOut = typename GraphUpdater::DistOut;
+  using Idx = typename GraphUpdater::Idx;
+  auto &nn_heap = graph_updater.current_graph;
+  const std::size_t n_points = nn_heap.n_points;
+  const std::size_t n_nbrs = nn_heap.n_nbrs;
+  if (n_seeds == 0) {
+    return;
+  }
+  // convergence is relative to the number of seeds
+  const double tol = delta * n_nbrs * n_seeds;
+
+  auto active = flag_seeded(nn_heap, is_seed);
+  TouchedSet<Idx> touched(n_points);
+  TouchedSet<Idx> changed(n_points);
+
+  for (std::size_t n = 0; n < n_iters; n++) {
+    if (active.empty()) {
+      break;
+    }
+    // a point is touched if it has a new neighbor or is a new neighbor
+    touched.clear();
+    for (auto i : active) {
+      touched.insert(i);
+      for (std::size_t j = 0; j < n_nbrs; j++) {
+        if (nn_heap.flag(i, j) == 1) {
+          touched.insert(nn_heap.index(i, j));
+        }
+      }
+    }
+
+    const std::size_t n_touched = touched.size();
+    NNHeap<DistOut, Idx> new_nbrs(n_touched, max_candidates);
+    decltype(new_nbrs) old_nbrs(n_touched, max_candidates);
+    build_insert_candidates(nn_heap, touched, new_nbrs, old_nbrs, rand);
+
+    // mark any neighbor in the current graph that was retained in the new
+    // candidates as false
+    for (std::size_t s = 0; s < n_touched; s++) {
+      auto i = touched.items[s];
+      for (std::size_t j = 0; j < n_nbrs; j++) {
+        if (new_nbrs.contains(s, nn_heap.index(i, j))) {
+          nn_heap.set_flag(i, j, 0);
+        }
+      }
+    }
+
+    // only the touched points and their candidates can be updated by the local
+    // join
+    changed.clear();
+    progress.set_n_blocks(n_touched);
+    std::size_t c = 0;
+    for (std::size_t s = 0; s < n_touched; s++) {
+      changed.insert(touched.items[s]);
+      for (std::size_t j = 0; j < max_candidates; j++) {
+        auto p = new_nbrs.index(s, j);
+        if (p == new_nbrs.npos()) {
+          continue;
+        }
+        changed.insert(p);
+        for (std::size_t k = j; k < max_candidates; k++) {
+          auto q = new_nbrs.index(s, k);
+          if (q == new_nbrs.npos()) {
+            continue;
+          }
+          c += graph_updater.generate_and_apply(p, q);
+        }
+
+        for (std::size_t k = 0; k < max_candidates; k++) {
+          auto q = old_nbrs.index(s, k);
+          if (q == old_nbrs.npos()) {
+            continue;
+          }
+          changed.insert(q);
+          c += graph_updater.generate_and_apply(p, q);
+        }
+      }
+      TDOANN_BLOCKFINISHED();
+    }
+
+    active.clear();
+    for (auto i : changed.items) {
+      if (has_new_nbrs(nn_heap, i)) {
+        active.push_back(i);
+      }
+    }
+
+    TDOANN_ITERFINISHED();
+    progress.heap_report(nn_heap);
+    TDOANN_CHECKCONVERGENCE();
+  }
+}
+
+// Incremental nearest neighbor descent. The first n_old points of the current
+// graph are assumed to already have good neighbors among themselves, the
+// remaining points are newly inserted items whose rows have been initialized
+// (e.g. by a graph search of the old points) and pushed into the rows of their
+// neighbors. Only the neighborhoods that contain a new item are refined.
+template <typename GraphUpdater, typename Progress, typename Rand>
+void nnd_insert(GraphUpdater &graph_updater, std::size_t n_old,
+                std::size_t max_candidates, std::size_t n_iters, double delta,
+                Rand &rand, Progress &progress) {
+  const std::size_t n_points = graph_updater.current_graph.n_points;
+  if (n_old >= n_points) {
+    return;
+  }
+  auto is_new = [n_old](std::size_t i) { return i >= n_old; };
+  nnd_refine(graph_updater, is_new, n_points - n_old, max_candidates, n_iters,
+             delta, rand, progress);
+}
+
+} // namespace tdoann
+#endif // TDOANN_NNDINSERT_H
@@ -27,7 +27,10 @@
 #ifndef TDOANN_NNDPARALLEL_H
 #define TDOANN_NNDPARALLEL_H
 
+#include "checkpoint.h"
+#include "distance.h"
 #include "heap.h"
+#include "nndescent.h"
 #include <mutex>
 
 namespace tdoann {
@@ -43,7 +46,9 @@ template <typename Distance> struct LockingHeapAdder {
   LockingHeapAdder(LockingHeapAdder const &) = delete;
   LockingHeapAdder &operator=(LockingHeapAdder const &) = delete;
 
-  void add(NNHeap<Out, Idx> &nbrs, Idx i, Idx idx, Out d) {
+  template <typename CandidateHeap>
+  void add(CandidateHeap &nbrs, Idx i, Idx idx,
+           typename CandidateHeap::DistanceOut d) {
     {
       std::lock_guard<std::mutex> guard(mutexes[i % n_mutexes]);
       nbrs.checked_push(i, d, idx);
@@ -53,7 +58,10 @@ template <typename Distance> struct LockingHeapAdder {
       nbrs.checked_push(idx, d, i);
     }
   }
-  void add(NNHeap<Out, Idx> &nbrs, Idx i, Idx idx, Out d_i, Out d_idx) {
+  template <typename CandidateHeap>
+  void add(CandidateHeap &nbrs, Idx i, Idx idx,
+           typename CandidateHeap::DistanceOut d_i,
+           typename CandidateHeap::DistanceOut d_idx) {
     {
       std::lock_guard<std::mutex> guard(mutexes[i % n_mutexes]);
       nbrs.checked_push(i, d_i, idx);
@@ -63,57 +71,91 @@ template <typename Distance> struct LockingHeapAdder {
       nbrs.checked_push(idx, d_idx, i);
     }
   }
+  // only add idx to the neighbors of i
+  template <typename CandidateHeap>
+  void add_one(CandidateHeap &nbrs, Idx i, Idx idx,
+               typename CandidateHeap::DistanceOut d) {
+    std::lock_guard<std::mutex> guard(mutexes[i % n_mutexes]);
+    nbrs.checked_push(i, d, idx);
+  }
 };
 
-template <typename ParallelRand, typename Distance>
-void build_candidates(
-    const NNDHeap<typename Distance::Output, typename Distance::Index>
-        &current_graph,
-    NNHeap<typename Distance::Output, typename Distance::Index> &new_nbrs,
-    NNHeap<typename Distance::Output, typename Distance::Index> &old_nbrs,
-    ParallelRand &parallel_rand, LockingHeapAdder<Distance> &heap_adder,
-    std::size_t begin, std::size_t end) {
+// The candidate priority of the pair (i, nbr) is a random number which only
+// depends on the current seed and the pair itself, not on which thread
+// generated it or in which order, so the candidates retained in each row are
+// the same for any number of threads. The same pair may be pushed twice (once
+// from each end) but always with the same priority, so only one copy is kept.
+// New neighbors are sampled with probability sample_rate and reverse
+// candidates with the reverse rate of the item they are sent to, as in
+// build_candidates_full: as the priority only depends on the pair, both ends
+// agree on whether it is sampled.
+template <typename ParallelRand, typename Distance, typename NbrHeap,
+          typename CandidateHeap>
+void build_candidates(const NbrHeap &current_graph, CandidateHeap &new_nbrs,
+                      CandidateHeap &old_nbrs, ParallelRand &parallel_rand,
+                      LockingHeapAdder<Distance> &heap_adder,
+                      const CandidateSchedule &schedule, std::size_t begin,
+                      std::size_t end) {
 
   const std::size_t n_nbrs = current_graph.n_nbrs;
-  auto rand = parallel_rand.get_rand(end);
+  const double sample_rate = schedule.sample_rate;
 
   for (auto i = begin; i < end; i++) {
-    std::size_t innbrs = i * n_nbrs;
     for (std::size_t j = 0; j < n_nbrs; j++) {
-      std::size_t ij = innbrs + j;
-      auto nbr = current_graph.idx[ij];
-      char isn = current_graph.flags[ij];
+      auto nbr = current_graph.index(i, j);
+      char isn = current_graph.flag(i, j);
       auto &nbrs = isn == 1 ? new_nbrs : old_nbrs;
       if (nbr == nbrs.npos()) {
         continue;
       }
+      auto rand = i < nbr ? parallel_rand.get_rand(i, nbr)
+                          : parallel_rand.get_rand(nbr, i);
       auto d = rand.unif();
-      heap_adder.add(nbrs, i, nbr, d);
+      if (isn == 1 && d >= sample_rate) {
+        continue;
+      }
+      if (d < schedule.reverse_rate(nbr, isn == 1)) {
+        heap_adder.add(nbrs, i, nbr, d);
+      } else {
+        heap_adder.add_one(nbrs, i, nbr, d);
+      }
     }
   }
 }
 
-template <typename Parallel, typename Distance, typename ParallelRand>
-void build_candidates(
-    const NNDHeap<typename Distance::Output, typename Distance::Index> &nn_heap,
-    NNHeap<typename Distance::Output, typename Distance::Index> &new_nbrs,
-    NNHeap<typename Distance::Output, typename Distance::Index> &old_nbrs,
-    ParallelRand &parallel_rand, LockingHeapAdder<Distance> &heap_adder,
-    std::size_t n_threads) {
+template <typename Parallel, typename Distance, typename ParallelRand,
+          typename NbrHeap, typename CandidateHeap>
+void build_candidates(const NbrHeap &nn_heap, CandidateHeap &new_nbrs,
+                      CandidateHeap &old_nbrs, ParallelRand &parallel_rand,
+                      LockingHeapAdder<Distance> &heap_adder,
+                      const CandidateSchedule &schedule,
+                      std::size_t n_threads) {
   parallel_rand.reseed();
   auto worker = [&](std::size_t begin, std::size_t end) {
-    build_candidates(nn_heap, new_nbrs, old_nbrs, parallel_rand, heap_adder,
-                     begin, end);
+    build_candidates<ParallelRand, Distance>(nn_heap, new_nbrs, old_nbrs,
+                                             parallel_rand, heap_adder,
+                                             schedule, begin, end);
   };
   const std::size_t grain_size = 1;
   Parallel::parallel_for(0, nn_heap.n_points, worker, n_threads, grain_size);
+
+  // the order of the candidates within each heap depends on the order they
+  // were pushed in: sorting puts them in a canonical order so the local join
+  // generates its updates in the same order for any number of threads
+  auto sort_worker = [&](std::size_t begin, std::size_t end) {
+    for (auto i = begin; i < end; i++) {
+      new_nbrs.deheap_sort(i);
+      old_nbrs.deheap_sort(i);
+    }
+  };
+  Parallel::parallel_for(0, nn_heap.n_points, sort_worker, n_threads,
+                         grain_size);
 }
 
-template <typename Parallel, typename Distance>
-void flag_new_candidates(
-    NNDHeap<typename Distance::Output, typename Distance::Index> &nn_heap,
-    const NNHeap<typename Distance::Output, typename Distance::Index> &new_nbrs,
-    std::size_t n_threads) {
+template <typename Parallel, typename Distance, typename NbrHeap,
+          typename CandidateHeap>
+void flag_new_candidates(NbrHeap &nn_heap, const CandidateHeap &new_nbrs,
+                         std::size_t n_threads) {
   auto worker = [&](std::size_t begin, std::size_t end) {
     flag_retained_new_candidates(nn_heap, new_nbrs, begin, end);
   };
@@ -121,52 +163,37 @@ void flag_new_candidates(
   Parallel::parallel_for(0, nn_heap.n_points, worker, n_threads, grain_size);
 }
 
-template <typename Distance, typename GraphUpdater>
-void local_join(
-    GraphUpdater &graph_updater,
-    const NNHeap<typename Distance::Output, typename Distance::Index> &new_nbrs,
-    const NNHeap<typename Distance::Output, typename Distance::Index> &old_nbrs,
-    std::size_t max_candidates, std::size_t begin, std::size_t end) {
+template <typename Distance, typename GraphUpdater, typename CandidateHeap>
+void local_join(GraphUpdater &graph_updater, const CandidateHeap &new_nbrs,
+                const CandidateHeap &old_nbrs, std::size_t max_candidates,
+                std::size_t begin, std::size_t end) {
+  // each worker owns its batch of candidates
+  DistanceBatch<typename Distance::Output, typename Distance::Index> qs;
   for (auto i = begin; i < end; i++) {
-    std::size_t imaxc = i * max_candidates;
     for (std::size_t j = 0; j < max_candidates; j++) {
-      std::size_t p = new_nbrs.idx[imaxc + j];
+      auto p = new_nbrs.index(i, j);
       if (p == new_nbrs.npos()) {
         continue;
       }
-      for (std::size_t k = j; k < max_candidates; k++) {
-        std::size_t q = new_nbrs.idx[imaxc + k];
-        if (q == new_nbrs.npos()) {
-          continue;
-        }
-        graph_updater.generate(p, q, i);
-      }
-
-      for (std::size_t k = 0; k < max_candidates; k++) {
-        std::size_t q = old_nbrs.idx[imaxc + k];
-        if (q == old_nbrs.npos()) {
-          continue;
-        }
-        graph_updater.generate(p, q, i);
-      }
+      local_join_candidates(new_nbrs, old_nbrs, i, j, qs);
+      graph_updater.generate(p, qs, i);
     }
   }
 }
 
 template <typename Parallel, typename Distance, typename GraphUpdater,
-          typename Progress>
-auto local_join(
-    GraphUpdater &graph_updater,
-    const NNHeap<typename Distance::Output, typename Distance::Index> &new_nbrs,
-    const NNHeap<typename Distance::Output, typename Distance::Index> &old_nbrs,
-    Progress &progress, std::size_t n_threads) -> std::size_t {
+          typename CandidateHeap, typename Progress>
+auto local_join(GraphUpdater &graph_updater, const CandidateHeap &new_nbrs,
+                const CandidateHeap &old_nbrs, Progress &progress,
+                std::size_t n_threads) -> std::size_t {
   std::size_t c = 0;
   auto local_join_worker = [&](std::size_t begin, std::size_t end) {
     local_join<Distance, decltype(graph_updater)>(
         graph_updater, new_nbrs, old_nbrs, new_nbrs.n_nbrs, begin, end);
   };
-  auto after_local_join = [&](std::size_t, std::size_t) {
+  auto after_local_join = [&](std::size_t begin, std::size_t end) {
     c += graph_updater.apply();
+    progress.dist_evals(local_join_size(new_nbrs, old_nbrs, begin, end));
   };
   const std::size_t block_size = 16384;
   const std::size_t grain_size = 1;
@@ -177,14 +204,13 @@ auto local_join(
 }
 
 template <typename Parallel, typename ParallelRand,
-          template <typename> class GraphUpdater, typename Distance,
-          typename Progress>
-void nnd_build(GraphUpdater<Distance> &graph_updater,
-               std::size_t max_candidates, std::size_t n_iters, double delta,
+          template <typename, typename> class GraphUpdater, typename Distance,
+          typename NbrHeap, typename Progress, typename Checkpoint>
+void nnd_build(GraphUpdater<Distance, NbrHeap> &graph_updater,
+               CandidateSchedule &schedule, std::size_t n_iters, double delta,
                Progress &progress, ParallelRand &parallel_rand,
-               std::size_t n_threads = 0) {
+               std::size_t n_threads, Checkpoint &checkpoint) {
 
-  using DistOut = typename Distance::Output;
   using Idx = typename Distance::Index;
   auto &nn_heap = graph_updater.current_graph;
   const std::size_t n_points = nn_heap.n_points;
@@ -192,12 +218,17 @@ void nnd_build(GraphUpdater<Distance> &graph_updater,
 
   LockingHeapAdder<Distance> heap_adder;
 
-  for (std::size_t n = 0; n < n_iters; n++) {
-    NNHeap<DistOut, Idx> new_nbrs(n_points, max_candidates);
-    decltype(new_nbrs) old_nbrs(n_points, max_candidates);
+  for (std::size_t n = checkpoint.start_iter(); n < n_iters; n++) {
+    // candidate priorities are stored at full precision to make ties (whose
+    // resolution would depend on the order of insertion) vanishingly rare
+    NNHeap<double, Idx> new_nbrs(n_points, schedule.n_candidates);
+    decltype(new_nbrs) old_nbrs(n_points, schedule.n_candidates);
 
+    schedule.start_iter(nn_heap);
     build_candidates<Parallel, Distance>(nn_heap, new_nbrs, old_nbrs,
-                                         parallel_rand, heap_adder, n_threads);
+                                         parallel_rand, heap_adder, schedule,
+                                         n_threads);
+    schedule.candidates_built(new_nbrs, old_nbrs);
 
     // mark any neighbor in the current graph that was retained in the new
     // candidates as true
@@ -207,10 +238,36 @@ void nnd_build(GraphUpdater<Distance> &graph_updater,
         graph_updater, new_nbrs, old_nbrs, progress, n_threads);
 
     TDOANN_ITERFINISHED();
+    schedule.iter_finished(c, n_points, nn_heap.n_nbrs, progress);
     progress.heap_report(nn_heap);
     TDOANN_CHECKCONVERGENCE();
+    checkpoint.iter_finished(nn_heap, n + 1);
   }
 }
 
+template <typename Parallel, typename ParallelRand,
+          template <typename, typename> class GraphUpdater, typename Distance,
+          typename NbrHeap, typename Progress, typename Checkpoint>
+void nnd_build(GraphUpdater<Distance, NbrHeap> &graph_updater,
+               std::size_t max_candidates, std::size_t n_iters, double delta,
+               Progress &progress, ParallelRand &parallel_rand,
+               std::size_t n_threads, Checkpoint &checkpoint) {
+  CandidateSchedule schedule(max_candidates);
+  nnd_build<Parallel>(graph_updater, schedule, n_iters, delta, progress,
+                      parallel_rand, n_threads, checkpoint);
+}
+
+template <typename Parallel, typename ParallelRand,
+          template <typename, typename> class GraphUpdater, typename Distance,
+          typename NbrHeap, typename Progress>
+void nnd_build(GraphUpdater<Distance, NbrHeap> &graph_updater,
+               std::size_t max_candidates, std::size_t n_iters, double delta,
+               Progress &progress, ParallelRand &parallel_rand,
+               std::size_t n_threads = 0) {
+  NullCheckpoint checkpoint;
+  nnd_build<Parallel>(graph_updater, max_candidates, n_iters, delta, progress,
+                      parallel_rand, n_threads, checkpoint);
+}
+
 } // namespace tdoann
 #endif // TDOANN_NNDPARALLEL_H
@@ -32,6 +32,7 @@
 
 #include "heap.h"
 #include "parallel.h"
+#include "tombstones.h"
 
 namespace tdoann {
 
@@ -41,12 +42,15 @@ struct SparseNNGraph {
   std::vector<Idx> col_idx;
   std::vector<DistOut> dist;
   std::size_t n_points;
+  // deleted points stay in the graph to navigate a search, but are never
+  // returned as neighbors
+  Tombstones tombstones;
 
   SparseNNGraph(const std::vector<std::size_t> &row_ptr,
                 const std::vector<Idx> &col_idx,
                 const std::vector<DistOut> &dist)
       : row_ptr(row_ptr), col_idx(col_idx), dist(dist),
-        n_points(row_ptr.size() - 1) {}
+        n_points(row_ptr.size() - 1), tombstones(n_points) {}
 
   using DistanceOut = DistOut;
   using Index = Idx;
@@ -84,19 +88,22 @@ template <typename DistOut = float, typename Idx = uint32_t> struct NNGraph {
 
   std::size_t n_points;
   std::size_t n_nbrs;
+  // deleted points: their neighbors are kept, but they should not be the
+  // neighbor of any other point
+  Tombstones tombstones;
 
   static constexpr auto npos() -> Idx { return static_cast<Idx>(-1); }
 
   NNGraph(const std::vector<Idx> &idx, const std::vector<DistOut> &dist,
           std::size_t n_points)
       : idx(idx), dist(dist), n_points(n_points),
-        n_nbrs(idx.size() / n_points) {}
+        n_nbrs(idx.size() / n_points), tombstones(n_points) {}
 
   NNGraph(std::size_t n_points, std::size_t n_nbrs)
       : idx(std::vector<Idx>(n_points * n_nbrs, npos())),
         dist(std::vector<DistOut>(n_points * n_nbrs,
                                   (std::numeric_limits<DistOut>::max)())),
-        n_points(n_points), n_nbrs(n_nbrs) {}
+        n_points(n_points), n_nbrs(n_nbrs), tombstones(n_points) {}
 
   using DistanceOut = DistOut;
   using Index = Idx;
@@ -106,8 +113,17 @@ template <typename NbrHeap>
 void heap_to_graph(
     const NbrHeap &heap,
     NNGraph<typename NbrHeap::DistanceOut, typename NbrHeap::Index> &nn_graph) {
-  nn_graph.idx = heap.idx;
-  nn_graph.dist = heap.dist;
+  const std::size_t n_points = heap.n_points;
+  const std::size_t n_nbrs = heap.n_nbrs;
+  nn_graph.idx.resize(n_points * n_nbrs);
+  nn_graph.dist.resize(n_points * n_nbrs);
+  for (std::size_t i = 0; i < n_points; i++) {
+    const std::size_t innbrs = i * n_nbrs;
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      nn_graph.idx[innbrs + j] = heap.index(i, j);
+      nn_graph.dist[innbrs + j] = heap.distance(i, j);
+    }
+  }
 }
 
 template <typename NbrHeap>
@@ -249,14 +265,9 @@ void idx_to_graph(const Distance &distance,
                   const std::vector<typename Distance::Index> &idx,
                   std::vector<typename Distance::Output> &dist,
                   std::size_t n_nbrs, std::size_t begin, std::size_t end) {
-  std::size_t innbrs = 0;
-  std::size_t ij = 0;
   for (std::size_t i = begin; i < end; i++) {
-    innbrs = i * n_nbrs;
-    for (std::size_t j = 0; j < n_nbrs; j++) {
-      ij = innbrs + j;
-      dist[ij] = distance(idx[ij], i);
-    }
+    const std::size_t innbrs = i * n_nbrs;
+    distance.batch(i, &idx[innbrs], n_nbrs, &dist[innbrs]);
   }
 }
 
@@ -66,7 +66,7 @@ void batch_parallel_for(Worker &worker, AfterWorker &after_worker,
     auto begin = i * block_size;
     auto end = std::min(n, begin + block_size);
     Parallel::parallel_for(begin, end, worker, n_threads, grain_size);
-    TDOANN_BREAKIFINTERRUPTED();
+    // the work of the block is already done, so keep it even if stopping
     after_worker(begin, end);
     TDOANN_BLOCKFINISHED();
   }
@@ -0,0 +1,117 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+// Philox4x32-10 counter-based PRNG from Salmon, Moraes, Dror and Shaw 2011.
+// The output is a pure function of a 128-bit counter and a 64-bit key, so a
+// stream of random numbers can be tied to a (seed, point) pair rather than to
+// the thread or range of work it happens to be generated in.
+
+#ifndef TDOANN_PHILOX_H
+#define TDOANN_PHILOX_H
+
+#include <array>
+#include <cstdint>
+
+namespace tdoann {
+
+inline void philox4x32_round(std::array<uint32_t, 4> &ctr,
+                             const std::array<uint32_t, 2> &key) {
+  const uint64_t prod0 = uint64_t{0xD2511F53} * ctr[0];
+  const uint64_t prod1 = uint64_t{0xCD9E8D57} * ctr[2];
+  const auto hi0 = static_cast<uint32_t>(prod0 >> 32);
+  const auto lo0 = static_cast<uint32_t>(prod0);
+  const auto hi1 = static_cast<uint32_t>(prod1 >> 32);
+  const auto lo1 = static_cast<uint32_t>(prod1);
+  ctr = {{hi1 ^ ctr[1] ^ key[0], lo1, hi0 ^ ctr[3] ^ key[1], lo0}};
+}
+
+inline auto philox4x32_10(std::array<uint32_t, 4> ctr,
+                          std::array<uint32_t, 2> key)
+    -> std::array<uint32_t, 4> {
+  for (int round = 0; round < 10; round++) {
+    if (round > 0) {
+      key[0] += 0x9E3779B9;
+      key[1] += 0xBB67AE85;
+    }
+    philox4x32_round(ctr, key);
+  }
+  return ctr;
+}
+
+// A stream of random numbers identified by seed, key1 and key2. The seed is the
+// Philox key, key1 the upper half of the counter. The lower half of the counter
+// starts at key2 and is incremented each time the output block is used up.
+class philox_prng {
+  std::array<uint32_t, 2> key;
+  uint64_t ctr_hi;
+  uint64_t ctr_lo;
+  std::array<uint32_t, 4> block;
+  std::size_t next;
+
+  void generate() {
+    block = philox4x32_10({{static_cast<uint32_t>(ctr_lo),
+                            static_cast<uint32_t>(ctr_lo >> 32),
+                            static_cast<uint32_t>(ctr_hi),
+                            static_cast<uint32_t>(ctr_hi >> 32)}},
+                          key);
+    ++ctr_lo;
+    next = 0;
+  }
+
+public:
+  philox_prng(uint64_t seed, uint64_t key1, uint64_t key2 = 0)
+      : key{{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)}},
+        ctr_hi(key1), ctr_lo(key2), block(), next(4) {}
+
+  auto operator()() -> uint32_t {
+    if (next == block.size()) {
+      generate();
+    }
+    return block[next++];
+  }
+
+  // a random uniform value in [0, 1) with 53 bits of precision
+  auto rand() -> double {
+    const uint32_t a = operator()() >> 5;
+    const uint32_t b = operator()() >> 6;
+    return (a * 67108864.0 + b) * (1.0 / 9007199254740992.0);
+  }
+};
+
+// A uniform random number generator with a unif() method, like those used
+// elsewhere in tdoann, but whose output depends only on the seed and keys
+struct PhiloxRand {
+  philox_prng prng;
+
+  PhiloxRand(uint64_t seed, uint64_t key1, uint64_t key2 = 0)
+      : prng(seed, key1, key2) {}
+
+  // a random uniform value between 0 and 1
+  auto unif() -> double { return prng.rand(); }
+};
+
+} // namespace tdoann
+#endif // TDOANN_PHILOX_H
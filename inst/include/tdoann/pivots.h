@@ -0,0 +1,227 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_PIVOTS_H
+#define TDOANN_PIVOTS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+namespace tdoann {
+
+// Lower bounds on the distances between reference and query items from their
+// Euclidean distances to a few pivots: by the triangle inequality,
+// |d(x, p) - d(y, p)| <= d(x, y) for each pivot p. The first pivot is the
+// origin if with_origin is true, so its distance is the norm of an item, and
+// the others are reference items, chosen to be far from each other and from
+// the origin.
+// The reference items are sorted by their distance to the first pivot, so the
+// items closest to a query on that pivot can be scanned first, and once the
+// bound from the first pivot is larger than the distance to the furthest
+// neighbor of a query, the rest of the items in that direction can be skipped.
+// ref_keys[p * nx + s] is the distance to pivot p of the item at position s of
+// the sorted order, and query_keys[j * n_pivots + p] the distance from query j
+template <typename Idx = uint32_t> struct PivotBounds {
+  std::size_t n_pivots;
+  std::vector<Idx> order;
+  std::vector<double> ref_keys;
+  std::vector<double> query_keys;
+
+  template <typename In>
+  PivotBounds(const std::vector<In> &x, const std::vector<In> &y,
+              std::size_t ndim, std::size_t n_pivots, bool with_origin)
+      : n_pivots(n_pivots), order(x.size() / ndim),
+        ref_keys(n_pivots * (x.size() / ndim)),
+        query_keys(n_pivots * (y.size() / ndim)) {
+    const std::size_t nx = x.size() / ndim;
+    const std::size_t ny = y.size() / ndim;
+
+    // distances of the reference items to each pivot, by original index
+    std::vector<double> keys(n_pivots * nx);
+    std::vector<double> min_dist(nx, std::numeric_limits<double>::max());
+    std::vector<std::vector<double>> pivots;
+    std::size_t next = 0;
+    if (with_origin) {
+      pivots.emplace_back(ndim, 0.0);
+    } else {
+      // start from the item furthest from the first item
+      std::vector<double> first(x.begin(), x.begin() + ndim);
+      for (std::size_t i = 0; i < nx; i++) {
+        if (pivot_dist(x, i, first, ndim) > pivot_dist(x, next, first, ndim)) {
+          next = i;
+        }
+      }
+      pivots.emplace_back(x.begin() + ndim * next,
+                          x.begin() + ndim * (next + 1));
+    }
+    for (std::size_t p = 0; p < n_pivots; p++) {
+      if (p > 0) {
+        pivots.emplace_back(x.begin() + ndim * next,
+                            x.begin() + ndim * (next + 1));
+      }
+      // the next pivot is the item furthest from all the pivots so far
+      std::size_t furthest = 0;
+      for (std::size_t i = 0; i < nx; i++) {
+        const double dist = pivot_dist(x, i, pivots[p], ndim);
+        keys[p * nx + i] = dist;
+        min_dist[i] = std::min(min_dist[i], dist);
+        if (min_dist[i] > min_dist[furthest]) {
+          furthest = i;
+        }
+      }
+      next = furthest;
+    }
+
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&](Idx a, Idx b) { return keys[a] < keys[b]; });
+    for (std::size_t p = 0; p < n_pivots; p++) {
+      for (std::size_t s = 0; s < nx; s++) {
+        ref_keys[p * nx + s] = keys[p * nx + order[s]];
+      }
+    }
+    for (std::size_t j = 0; j < ny; j++) {
+      for (std::size_t p = 0; p < n_pivots; p++) {
+        query_keys[j * n_pivots + p] = pivot_dist(y, j, pivots[p], ndim);
+      }
+    }
+  }
+
+  template <typename In>
+  static auto pivot_dist(const std::vector<In> &data, std::size_t i,
+                         const std::vector<double> &pivot, std::size_t ndim)
+      -> double {
+    double sum = 0.0;
+    for (std::size_t d = 0; d < ndim; d++) {
+      const double diff = static_cast<double>(data[ndim * i + d]) - pivot[d];
+      sum += diff * diff;
+    }
+    return std::sqrt(sum);
+  }
+
+  // The largest lower bound on the Euclidean distance between the item at
+  // position s of the sorted order and a query with pivot distances qkeys
+  auto max_gap(std::size_t s, const double *qkeys) const -> double {
+    const std::size_t nx = order.size();
+    double gap = 0.0;
+    for (std::size_t p = 0; p < n_pivots; p++) {
+      gap = std::max(gap, std::abs(ref_keys[p * nx + s] - qkeys[p]));
+    }
+    return gap;
+  }
+};
+
+// The keys are calculated in double precision, but the distances they bound
+// are not, so the bounds are reduced slightly so rounding can't prune a
+// neighbor
+constexpr double pivot_bound_slack = 1.0 - 1e-5;
+
+// A lower bound on a distance reduced by pivot_bound_slack. Also used by the
+// exact search trees, whose bounds are calculated from distances and
+// coordinates in the output precision
+template <typename T> auto slack_bound(T bound) -> double {
+  return static_cast<double>(bound) * pivot_bound_slack;
+}
+
+// Convert a lower bound on the Euclidean distance into a lower bound on a
+// distance: Manhattan distances are never smaller than Euclidean distances,
+// so EuclideanBound also serves them
+template <typename Out> struct EuclideanBound {
+  auto operator()(double gap) const -> Out {
+    return static_cast<Out>(slack_bound(gap));
+  }
+};
+
+template <typename Out> struct L2SqrBound {
+  auto operator()(double gap) const -> Out {
+    const double bound = slack_bound(gap);
+    return static_cast<Out>(bound * bound);
+  }
+};
+
+// the cosine distance between normalized items is half their squared
+// Euclidean distance
+template <typename Out> struct CosineBound {
+  auto operator()(double gap) const -> Out {
+    const double bound = slack_bound(gap);
+    return static_cast<Out>(0.5 * bound * bound);
+  }
+};
+
+// For each query, scan outwards from its position in the sorted order of the
+// reference items, taking the nearer item on the first pivot from either side.
+// Items whose bound from any pivot exceeds the distance to the furthest
+// neighbor of the query are skipped, and the scan stops when the bound from the
+// first pivot does
+template <typename Bound, typename Distance, typename NbrHeap>
+void nnbf_query(NbrHeap &neighbor_heap, Distance &distance,
+                const PivotBounds<typename Distance::Index> &bounds,
+                std::size_t begin, std::size_t end) {
+  const Bound bound;
+  const std::size_t nx = bounds.order.size();
+  const double inf = std::numeric_limits<double>::infinity();
+  for (std::size_t query = begin; query < end; query++) {
+    const double *qkeys = &bounds.query_keys[query * bounds.n_pivots];
+    std::size_t hi =
+        std::lower_bound(bounds.ref_keys.begin(), bounds.ref_keys.begin() + nx,
+                         qkeys[0]) -
+        bounds.ref_keys.begin();
+    std::size_t lo = hi;
+    while (lo > 0 || hi < nx) {
+      const double lo_gap = lo > 0 ? qkeys[0] - bounds.ref_keys[lo - 1] : inf;
+      const double hi_gap = hi < nx ? bounds.ref_keys[hi] - qkeys[0] : inf;
+      std::size_t s = 0;
+      if (lo_gap <= hi_gap) {
+        s = --lo;
+      } else {
+        s = hi++;
+      }
+      // every item left on either side is at least as far on the first pivot
+      if (bound(std::min(lo_gap, hi_gap)) >
+          neighbor_heap.max_distance(query)) {
+        break;
+      }
+      if (bounds.n_pivots > 1 &&
+          bound(bounds.max_gap(s, qkeys)) > neighbor_heap.max_distance(query)) {
+        continue;
+      }
+      const auto ref = bounds.order[s];
+      typename Distance::Output d = distance(ref, query);
+      if (neighbor_heap.accepts(query, d)) {
+        neighbor_heap.unchecked_push(query, d, ref);
+      }
+    }
+  }
+}
+
+} // namespace tdoann
+
+#endif // TDOANN_PIVOTS_H
@@ -0,0 +1,349 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+
+#ifndef TDOANN_PQ_H
+#define TDOANN_PQ_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "distance.h"
+#include "parallel.h"
+#include "progressbase.h"
+
+namespace tdoann {
+
+// Product quantization: the dimensions are split into n_subspaces contiguous
+// subspaces of sub_ndim dimensions each, and the part of each item in a
+// subspace (its subvector) is replaced by the nearest of (up to) 256 centroids,
+// trained with k-means. An item is then stored as n_subspaces one-byte codes.
+struct ProductQuantizer {
+  std::size_t ndim;
+  std::size_t n_subspaces;
+  std::size_t sub_ndim;
+  std::size_t n_centroids;
+  // the sub_ndim coordinates of centroid c of subspace m start at
+  // (m * n_centroids + c) * sub_ndim
+  std::vector<float> centroids;
+
+  ProductQuantizer(std::size_t ndim, std::size_t n_subspaces,
+                   std::size_t n_centroids, std::vector<float> centroids)
+      : ndim(ndim), n_subspaces(n_subspaces), sub_ndim(ndim / n_subspaces),
+        n_centroids(n_centroids), centroids(std::move(centroids)) {}
+
+  auto centroid(std::size_t m, std::size_t c) const -> const float * {
+    return &centroids[(m * n_centroids + c) * sub_ndim];
+  }
+
+  // the nearest centroid of subspace m to the subvector x
+  auto nearest(std::size_t m, const float *x) const -> uint8_t {
+    std::size_t best = 0;
+    float best_dist = (std::numeric_limits<float>::max)();
+    for (std::size_t c = 0; c < n_centroids; c++) {
+      const float dist =
+          dense_sum<float>(centroid(m, c), x, sub_ndim, SquaredDiff<float>());
+      if (dist < best_dist) {
+        best_dist = dist;
+        best = c;
+      }
+    }
+    return static_cast<uint8_t>(best);
+  }
+
+  // The n_subspaces codes of each item in data
+  template <typename Parallel = NoParallel>
+  auto encode(const std::vector<float> &data, std::size_t n_threads = 0) const
+      -> std::vector<uint8_t> {
+    const std::size_t n_points = data.size() / ndim;
+    std::vector<uint8_t> codes(n_points * n_subspaces);
+    auto encode_worker = [&](std::size_t begin, std::size_t end) {
+      for (std::size_t i = begin; i < end; i++) {
+        for (std::size_t m = 0; m < n_subspaces; m++) {
+          codes[i * n_subspaces + m] =
+              nearest(m, &data[i * ndim + m * sub_ndim]);
+        }
+      }
+    };
+    NullProgress progress;
+    const std::size_t grain_size = 1;
+    batch_parallel_for<Parallel>(encode_worker, progress, n_points, n_threads,
+                                 grain_size);
+    return codes;
+  }
+};
+
+// Train a product quantizer on the items in data with n_iters iterations of
+// k-means (Lloyd's algorithm) in each subspace. The first n_centroids items of
+// data are the initial centroids, so data should be in random order. A
+// centroid which is assigned no items keeps its position
+template <typename Parallel = NoParallel>
+auto train_pq(const std::vector<float> &data, std::size_t ndim,
+              std::size_t n_subspaces, std::size_t n_centroids,
+              std::size_t n_iters, std::size_t n_threads = 0)
+    -> ProductQuantizer {
+  const std::size_t n_points = data.size() / ndim;
+  const std::size_t sub_ndim = ndim / n_subspaces;
+  std::vector<float> centroids(n_subspaces * n_centroids * sub_ndim);
+  for (std::size_t m = 0; m < n_subspaces; m++) {
+    for (std::size_t c = 0; c < n_centroids; c++) {
+      std::copy(data.begin() + c * ndim + m * sub_ndim,
+                data.begin() + c * ndim + (m + 1) * sub_ndim,
+                centroids.begin() + (m * n_centroids + c) * sub_ndim);
+    }
+  }
+  ProductQuantizer pq(ndim, n_subspaces, n_centroids, std::move(centroids));
+
+  std::vector<float> sums(n_centroids * sub_ndim);
+  std::vector<std::size_t> counts(n_centroids);
+  for (std::size_t iter = 0; iter < n_iters; iter++) {
+    auto codes = pq.encode<Parallel>(data, n_threads);
+    for (std::size_t m = 0; m < n_subspaces; m++) {
+      std::fill(sums.begin(), sums.end(), 0.0F);
+      std::fill(counts.begin(), counts.end(), 0);
+      for (std::size_t i = 0; i < n_points; i++) {
+        const std::size_t c = codes[i * n_subspaces + m];
+        const float *x = &data[i * ndim + m * sub_ndim];
+        for (std::size_t d = 0; d < sub_ndim; d++) {
+          sums[c * sub_ndim + d] += x[d];
+        }
+        ++counts[c];
+      }
+      for (std::size_t c = 0; c < n_centroids; c++) {
+        if (counts[c] == 0) {
+          continue;
+        }
+        float *centroid = &pq.centroids[(m * n_centroids + c) * sub_ndim];
+        for (std::size_t d = 0; d < sub_ndim; d++) {
+          centroid[d] = sums[c * sub_ndim + d] / counts[c];
+        }
+      }
+    }
+  }
+  return pq;
+}
+
+// Identifies each AdcDistance (and its copies) or RowFileDistance, to tell
+// apart the per-thread state of different functors
+inline auto next_adc_id() -> uint64_t {
+  static std::atomic<uint64_t> counter{0};
+  return ++counter;
+}
+
+template <typename Out> struct AdcTable {
+  uint64_t owner{0};
+  std::size_t query{(std::numeric_limits<std::size_t>::max)()};
+  std::vector<Out> dists;
+};
+
+// Asymmetric distances between the product quantized items in x and the
+// unquantized query items in y: for each query, the distances between its
+// subvectors and every centroid are calculated once and stored in a table, and
+// the distance to an item is then finish of the sum of its n_subspaces table
+// entries. Term and Finish are as for the dense distances, e.g. SquaredDiff and
+// Identity give the squared Euclidean distance to the quantized items
+template <typename In, typename Out, typename Idx, typename Term,
+          typename Finish>
+struct AdcDistance {
+  AdcDistance(ProductQuantizer pq, std::vector<uint8_t> codes,
+              std::vector<In> y, Term term = Term(), Finish finish = Finish())
+      : pq(std::move(pq)), codes(std::move(codes)), y(std::move(y)),
+        term(term), finish(finish), ndim(this->pq.ndim),
+        nx(this->codes.size() / this->pq.n_subspaces),
+        ny(this->y.size() / ndim), id(next_adc_id()) {}
+
+  // Each thread keeps the table of the last query it asked for, so as long as
+  // the distances to one query are calculated together (as in the graph
+  // search), its table is only built once
+  auto table(Idx j) const -> const Out * {
+    static thread_local AdcTable<Out> cache;
+    if (cache.owner != id || cache.query != j) {
+      cache.owner = id;
+      cache.query = j;
+      cache.dists.resize(pq.n_subspaces * pq.n_centroids);
+      const In *yj = &y[ndim * j];
+      for (std::size_t m = 0; m < pq.n_subspaces; m++) {
+        for (std::size_t c = 0; c < pq.n_centroids; c++) {
+          cache.dists[m * pq.n_centroids + c] = dense_sum<Out>(
+              pq.centroid(m, c), yj + m * pq.sub_ndim, pq.sub_ndim, term);
+        }
+      }
+    }
+    return cache.dists.data();
+  }
+
+  auto code_dist(const Out *dists, Idx i) const -> Out {
+    const uint8_t *xi = &codes[pq.n_subspaces * i];
+    Out sum = 0.0;
+    for (std::size_t m = 0; m < pq.n_subspaces; m++) {
+      sum += dists[m * pq.n_centroids + xi[m]];
+    }
+    return finish(sum);
+  }
+
+  auto operator()(Idx i, Idx j) const -> Out { return code_dist(table(j), i); }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    const Out *dists = table(j);
+    for (std::size_t k = 0; k < n; k++) {
+      out[k] = code_dist(dists, is[k]);
+    }
+  }
+
+  const ProductQuantizer pq;
+  const std::vector<uint8_t> codes;
+  const std::vector<In> y;
+  Term term;
+  Finish finish;
+  std::size_t ndim;
+  Idx nx;
+  Idx ny;
+  uint64_t id;
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+};
+
+// The stream a thread last used to read a row file, and which functor owns it
+struct RowFileStream {
+  uint64_t owner{0};
+  std::ifstream stream;
+};
+
+// Exact distances between the items in x, stored as rows of ndim 32-bit floats
+// in a binary file, and the query items in y, for re-ranking the neighbors
+// found with an AdcDistance without holding x in memory. Only the rows of the
+// items that are asked for are read. If normalize is true, each row is
+// normalized after it is read, for the cosine distance. Each thread keeps its
+// own stream open, so it can be used from several threads at once. If a row
+// can't be read, the distance is the maximum value and the first error is kept:
+// worker threads can't propagate it, so call rethrow_error afterwards. The
+// caller is responsible for checking that the file exists and has nx rows
+template <typename Out, typename Idx, typename Term, typename Finish>
+struct RowFileDistance {
+  RowFileDistance(std::string filename, std::vector<float> y, std::size_t ndim,
+                  std::size_t nx, bool normalize = false, Term term = Term(),
+                  Finish finish = Finish())
+      : filename(std::move(filename)), y(std::move(y)), ndim(ndim),
+        normalize(normalize), term(term), finish(finish), nx(nx),
+        ny(this->y.size() / ndim), id(next_adc_id()) {}
+
+  auto stream() const -> std::ifstream & {
+    static thread_local RowFileStream cache;
+    if (cache.owner != id) {
+      cache.owner = id;
+      cache.stream.close();
+      cache.stream.clear();
+      cache.stream.open(filename, std::ios::binary);
+      if (cache.stream.fail()) {
+        throw std::runtime_error("Can't open " + filename);
+      }
+    }
+    return cache.stream;
+  }
+
+  void read_row(std::ifstream &stream, Idx i, std::vector<float> &row) const {
+    const auto row_bytes = static_cast<std::streamoff>(ndim * sizeof(float));
+    stream.seekg(row_bytes * static_cast<std::streamoff>(i));
+    stream.read(reinterpret_cast<char *>(row.data()), row_bytes);
+    if (stream.fail()) {
+      // don't leave the failed stream for the next call on this thread
+      stream.clear();
+      throw std::runtime_error("Can't read row " + std::to_string(i + 1) +
+                               " of " + filename);
+    }
+    if (normalize) {
+      float norm = 0.0;
+      for (std::size_t d = 0; d < ndim; d++) {
+        norm += row[d] * row[d];
+      }
+      norm = std::sqrt(norm) + 1e-30;
+      for (std::size_t d = 0; d < ndim; d++) {
+        row[d] /= norm;
+      }
+    }
+  }
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    Out out;
+    batch(j, &i, 1, &out);
+    return out;
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    std::vector<float> row(ndim);
+    std::size_t k = 0;
+    try {
+      std::ifstream &rows = stream();
+      for (; k < n; k++) {
+        read_row(rows, is[k], row);
+        out[k] = finish(dense_sum<Out>(row.data(), &y[ndim * j], ndim, term));
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> guard(error_mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+      std::fill(out + k, out + n, (std::numeric_limits<Out>::max)());
+    }
+  }
+
+  void rethrow_error() const {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  const std::string filename;
+  const std::vector<float> y;
+  std::size_t ndim;
+  bool normalize;
+  Term term;
+  Finish finish;
+  Idx nx;
+  Idx ny;
+  uint64_t id;
+  mutable std::mutex error_mutex;
+  mutable std::exception_ptr error;
+
+  using Input = float;
+  using Output = Out;
+  using Index = Idx;
+};
+
+} // namespace tdoann
+#endif // TDOANN_PQ_H
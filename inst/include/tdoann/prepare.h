@@ -173,10 +173,14 @@ auto remove_long_edges(const SparseNNGraph &graph, const Distance &distance,
     -> SparseNNGraph {
   SparseNNGraph result(graph.row_ptr, graph.col_idx, graph.dist);
   parallel_rand.reseed();
+  // each point gets its own random stream so the result doesn't depend on how
+  // the points are split between threads
   auto worker = [&](std::size_t begin, std::size_t end) {
-    auto rand = parallel_rand.get_rand(end);
-    remove_long_edges_impl(graph, distance, rand, prune_probability, result,
-                           begin, end);
+    for (auto i = begin; i < end; i++) {
+      auto rand = parallel_rand.get_rand(i);
+      remove_long_edges_impl(graph, distance, rand, prune_probability, result,
+                             i, i + 1);
+    }
   };
   const std::size_t grain_size = 1;
   batch_parallel_for<Parallel>(worker, progress, graph.n_points, n_threads,
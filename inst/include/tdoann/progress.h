@@ -46,6 +46,8 @@ template <typename Progress> struct NNDProgress {
   }
   void log(const std::string &msg) { progress.log(msg); }
   template <typename NeighborHeap> void heap_report(const NeighborHeap &) {}
+  auto target_reached() -> bool { return false; }
+  void dist_evals(std::size_t) {}
 };
 
 template <typename Progress> struct HeapSumProgress {
@@ -67,15 +69,16 @@ template <typename Progress> struct HeapSumProgress {
     std::size_t n_nbrs = neighbor_heap.n_nbrs;
     typename NeighborHeap::DistanceOut hsum = 0.0;
     for (typename NeighborHeap::Index i = 0; i < n_points; i++) {
-      std::size_t innbrs = i * n_nbrs;
       for (std::size_t j = 0; j < n_nbrs; j++) {
-        hsum += neighbor_heap.dist[innbrs + j];
+        hsum += neighbor_heap.distance(i, j);
       }
     }
     std::ostringstream os;
     os << "heap sum = " << hsum;
     log(os.str());
   }
+  auto target_reached() -> bool { return false; }
+  void dist_evals(std::size_t) {}
 };
 
 template <typename Progress, typename NeighborHeap>
@@ -92,26 +95,24 @@ void pr(Progress &progress, const NeighborHeap &neighbor_heap,
   std::ostringstream os;
   os << header << std::endl;
   for (typename NeighborHeap::Index i = 0; i < n_points; i++) {
-    std::size_t innbrs = i * n_nbrs;
     os << i << ": ";
     for (std::size_t j = 0; j < n_nbrs; j++) {
-      auto idx = neighbor_heap.idx[innbrs + j];
+      auto idx = neighbor_heap.index(i, j);
       if (idx == neighbor_heap.npos()) {
         os << "-1 ";
       } else {
-        os << neighbor_heap.idx[innbrs + j] << " ";
+        os << idx << " ";
       }
     }
     os << std::endl;
   }
   for (typename NeighborHeap::Index i = 0; i < n_points; i++) {
-    std::size_t innbrs = i * n_nbrs;
     os << i << ": ";
     for (std::size_t j = 0; j < n_nbrs; j++) {
-      if (neighbor_heap.idx[innbrs + j] == neighbor_heap.npos()) {
+      if (neighbor_heap.index(i, j) == neighbor_heap.npos()) {
         os << "NA ";
       } else {
-        os << neighbor_heap.dist[innbrs + j] << " ";
+        os << neighbor_heap.distance(i, j) << " ";
       }
     }
     os << std::endl;
@@ -46,6 +46,9 @@
   if (is_converged(c, tol)) {                                                  \
     progress.converged(c, tol);                                                \
     break;                                                                     \
+  }                                                                            \
+  if (progress.target_reached()) {                                             \
+    break;                                                                     \
   }
 
 namespace tdoann {
@@ -0,0 +1,180 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+
+#ifndef TDOANN_QUANTIZE_H
+#define TDOANN_QUANTIZE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace tdoann {
+
+// Scalar quantization of data to one byte per dimension. Each dimension d is
+// shifted by its minimum value lower[d] in the data the quantizer was fitted
+// to, and then divided by a scale shared by all the dimensions, chosen so that
+// the dimension with the largest range uses all 256 codes. With a shared
+// scale, the difference between two values is the difference between their
+// codes times scale, so the Euclidean and Manhattan distances can be calculated
+// from the codes with integer arithmetic and multiplied by scale (or its
+// square) at the end.
+struct ScalarQuantizer {
+  std::vector<float> lower;
+  float scale{1.0};
+
+  ScalarQuantizer() = default;
+
+  template <typename In>
+  ScalarQuantizer(const std::vector<In> &data, std::size_t ndim)
+      : lower(ndim, (std::numeric_limits<float>::max)()) {
+    std::vector<float> upper(ndim, std::numeric_limits<float>::lowest());
+    for (std::size_t i = 0; i < data.size(); i += ndim) {
+      for (std::size_t d = 0; d < ndim; d++) {
+        lower[d] = (std::min)(lower[d], static_cast<float>(data[i + d]));
+        upper[d] = (std::max)(upper[d], static_cast<float>(data[i + d]));
+      }
+    }
+    float range = 0.0;
+    for (std::size_t d = 0; d < ndim; d++) {
+      range = (std::max)(range, upper[d] - lower[d]);
+    }
+    if (range > 0.0) {
+      scale = range / 255.0F;
+    }
+  }
+
+  // Values outside the range of the fitted data (e.g. in query data) are
+  // clamped to the nearest code
+  template <typename In>
+  auto encode(const std::vector<In> &data) const -> std::vector<uint8_t> {
+    const std::size_t ndim = lower.size();
+    std::vector<uint8_t> codes(data.size());
+    for (std::size_t i = 0; i < data.size(); i += ndim) {
+      for (std::size_t d = 0; d < ndim; d++) {
+        const float code = std::round((data[i + d] - lower[d]) / scale);
+        codes[i + d] =
+            static_cast<uint8_t>((std::min)((std::max)(code, 0.0F), 255.0F));
+      }
+    }
+    return codes;
+  }
+};
+
+// The codes of the items in x and y, quantized with a quantizer fitted to x. If
+// x and y are the same data, y is left empty rather than storing a copy
+struct QuantizedData {
+  ScalarQuantizer quantizer;
+  std::vector<uint8_t> x;
+  std::vector<uint8_t> y;
+  std::size_t ndim;
+  std::size_t nx;
+  std::size_t ny;
+
+  template <typename In>
+  QuantizedData(const std::vector<In> &data, std::size_t ndim)
+      : quantizer(data, ndim), x(quantizer.encode(data)), ndim(ndim),
+        nx(data.size() / ndim), ny(nx) {}
+
+  template <typename In>
+  QuantizedData(const std::vector<In> &x, const std::vector<In> &y,
+                std::size_t ndim)
+      : quantizer(x, ndim), x(quantizer.encode(x)), y(quantizer.encode(y)),
+        ndim(ndim), nx(x.size() / ndim), ny(y.size() / ndim) {}
+
+  auto xrow(std::size_t i) const -> const uint8_t * { return &x[ndim * i]; }
+  auto yrow(std::size_t j) const -> const uint8_t * {
+    return y.empty() ? &x[ndim * j] : &y[ndim * j];
+  }
+};
+
+// The sums over the codes are accumulated in 16 independent 32-bit lanes, so
+// the inner loop has a fixed length and no conversions or branches, which the
+// compiler can vectorize even at -O2. Every code_block_size dimensions, the
+// lanes are added to a 64-bit total, before they can overflow
+const std::size_t code_lanes = 16;
+const std::size_t code_block_size = 32768;
+
+template <typename Term>
+auto code_sum(const uint8_t *x, const uint8_t *y, std::size_t ndim, Term term)
+    -> uint64_t {
+  uint64_t sum = 0;
+  uint32_t lanes[code_lanes] = {0};
+  std::size_t d = 0;
+  for (; d + code_lanes <= ndim; d += code_lanes) {
+    for (std::size_t l = 0; l < code_lanes; l++) {
+      lanes[l] += term(x[d + l], y[d + l]);
+    }
+    if ((d + code_lanes) % code_block_size == 0) {
+      for (std::size_t l = 0; l < code_lanes; l++) {
+        sum += lanes[l];
+        lanes[l] = 0;
+      }
+    }
+  }
+  for (; d < ndim; d++) {
+    sum += term(x[d], y[d]);
+  }
+  for (std::size_t l = 0; l < code_lanes; l++) {
+    sum += lanes[l];
+  }
+  return sum;
+}
+
+struct SquaredCodeDiff {
+  auto operator()(uint8_t xd, uint8_t yd) const -> uint32_t {
+    const int32_t diff = static_cast<int32_t>(xd) - yd;
+    return diff * diff;
+  }
+};
+
+struct AbsCodeDiff {
+  auto operator()(uint8_t xd, uint8_t yd) const -> uint32_t {
+    const int32_t diff = static_cast<int32_t>(xd) - yd;
+    return diff < 0 ? -diff : diff;
+  }
+};
+
+// The sum of the squared differences of the codes x and y
+struct CodeL2Sqr {
+  auto operator()(const uint8_t *x, const uint8_t *y, std::size_t ndim) const
+      -> uint64_t {
+    return code_sum(x, y, ndim, SquaredCodeDiff());
+  }
+};
+
+// The sum of the absolute differences of the codes x and y
+struct CodeL1 {
+  auto operator()(const uint8_t *x, const uint8_t *y, std::size_t ndim) const
+      -> uint64_t {
+    return code_sum(x, y, ndim, AbsCodeDiff());
+  }
+};
+
+} // namespace tdoann
+#endif // TDOANN_QUANTIZE_H
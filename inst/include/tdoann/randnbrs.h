@@ -54,11 +54,12 @@ template <typename Distance, typename Sampler> struct RandomNbrQueryWorker {
         nrefs(distance.nx), seed(Sampler::get_seed()) {}
 
   void operator()(std::size_t begin, std::size_t end) {
-    Sampler int_sampler(seed, end);
-
-    for (int qi = static_cast<int>(begin); qi < static_cast<int>(end); qi++) {
+    for (std::size_t qi = begin; qi < end; qi++) {
+      // seed by point rather than by chunk so the result doesn't depend on
+      // the number of threads
+      Sampler int_sampler(seed, qi);
       auto idxi = int_sampler.template sample<Idx>(nrefs, n_nbrs);
-      std::size_t kqi = n_nbrs * qi;
+      const std::size_t kqi = static_cast<std::size_t>(n_nbrs) * qi;
       for (std::size_t j = 0; j < n_nbrs; j++) {
         auto &ri = idxi[j];
         nn_idx[j + kqi] = ri;
@@ -89,16 +90,17 @@ template <typename Distance, typename Sampler> struct RandomNbrBuildWorker {
         seed(Sampler::get_seed()) {}
 
   void operator()(std::size_t begin, std::size_t end) {
-    Sampler int_sampler(seed, end);
-
-    for (auto qi = static_cast<int>(begin); qi < static_cast<int>(end); qi++) {
-      std::size_t kqi = n_nbrs * qi;
-      std::size_t kqi1 = kqi + 1;
+    for (std::size_t qi = begin; qi < end; qi++) {
+      // seed by point rather than by chunk so the result doesn't depend on
+      // the number of threads
+      Sampler int_sampler(seed, qi);
+      const std::size_t kqi = static_cast<std::size_t>(n_nbrs) * qi;
+      const std::size_t kqi1 = kqi + 1;
       nn_idx[0 + kqi] = qi;
       auto ris = int_sampler.template sample<Idx>(n_points_minus_1, k_minus_1);
 
       for (auto j = 0; j < k_minus_1; j++) {
-        int ri = ris[j];
+        Idx ri = ris[j];
         if (ri >= qi) {
           ri += 1;
         }
@@ -144,12 +146,9 @@ auto get_nn(Distance &distance, typename Distance::Index n_nbrs, bool sort,
 
 template <typename Distance, typename Sampler, typename Progress,
           typename Parallel>
-auto random_build(const std::vector<typename Distance::Input> &data,
-                  std::size_t ndim, typename Distance::Index n_nbrs, bool sort,
-                  std::size_t n_threads = 0, bool verbose = false)
+auto random_build(Distance &distance, typename Distance::Index n_nbrs,
+                  bool sort, std::size_t n_threads = 0, bool verbose = false)
     -> NNGraph<typename Distance::Output, typename Distance::Index> {
-  Distance distance(data, ndim);
-
   using Worker = tdoann::RandomNbrBuildWorker<Distance, Sampler>;
   if (n_threads > 0) {
     using HeapAdd = tdoann::LockingHeapAddSymmetric;
@@ -163,6 +162,28 @@ auto random_build(const std::vector<typename Distance::Input> &data,
   }
 }
 
+template <typename Distance, typename Sampler, typename Progress,
+          typename Parallel>
+auto random_query(Distance &distance, typename Distance::Index n_nbrs,
+                  bool sort, std::size_t n_threads = 0, bool verbose = false)
+    -> NNGraph<typename Distance::Output, typename Distance::Index> {
+  using Worker = tdoann::RandomNbrQueryWorker<Distance, Sampler>;
+  using HeapAdd = tdoann::HeapAddQuery;
+  return get_nn<Distance, Progress, Parallel, Worker, HeapAdd>(
+      distance, n_nbrs, sort, n_threads, verbose);
+}
+
+template <typename Distance, typename Sampler, typename Progress,
+          typename Parallel>
+auto random_build(const std::vector<typename Distance::Input> &data,
+                  std::size_t ndim, typename Distance::Index n_nbrs, bool sort,
+                  std::size_t n_threads = 0, bool verbose = false)
+    -> NNGraph<typename Distance::Output, typename Distance::Index> {
+  Distance distance(data, ndim);
+  return random_build<Distance, Sampler, Progress, Parallel>(
+      distance, n_nbrs, sort, n_threads, verbose);
+}
+
 template <typename Distance, typename Sampler, typename Progress,
           typename Parallel>
 auto random_query(const std::vector<typename Distance::Input> &reference,
@@ -172,10 +193,7 @@ auto random_query(const std::vector<typename Distance::Input> &reference,
                   std::size_t n_threads = 0, bool verbose = false)
     -> NNGraph<typename Distance::Output, typename Distance::Index> {
   Distance distance(reference, query, ndim);
-
-  using Worker = tdoann::RandomNbrQueryWorker<Distance, Sampler>;
-  using HeapAdd = tdoann::HeapAddQuery;
-  return get_nn<Distance, Progress, Parallel, Worker, HeapAdd>(
+  return random_query<Distance, Sampler, Progress, Parallel>(
       distance, n_nbrs, sort, n_threads, verbose);
 }
 
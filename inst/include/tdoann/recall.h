@@ -0,0 +1,181 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_RECALL_H
+#define TDOANN_RECALL_H
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bruteforce.h"
+#include "heap.h"
+#include "parallel.h"
+
+namespace tdoann {
+
+// Treats a sample of the items of a self-distance as queries, so that the
+// sample can be passed to nnbf_query: the distance between ref and query is
+// that between ref and the query-th item of the sample
+template <typename Distance> struct SampleDistance {
+  using Input = typename Distance::Input;
+  using Output = typename Distance::Output;
+  using Index = typename Distance::Index;
+
+  const Distance &distance;
+  const std::vector<Index> &sample;
+  Index nx;
+  Index ny;
+
+  SampleDistance(const Distance &distance, const std::vector<Index> &sample)
+      : distance(distance), sample(sample), nx(distance.nx),
+        ny(sample.size()) {}
+
+  auto operator()(Index ref, Index query) const -> Output {
+    return distance(ref, sample[query]);
+  }
+
+  void batch(Index query, const Index *refs, std::size_t n,
+             Output *out) const {
+    distance.batch(sample[query], refs, n, out);
+  }
+};
+
+// Estimates the recall of a neighbor graph from the exact neighbors of a fixed
+// sample of its items. Each neighbor of a sampled item in the graph counts as
+// found if it is no further away than the exact kth neighbor, so ties in the
+// exact distances don't count against the graph. With an empty sample, the
+// recall is always reported as 1.
+template <typename DistOut, typename Idx> struct SampledRecall {
+  std::vector<Idx> sample;
+  // the exact distance to the kth neighbor of each item of the sample
+  std::vector<DistOut> max_dist;
+
+  SampledRecall() = default;
+
+  SampledRecall(const std::vector<Idx> &sample,
+                const std::vector<DistOut> &max_dist)
+      : sample(sample), max_dist(max_dist) {}
+
+  auto empty() const -> bool { return sample.empty(); }
+
+  template <typename NbrHeap>
+  auto recall(const NbrHeap &current_graph) const -> double {
+    if (empty()) {
+      return 1.0;
+    }
+    const std::size_t n_nbrs = current_graph.n_nbrs;
+    std::size_t n_found = 0;
+    for (std::size_t s = 0; s < sample.size(); s++) {
+      for (std::size_t j = 0; j < n_nbrs; j++) {
+        if (current_graph.index(sample[s], j) != current_graph.npos() &&
+            current_graph.distance(sample[s], j) <= max_dist[s]) {
+          ++n_found;
+        }
+      }
+    }
+    return static_cast<double>(n_found) / (sample.size() * n_nbrs);
+  }
+};
+
+// Find the exact neighbors of the items in sample by brute force
+template <typename Parallel, typename Distance>
+auto sampled_recall(const Distance &distance,
+                    const std::vector<typename Distance::Index> &sample,
+                    std::size_t n_nbrs, std::size_t n_threads = 0)
+    -> SampledRecall<typename Distance::Output, typename Distance::Index> {
+  using DistOut = typename Distance::Output;
+  using Idx = typename Distance::Index;
+
+  SampleDistance<Distance> sample_distance(distance, sample);
+  NNHeap<DistOut, Idx> exact(sample.size(), n_nbrs);
+  auto worker = [&](std::size_t begin, std::size_t end) {
+    nnbf_query(exact, sample_distance, begin, end);
+  };
+  const std::size_t grain_size = 1;
+  Parallel::parallel_for(0, sample.size(), worker, n_threads, grain_size);
+
+  std::vector<DistOut> max_dist(sample.size());
+  for (std::size_t s = 0; s < sample.size(); s++) {
+    max_dist[s] = exact.max_distance(s);
+  }
+  return SampledRecall<DistOut, Idx>(sample, max_dist);
+}
+
+// Wraps one of the NND progress types (e.g. NNDProgress), calculating the
+// sampled recall of the graph at the end of each iteration, so that the
+// optimization can stop once the recall reaches target. If log_each_iter is
+// true, the recall is also logged for every iteration.
+template <typename NNDProg, typename Recall> struct RecallProgress {
+  NNDProg progress;
+  const Recall &recall;
+  double target;
+  bool log_each_iter;
+  double last_recall;
+
+  RecallProgress(NNDProg &progress, const Recall &recall, double target,
+                 bool log_each_iter = false)
+      : progress(progress), recall(recall), target(target),
+        log_each_iter(log_each_iter), last_recall(0.0) {}
+  void set_n_blocks(std::size_t n) { progress.set_n_blocks(n); }
+  void block_finished() { progress.block_finished(); }
+  void iter_finished() { progress.iter_finished(); }
+  void stopping_early() { progress.stopping_early(); }
+  auto check_interrupt() -> bool { return progress.check_interrupt(); }
+  void converged(std::size_t n_updates, double tol) {
+    progress.converged(n_updates, tol);
+  }
+  void log(const std::string &msg) { progress.log(msg); }
+  template <typename NeighborHeap>
+  void heap_report(const NeighborHeap &neighbor_heap) {
+    progress.heap_report(neighbor_heap);
+    if (recall.empty()) {
+      return;
+    }
+    last_recall = recall.recall(neighbor_heap);
+    if (log_each_iter) {
+      std::ostringstream os;
+      os << "sampled recall = " << last_recall;
+      log(os.str());
+    }
+  }
+  // called after heap_report: if true, progress reporting is finished
+  auto target_reached() -> bool {
+    if (recall.empty() || last_recall < target) {
+      return false;
+    }
+    progress.stopping_early();
+    std::ostringstream os;
+    os << "Reached target recall: sampled recall = " << last_recall
+       << " target = " << target;
+    log(os.str());
+    return true;
+  }
+  void dist_evals(std::size_t n) { progress.dist_evals(n); }
+};
+
+} // namespace tdoann
+#endif // TDOANN_RECALL_H
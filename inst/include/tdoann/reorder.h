@@ -0,0 +1,118 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_REORDER_H
+#define TDOANN_REORDER_H
+
+#include <deque>
+#include <vector>
+
+#include "nngraph.h"
+
+namespace tdoann {
+
+// Returns an ordering of the items in graph, where order[i] is the (old) index
+// of the item which should be placed at position i. Items are ordered by a
+// breadth-first search of the graph, visiting the neighbors of each item in the
+// order they are stored (i.e. nearest first for a sorted neighbor graph), and
+// starting a new search from the first unvisited item whenever a search runs
+// out of items. Neighbors of an item therefore end up close to it (and each
+// other) in the ordering, so storing the data in this order means that the
+// distance calculations carried out when searching or refining the graph
+// access nearby rows of the data.
+template <typename DistOut, typename Idx>
+auto bfs_order(const SparseNNGraph<DistOut, Idx> &graph) -> std::vector<Idx> {
+  const std::size_t n_points = graph.n_points;
+  std::vector<Idx> order;
+  order.reserve(n_points);
+  std::vector<char> visited(n_points, 0);
+  std::deque<Idx> queue;
+
+  for (std::size_t start = 0; start < n_points; start++) {
+    if (visited[start] == 1) {
+      continue;
+    }
+    visited[start] = 1;
+    queue.push_back(static_cast<Idx>(start));
+    while (!queue.empty()) {
+      const Idx i = queue.front();
+      queue.pop_front();
+      order.push_back(i);
+      const std::size_t n_nbrs = graph.n_nbrs(i);
+      for (std::size_t j = 0; j < n_nbrs; j++) {
+        const Idx nbr = graph.index(i, j);
+        if (nbr >= n_points || visited[nbr] == 1) {
+          continue;
+        }
+        visited[nbr] = 1;
+        queue.push_back(nbr);
+      }
+    }
+  }
+  return order;
+}
+
+// The inverse of order: position[order[i]] = i
+template <typename Idx>
+auto inverse_permutation(const std::vector<Idx> &order) -> std::vector<Idx> {
+  std::vector<Idx> position(order.size());
+  for (std::size_t i = 0; i < order.size(); i++) {
+    position[order[i]] = static_cast<Idx>(i);
+  }
+  return position;
+}
+
+// Returns a copy of graph with its items placed in the given order: the
+// neighbors of order[i] become the neighbors of item i, with their indices
+// also updated
+template <typename DistOut, typename Idx>
+auto permute_graph(const SparseNNGraph<DistOut, Idx> &graph,
+                   const std::vector<Idx> &order)
+    -> SparseNNGraph<DistOut, Idx> {
+  const std::size_t n_points = graph.n_points;
+  auto position = inverse_permutation(order);
+
+  std::vector<std::size_t> row_ptr(n_points + 1, 0);
+  std::vector<Idx> col_idx;
+  col_idx.reserve(graph.col_idx.size());
+  std::vector<DistOut> dist;
+  dist.reserve(graph.dist.size());
+  for (std::size_t i = 0; i < n_points; i++) {
+    const Idx old_i = order[i];
+    const std::size_t n_nbrs = graph.n_nbrs(old_i);
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      const Idx nbr = graph.index(old_i, j);
+      col_idx.push_back(nbr < n_points ? position[nbr] : nbr);
+      dist.push_back(graph.distance(old_i, j));
+    }
+    row_ptr[i + 1] = col_idx.size();
+  }
+  return SparseNNGraph<DistOut, Idx>(row_ptr, col_idx, dist);
+}
+
+} // namespace tdoann
+
+#endif // TDOANN_REORDER_H
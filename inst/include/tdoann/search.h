@@ -27,41 +27,68 @@
 #ifndef TDOANN_SEARCH_H
 #define TDOANN_SEARCH_H
 
+#include <limits>
+#include <mutex>
+
 #include "bvset.h"
+#include "distance.h"
 #include "nbrqueue.h"
 #include "nngraph.h"
+#include "sketch.h"
+#include "tombstones.h"
 
 namespace tdoann {
 
-template <typename Progress, typename Distance>
-void nn_query(
+// max_dist_evals is the maximum number of distance calculations carried out
+// for each query. Returns the number of queries which reached that limit.
+// Candidates rejected by sketch don't have their distances calculated. The
+// tombstones of reference_graph mark the points which can't be neighbors.
+template <typename Progress, typename Distance, typename Sketch = NoSketch>
+auto nn_query(
     const SparseNNGraph<typename Distance::Output, typename Distance::Index>
         &reference_graph,
     NNHeap<typename Distance::Output, typename Distance::Index> &nn_heap,
-    const Distance &distance, double epsilon, bool verbose) {
+    const Distance &distance, double epsilon, bool verbose,
+    std::size_t max_dist_evals = (std::numeric_limits<std::size_t>::max)(),
+    const Sketch &sketch = Sketch()) -> std::size_t {
+  std::size_t n_capped = 0;
   auto query_non_search_worker = [&](std::size_t begin, std::size_t end) {
-    non_search_query(nn_heap, distance, reference_graph, epsilon, begin, end);
+    n_capped += non_search_query(nn_heap, distance, reference_graph, epsilon,
+                                 reference_graph.tombstones, sketch,
+                                 max_dist_evals, begin, end);
   };
   Progress progress(1, verbose);
   const std::size_t n_points = nn_heap.n_points;
   batch_serial_for(query_non_search_worker, progress, n_points);
+  return n_capped;
 }
 
-template <typename Parallel, typename Progress, typename Distance>
-void nn_query(
+template <typename Parallel, typename Progress, typename Distance,
+          typename Sketch = NoSketch>
+auto nn_query(
     const SparseNNGraph<typename Distance::Output, typename Distance::Index>
         &reference_graph,
     NNHeap<typename Distance::Output, typename Distance::Index> &nn_heap,
     const Distance &distance, double epsilon, std::size_t n_threads,
-    bool verbose) {
+    bool verbose,
+    std::size_t max_dist_evals = (std::numeric_limits<std::size_t>::max)(),
+    const Sketch &sketch = Sketch()) -> std::size_t {
+  std::size_t n_capped = 0;
+  std::mutex n_capped_mutex;
   auto query_non_search_worker = [&](std::size_t begin, std::size_t end) {
-    non_search_query(nn_heap, distance, reference_graph, epsilon, begin, end);
+    const std::size_t block_capped =
+        non_search_query(nn_heap, distance, reference_graph, epsilon,
+                         reference_graph.tombstones, sketch, max_dist_evals,
+                         begin, end);
+    std::lock_guard<std::mutex> guard(n_capped_mutex);
+    n_capped += block_capped;
   };
   Progress progress(1, verbose);
   const std::size_t n_points = nn_heap.n_points;
   const std::size_t grain_size = 1;
   batch_parallel_for<Parallel>(query_non_search_worker, progress, n_points,
                                n_threads, grain_size);
+  return n_capped;
 }
 
 template <typename T, typename Container, typename Compare>
@@ -71,13 +98,21 @@ auto pop(std::priority_queue<T, Container, Compare> &pq) -> T {
   return result;
 }
 
-template <typename Distance>
-void non_search_query(
+// Deleted points in the search graph are used to navigate but are never added
+// to the neighbors of a query. The search for a query stops after
+// max_dist_evals distance calculations, keeping the neighbors found so far.
+// Returns the number of queries whose search was stopped that way. A candidate
+// which the sketch shows can't be within the distance bound is skipped without
+// calculating its distance (or counting towards max_dist_evals).
+template <typename Distance, typename Deleted, typename Sketch>
+auto non_search_query(
     NNHeap<typename Distance::Output, typename Distance::Index> &current_graph,
     const Distance &distance,
     const SparseNNGraph<typename Distance::Output, typename Distance::Index>
         &search_graph,
-    double epsilon, std::size_t begin, std::size_t end) {
+    double epsilon, const Deleted &deleted, const Sketch &sketch,
+    std::size_t max_dist_evals, std::size_t begin, std::size_t end)
+    -> std::size_t {
 
   using DistOut = typename Distance::Output;
   using Idx = typename Distance::Index;
@@ -85,6 +120,10 @@ void non_search_query(
   const std::size_t n_nbrs = current_graph.n_nbrs;
 
   const double distance_scale = 1.0 + epsilon;
+  std::size_t n_capped = 0;
+  std::size_t n_tested = 0;
+  std::size_t n_rejected = 0;
+  DistanceBatch<DistOut, Idx> candidates;
 
   for (std::size_t query_idx = begin; query_idx < end; query_idx++) {
     auto visited = create_set(search_graph.n_points);
@@ -97,18 +136,27 @@ void non_search_query(
       seed_set.emplace(current_graph.distance(query_idx, j), candidate_idx);
       mark_visited(visited, candidate_idx);
     }
+    if (!deleted.empty() &&
+        has_deleted_nbrs(current_graph, query_idx, deleted)) {
+      remove_deleted_nbrs(current_graph, query_idx, deleted);
+    }
 
     double distance_bound =
         distance_scale *
         static_cast<double>(current_graph.max_distance(query_idx));
 
-    while (!seed_set.empty()) {
+    std::size_t n_dist_evals = 0;
+    bool capped = false;
+    while (!capped && !seed_set.empty()) {
       auto vertex = seed_set.pop();
       DistOut d_vertex = vertex.first;
       if (static_cast<double>(d_vertex) >= distance_bound) {
         break;
       }
       Idx vertex_idx = vertex.second;
+      // the distances to all the unvisited neighbors of the vertex are
+      // calculated together, up to the limit on the distance calculations
+      candidates.clear();
       const std::size_t max_candidates = search_graph.n_nbrs(vertex_idx);
       for (std::size_t k = 0; k < max_candidates; k++) {
         Idx candidate_idx = search_graph.index(vertex_idx, k);
@@ -116,18 +164,77 @@ void non_search_query(
             has_been_and_mark_visited(visited, candidate_idx)) {
           continue;
         }
-        DistOut d = distance(candidate_idx, query_idx);
+        ++n_tested;
+        if (sketch.rejects(candidate_idx, static_cast<Idx>(query_idx),
+                           distance_bound)) {
+          ++n_rejected;
+          continue;
+        }
+        if (n_dist_evals + candidates.size() == max_dist_evals) {
+          capped = true;
+          break;
+        }
+        candidates.add(candidate_idx);
+      }
+      n_dist_evals += candidates.size();
+      candidates.calculate(distance, query_idx);
+
+      for (std::size_t k = 0; k < candidates.size(); k++) {
+        Idx candidate_idx = candidates.idx[k];
+        DistOut d = candidates.dist[k];
         if (static_cast<double>(d) >= distance_bound) {
           continue;
         }
-        current_graph.checked_push(query_idx, d, candidate_idx);
+        if (!deleted.is_deleted(candidate_idx)) {
+          current_graph.checked_push(query_idx, d, candidate_idx);
+        }
         seed_set.emplace(d, candidate_idx);
         distance_bound =
             distance_scale *
             static_cast<double>(current_graph.max_distance(query_idx));
       }
     } // next candidate
+    if (capped) {
+      ++n_capped;
+    }
   }
+  sketch.count(n_tested, n_rejected);
+  return n_capped;
+}
+
+template <typename Distance, typename Deleted>
+auto non_search_query(
+    NNHeap<typename Distance::Output, typename Distance::Index> &current_graph,
+    const Distance &distance,
+    const SparseNNGraph<typename Distance::Output, typename Distance::Index>
+        &search_graph,
+    double epsilon, const Deleted &deleted, std::size_t max_dist_evals,
+    std::size_t begin, std::size_t end) -> std::size_t {
+  return non_search_query(current_graph, distance, search_graph, epsilon,
+                          deleted, NoSketch(), max_dist_evals, begin, end);
+}
+
+template <typename Distance, typename Deleted>
+void non_search_query(
+    NNHeap<typename Distance::Output, typename Distance::Index> &current_graph,
+    const Distance &distance,
+    const SparseNNGraph<typename Distance::Output, typename Distance::Index>
+        &search_graph,
+    double epsilon, const Deleted &deleted, std::size_t begin,
+    std::size_t end) {
+  non_search_query(current_graph, distance, search_graph, epsilon, deleted,
+                   (std::numeric_limits<std::size_t>::max)(), begin, end);
+}
+
+template <typename Distance>
+void non_search_query(
+    NNHeap<typename Distance::Output, typename Distance::Index> &current_graph,
+    const Distance &distance,
+    const SparseNNGraph<typename Distance::Output, typename Distance::Index>
+        &search_graph,
+    double epsilon, std::size_t begin, std::size_t end) {
+  non_search_query(current_graph, distance, search_graph, epsilon,
+                   NoTombstones(), begin, end);
 }
 
 } // namespace tdoann
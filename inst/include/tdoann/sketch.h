@@ -0,0 +1,253 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_SKETCH_H
+#define TDOANN_SKETCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+#include "bitvec.h"
+#include "distance.h"
+#include "nngraph.h"
+#include "parallel.h"
+#include "progressbase.h"
+
+namespace tdoann {
+
+// number of hyperplanes whose projections are calculated together
+constexpr std::size_t sketch_lanes = 16;
+
+// Random hyperplane ("sign") sketches of the reference and query items, used to
+// skip distance calculations during a graph search. Bit b of the sketch of an
+// item is set if the item lies on the positive side of the b-th random
+// hyperplane through the center of the reference data (the origin for angular
+// distances). The number of bits that differ between two sketches estimates the
+// angle between the items, and with the distance of each item from the center
+// that gives a lower bound on their distance: a candidate whose bound is not
+// smaller than the search bound of the query can't become one of its neighbors.
+//
+// The estimated angle is reduced by a number of bits found from the edges of
+// the search graph, so that the bound holds for all but max_miss of them.
+struct SignSketch {
+  std::size_t n_bits;
+  std::size_t vec_len;
+  // for angular distances (1 - cosine similarity) the norms are not needed
+  bool angular;
+  // whether the bound is compared to squared Euclidean distances
+  bool squared;
+  double max_miss;
+
+  BitVec bx;
+  BitVec by;
+  std::vector<double> x_norms;
+  std::vector<double> y_norms;
+  // the largest cosine of the angle between two items for each number of
+  // differing bits
+  std::vector<double> max_cos;
+
+  // the number of candidates tested, and how many were rejected
+  mutable std::atomic<std::size_t> n_tested{0};
+  mutable std::atomic<std::size_t> n_rejected{0};
+
+  SignSketch(std::size_t n_bits, bool angular, bool squared,
+             double max_miss = 0.01)
+      : n_bits(n_bits), vec_len(bitvec_size(n_bits)), angular(angular),
+        squared(squared), max_miss(max_miss), max_cos(n_bits + 1, 1.0) {}
+
+  // x contains the reference items, y the queries. The search graph of the
+  // reference items is used to calibrate the bound
+  template <typename Parallel, typename In, typename DistOut, typename Idx,
+            typename Rand>
+  void build(const std::vector<In> &x, const std::vector<In> &y,
+             std::size_t ndim, const SparseNNGraph<DistOut, Idx> &search_graph,
+             Rand &rand, std::size_t n_threads) {
+    std::vector<In> center(ndim, 0);
+    if (!angular) {
+      const std::size_t nx = x.size() / ndim;
+      std::vector<double> sums(ndim, 0.0);
+      for (std::size_t i = 0; i < nx; i++) {
+        for (std::size_t d = 0; d < ndim; d++) {
+          sums[d] += x[i * ndim + d];
+        }
+      }
+      for (std::size_t d = 0; d < ndim; d++) {
+        center[d] = sums[d] / nx;
+      }
+    }
+
+    // Gaussian hyperplane normals via the Box-Muller transform, stored in
+    // blocks of sketch_lanes hyperplanes, with the values of each dimension of
+    // a block next to each other, so the projections of an item onto the
+    // hyperplanes of a block are accumulated together
+    const std::size_t n_blocks = (n_bits + sketch_lanes - 1) / sketch_lanes;
+    std::vector<In> planes(n_blocks * ndim * sketch_lanes);
+    constexpr double two_pi = 6.283185307179586;
+    for (std::size_t p = 0; p < planes.size(); p++) {
+      planes[p] = std::sqrt(-2.0 * std::log(1.0 - rand.unif())) *
+                  std::cos(two_pi * rand.unif());
+    }
+
+    sketch_items<Parallel>(x, ndim, center, planes, bx, x_norms, n_threads);
+    sketch_items<Parallel>(y, ndim, center, planes, by, y_norms, n_threads);
+    calibrate(x, ndim, center, search_graph);
+  }
+
+  template <typename Idx>
+  auto rejects(Idx i, Idx j, double bound) const -> bool {
+    const double cos_ij =
+        max_cos[hamming_impl<std::size_t>(bx, i, by, j, vec_len)];
+    if (angular) {
+      return 1.0 - cos_ij >= bound;
+    }
+    const double xn = x_norms[i];
+    const double yn = y_norms[j];
+    const double lower = xn * xn + yn * yn - 2.0 * xn * yn * cos_ij;
+    return lower >= (squared ? bound : bound * bound);
+  }
+
+  void count(std::size_t tested, std::size_t rejected) const {
+    n_tested += tested;
+    n_rejected += rejected;
+  }
+
+  auto rejection_rate() const -> double {
+    return n_tested == 0 ? 0.0
+                         : static_cast<double>(n_rejected) /
+                               static_cast<double>(n_tested);
+  }
+
+  template <typename Parallel, typename In>
+  void sketch_items(const std::vector<In> &data, std::size_t ndim,
+                    const std::vector<In> &center,
+                    const std::vector<In> &planes, BitVec &bits,
+                    std::vector<double> &norms, std::size_t n_threads) {
+    const std::size_t n_points = data.size() / ndim;
+    const std::size_t n_blocks = planes.size() / (ndim * sketch_lanes);
+    bits.assign(n_points * vec_len, BitSet<BITVEC_BIT_WIDTH>());
+    norms.assign(n_points, 0.0);
+
+    auto worker = [&](std::size_t begin, std::size_t end) {
+      std::vector<In> centered(ndim);
+      for (std::size_t i = begin; i < end; i++) {
+        const In *xi = &data[i * ndim];
+        double norm = 0.0;
+        for (std::size_t d = 0; d < ndim; d++) {
+          centered[d] = xi[d] - center[d];
+          norm += centered[d] * centered[d];
+        }
+        norms[i] = std::sqrt(norm);
+
+        for (std::size_t block = 0; block < n_blocks; block++) {
+          const In *block_planes = &planes[block * ndim * sketch_lanes];
+          In proj[sketch_lanes] = {};
+          for (std::size_t d = 0; d < ndim; d++) {
+            const In *plane_d = block_planes + d * sketch_lanes;
+            for (std::size_t l = 0; l < sketch_lanes; l++) {
+              proj[l] += plane_d[l] * centered[d];
+            }
+          }
+          for (std::size_t l = 0; l < sketch_lanes; l++) {
+            const std::size_t b = block * sketch_lanes + l;
+            if (b < n_bits) {
+              bits[i * vec_len + b / BITVEC_BIT_WIDTH][b % BITVEC_BIT_WIDTH] =
+                  proj[l] > 0;
+            }
+          }
+        }
+      }
+    };
+    NullProgress progress;
+    batch_parallel_for<Parallel>(worker, progress, n_points, n_threads,
+                                 std::size_t{64});
+  }
+
+  // the residual of each calibration pair is the number of differing bits
+  // beyond those expected from the angle between the items: the slack removed
+  // from the estimated angle is the 1 - max_miss quantile of the residuals
+  template <typename In, typename DistOut, typename Idx>
+  void calibrate(const std::vector<In> &x, std::size_t ndim,
+                 const std::vector<In> &center,
+                 const SparseNNGraph<DistOut, Idx> &search_graph) {
+    constexpr std::size_t max_calibration_points = 1000;
+    constexpr double pi = 3.141592653589793;
+    const std::size_t n_points = search_graph.n_points;
+    const std::size_t stride =
+        std::max(std::size_t{1}, n_points / max_calibration_points);
+
+    std::vector<double> residuals;
+    for (std::size_t i = 0; i < n_points; i += stride) {
+      for (std::size_t k = 0; k < search_graph.n_nbrs(i); k++) {
+        const Idx j = search_graph.index(i, k);
+        if (j == search_graph.npos() || j == i || x_norms[i] == 0.0 ||
+            x_norms[j] == 0.0) {
+          continue;
+        }
+        double dot = 0.0;
+        for (std::size_t d = 0; d < ndim; d++) {
+          dot += (x[i * ndim + d] - center[d]) * (x[j * ndim + d] - center[d]);
+        }
+        const double cos_ij = std::min(
+            1.0, std::max(-1.0, dot / (x_norms[i] * x_norms[j])));
+        const double expected = n_bits * std::acos(cos_ij) / pi;
+        const double n_diff =
+            hamming_impl<double, std::size_t>(bx, i, bx, j, vec_len);
+        residuals.push_back(n_diff - expected);
+      }
+    }
+
+    // with nothing to calibrate against, ignore the sketches: the bound is
+    // then from the norms alone (the triangle inequality)
+    double slack = static_cast<double>(n_bits);
+    if (!residuals.empty()) {
+      const std::size_t q = std::min(
+          residuals.size() - 1,
+          static_cast<std::size_t>((1.0 - max_miss) * residuals.size()));
+      std::nth_element(residuals.begin(), residuals.begin() + q,
+                       residuals.end());
+      slack = std::max(0.0, residuals[q]);
+    }
+    for (std::size_t h = 0; h <= n_bits; h++) {
+      const double bits = std::max(0.0, h - slack);
+      max_cos[h] = std::cos(pi * bits / n_bits);
+    }
+  }
+};
+
+// Used when there are no sketches: no candidate is rejected
+struct NoSketch {
+  template <typename Idx> auto rejects(Idx, Idx, double) const -> bool {
+    return false;
+  }
+
+  void count(std::size_t, std::size_t) const {}
+};
+
+} // namespace tdoann
+
+#endif // TDOANN_SKETCH_H
@@ -0,0 +1,296 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_SPARSE_H
+#define TDOANN_SPARSE_H
+
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "distance.h"
+
+namespace tdoann {
+
+// Data in compressed sparse row (CSR) format: the non-zero values of row i are
+// data[ptr[i]] to data[ptr[i + 1] - 1], and ind contains their column indices,
+// which must be in increasing order within each row
+template <typename In> struct SparseData {
+  std::vector<uint32_t> ind;
+  std::vector<std::size_t> ptr;
+  std::vector<In> data;
+
+  SparseData(std::vector<uint32_t> ind, std::vector<std::size_t> ptr,
+             std::vector<In> data)
+      : ind(std::move(ind)), ptr(std::move(ptr)), data(std::move(data)) {}
+
+  auto n_rows() const -> std::size_t { return ptr.size() - 1; }
+};
+
+template <typename In>
+auto normalize(const SparseData<In> &sparse) -> SparseData<In> {
+  SparseData<In> normalized(sparse);
+  const std::size_t n_rows = sparse.n_rows();
+  for (std::size_t i = 0; i < n_rows; i++) {
+    double norm = 0.0;
+    for (std::size_t k = sparse.ptr[i]; k < sparse.ptr[i + 1]; k++) {
+      norm += static_cast<double>(sparse.data[k]) * sparse.data[k];
+    }
+    norm = std::sqrt(norm) + 1e-30;
+    for (std::size_t k = sparse.ptr[i]; k < sparse.ptr[i + 1]; k++) {
+      normalized.data[k] = sparse.data[k] / norm;
+    }
+  }
+  return normalized;
+}
+
+// The sum of term(x_d, y_d) over the columns d which are non-zero in row i of x
+// or row j of y, found by merging their column indices: a column missing from
+// one of the rows contributes term(x_d, 0) or term(0, y_d)
+template <typename Out, typename In, typename Term>
+auto sparse_union_sum(const SparseData<In> &x, std::size_t i,
+                      const SparseData<In> &y, std::size_t j, Term term)
+    -> Out {
+  const In zero = 0;
+  std::size_t xk = x.ptr[i];
+  const std::size_t x_end = x.ptr[i + 1];
+  std::size_t yk = y.ptr[j];
+  const std::size_t y_end = y.ptr[j + 1];
+  Out sum = 0.0;
+  while (xk < x_end && yk < y_end) {
+    if (x.ind[xk] == y.ind[yk]) {
+      sum += term(x.data[xk], y.data[yk]);
+      ++xk;
+      ++yk;
+    } else if (x.ind[xk] < y.ind[yk]) {
+      sum += term(x.data[xk], zero);
+      ++xk;
+    } else {
+      sum += term(zero, y.data[yk]);
+      ++yk;
+    }
+  }
+  for (; xk < x_end; ++xk) {
+    sum += term(x.data[xk], zero);
+  }
+  for (; yk < y_end; ++yk) {
+    sum += term(zero, y.data[yk]);
+  }
+  return sum;
+}
+
+// The sum of term(x_d, y_d) over the columns d which are non-zero in both row i
+// of x and row j of y
+template <typename Out, typename In, typename Term>
+auto sparse_intersection_sum(const SparseData<In> &x, std::size_t i,
+                             const SparseData<In> &y, std::size_t j, Term term)
+    -> Out {
+  std::size_t xk = x.ptr[i];
+  const std::size_t x_end = x.ptr[i + 1];
+  std::size_t yk = y.ptr[j];
+  const std::size_t y_end = y.ptr[j + 1];
+  Out sum = 0.0;
+  while (xk < x_end && yk < y_end) {
+    if (x.ind[xk] == y.ind[yk]) {
+      sum += term(x.data[xk], y.data[yk]);
+      ++xk;
+      ++yk;
+    } else if (x.ind[xk] < y.ind[yk]) {
+      ++xk;
+    } else {
+      ++yk;
+    }
+  }
+  return sum;
+}
+
+// Counts each column, for the Jaccard distance
+template <typename Out> struct One {
+  template <typename In> auto operator()(In, In) const -> Out { return 1; }
+};
+
+template <typename In, typename Out, typename Idx = uint32_t>
+struct SparseL2Sqr {
+  SparseL2Sqr(const SparseData<In> &data, std::size_t ndim)
+      : x(data), y(data), ndim(ndim), nx(data.n_rows()), ny(data.n_rows()) {}
+  SparseL2Sqr(const SparseData<In> &x, const SparseData<In> &y,
+              std::size_t ndim)
+      : x(x), y(y), ndim(ndim), nx(x.n_rows()), ny(y.n_rows()) {}
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    return sparse_union_sum<Out>(x, i, y, j, SquaredDiff<Out>());
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    for (std::size_t k = 0; k < n; k++) {
+      out[k] = (*this)(is[k], j);
+    }
+  }
+
+  const SparseData<In> x;
+  const SparseData<In> y;
+  std::size_t ndim;
+  Idx nx;
+  Idx ny;
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+};
+
+template <typename In, typename Out, typename Idx = uint32_t>
+struct SparseEuclidean {
+  SparseEuclidean(const SparseData<In> &data, std::size_t ndim)
+      : x(data), y(data), ndim(ndim), nx(data.n_rows()), ny(data.n_rows()) {}
+  SparseEuclidean(const SparseData<In> &x, const SparseData<In> &y,
+                  std::size_t ndim)
+      : x(x), y(y), ndim(ndim), nx(x.n_rows()), ny(y.n_rows()) {}
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    return std::sqrt(sparse_union_sum<Out>(x, i, y, j, SquaredDiff<Out>()));
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    for (std::size_t k = 0; k < n; k++) {
+      out[k] = (*this)(is[k], j);
+    }
+  }
+
+  const SparseData<In> x;
+  const SparseData<In> y;
+  std::size_t ndim;
+  Idx nx;
+  Idx ny;
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+};
+
+template <typename In, typename Out, typename Idx = uint32_t>
+struct SparseManhattan {
+  SparseManhattan(const SparseData<In> &data, std::size_t ndim)
+      : x(data), y(data), ndim(ndim), nx(data.n_rows()), ny(data.n_rows()) {}
+  SparseManhattan(const SparseData<In> &x, const SparseData<In> &y,
+                  std::size_t ndim)
+      : x(x), y(y), ndim(ndim), nx(x.n_rows()), ny(y.n_rows()) {}
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    return sparse_union_sum<Out>(x, i, y, j, AbsDiff<Out>());
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    for (std::size_t k = 0; k < n; k++) {
+      out[k] = (*this)(is[k], j);
+    }
+  }
+
+  const SparseData<In> x;
+  const SparseData<In> y;
+  std::size_t ndim;
+  Idx nx;
+  Idx ny;
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+};
+
+// The rows are normalized when the distance is created, so only the columns
+// which are non-zero in both rows contribute to the distance
+template <typename In, typename Out, typename Idx = uint32_t>
+struct SparseCosine {
+  SparseCosine(const SparseData<In> &data, std::size_t ndim)
+      : x(normalize(data)), y(x), ndim(ndim), nx(data.n_rows()),
+        ny(data.n_rows()) {}
+  SparseCosine(const SparseData<In> &x, const SparseData<In> &y,
+               std::size_t ndim)
+      : x(normalize(x)), y(normalize(y)), ndim(ndim), nx(x.n_rows()),
+        ny(y.n_rows()) {}
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    return 1.0 - sparse_intersection_sum<Out>(x, i, y, j, Product<Out>());
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    for (std::size_t k = 0; k < n; k++) {
+      out[k] = (*this)(is[k], j);
+    }
+  }
+
+  const SparseData<In> x;
+  const SparseData<In> y;
+  std::size_t ndim;
+  Idx nx;
+  Idx ny;
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+};
+
+// 1 minus the number of columns which are non-zero in both rows divided by the
+// number which are non-zero in either: the values themselves are not used
+template <typename In, typename Out, typename Idx = uint32_t>
+struct SparseJaccard {
+  SparseJaccard(const SparseData<In> &data, std::size_t ndim)
+      : x(data), y(data), ndim(ndim), nx(data.n_rows()), ny(data.n_rows()) {}
+  SparseJaccard(const SparseData<In> &x, const SparseData<In> &y,
+                std::size_t ndim)
+      : x(x), y(y), ndim(ndim), nx(x.n_rows()), ny(y.n_rows()) {}
+
+  auto operator()(Idx i, Idx j) const -> Out {
+    const std::size_t n_both =
+        sparse_intersection_sum<std::size_t>(x, i, y, j, One<std::size_t>());
+    const std::size_t n_either =
+        (x.ptr[i + 1] - x.ptr[i]) + (y.ptr[j + 1] - y.ptr[j]) - n_both;
+    if (n_either == 0) {
+      return 0.0;
+    }
+    return static_cast<Out>(n_either - n_both) / static_cast<Out>(n_either);
+  }
+
+  void batch(Idx j, const Idx *is, std::size_t n, Out *out) const {
+    for (std::size_t k = 0; k < n; k++) {
+      out[k] = (*this)(is[k], j);
+    }
+  }
+
+  const SparseData<In> x;
+  const SparseData<In> y;
+  std::size_t ndim;
+  Idx nx;
+  Idx ny;
+
+  using Input = In;
+  using Output = Out;
+  using Index = Idx;
+};
+
+} // namespace tdoann
+
+#endif // TDOANN_SPARSE_H
@@ -0,0 +1,205 @@
+// BSD 2-Clause License
+//
+// Copyright 2021 James Melville
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// OF SUCH DAMAGE.
+
+#ifndef TDOANN_TOMBSTONES_H
+#define TDOANN_TOMBSTONES_H
+
+#include <vector>
+
+#include "heap.h"
+#include "parallel.h"
+
+namespace tdoann {
+
+// Marks points as deleted without removing them from the graph: a deleted
+// point can still be used to navigate the graph during a search, but it must
+// never be returned as a neighbor.
+struct Tombstones {
+  std::vector<char> deleted;
+  std::size_t n_deleted;
+
+  Tombstones(std::size_t n_points) : deleted(n_points, 0), n_deleted(0) {}
+
+  void mark(std::size_t i) {
+    if (deleted[i] == 0) {
+      deleted[i] = 1;
+      ++n_deleted;
+    }
+  }
+
+  auto is_deleted(std::size_t i) const -> bool { return deleted[i] == 1; }
+
+  auto empty() const -> bool { return n_deleted == 0; }
+};
+
+// Null object for when nothing has been deleted
+struct NoTombstones {
+  auto is_deleted(std::size_t) const -> bool { return false; }
+
+  auto empty() const -> bool { return true; }
+};
+
+template <typename NbrHeap, typename Deleted>
+auto has_deleted_nbrs(const NbrHeap &graph, std::size_t i,
+                      const Deleted &deleted) -> bool {
+  const std::size_t n_nbrs = graph.n_nbrs;
+  for (std::size_t j = 0; j < n_nbrs; j++) {
+    auto nbr = graph.index(i, j);
+    if (nbr != graph.npos() && deleted.is_deleted(nbr)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Remove any deleted neighbors from row i of a heap, retaining the others
+template <typename NbrHeap, typename Deleted>
+void remove_deleted_nbrs(NbrHeap &heap, std::size_t i,
+                         const Deleted &deleted) {
+  using DistOut = typename NbrHeap::DistanceOut;
+  using Idx = typename NbrHeap::Index;
+
+  const std::size_t n_nbrs = heap.n_nbrs;
+  std::vector<std::pair<DistOut, Idx>> retained;
+  retained.reserve(n_nbrs);
+  for (std::size_t j = 0; j < n_nbrs; j++) {
+    auto nbr = heap.index(i, j);
+    if (nbr != heap.npos() && !deleted.is_deleted(nbr)) {
+      retained.emplace_back(heap.distance(i, j), nbr);
+    }
+  }
+  heap.clear(i);
+  for (const auto &nbr : retained) {
+    heap.checked_push(i, nbr.first, nbr.second);
+  }
+}
+
+// Copy row i of graph into repaired. If any of the neighbors of i have been
+// deleted, they are replaced by the nearest of the neighbors of the neighbors
+// of i (including those of the deleted neighbors) which have not been deleted.
+// Rows of deleted points are copied unchanged. Returns true if the row needed
+// repairing.
+template <typename NbrHeap, typename Distance, typename Deleted>
+auto repair_deleted(const NbrHeap &graph, NbrHeap &repaired,
+                    const Distance &distance, const Deleted &deleted,
+                    std::size_t i) -> bool {
+  const std::size_t n_nbrs = graph.n_nbrs;
+  const bool needs_repair =
+      !deleted.is_deleted(i) && has_deleted_nbrs(graph, i, deleted);
+
+  for (std::size_t j = 0; j < n_nbrs; j++) {
+    auto nbr = graph.index(i, j);
+    if (nbr == graph.npos() || (needs_repair && deleted.is_deleted(nbr))) {
+      continue;
+    }
+    repaired.checked_push(i, graph.distance(i, j), nbr);
+  }
+  if (!needs_repair) {
+    return false;
+  }
+
+  for (std::size_t j = 0; j < n_nbrs; j++) {
+    auto nbr = graph.index(i, j);
+    if (nbr == graph.npos()) {
+      continue;
+    }
+    for (std::size_t k = 0; k < n_nbrs; k++) {
+      auto nbr2 = graph.index(nbr, k);
+      if (nbr2 == graph.npos() || nbr2 == i || deleted.is_deleted(nbr2) ||
+          repaired.contains(i, nbr2)) {
+        continue;
+      }
+      repaired.checked_push(i, distance(i, nbr2), nbr2);
+    }
+  }
+  return true;
+}
+
+template <typename NbrHeap, typename Distance, typename Deleted>
+auto repair_deleted(const NbrHeap &graph, const Distance &distance,
+                    const Deleted &deleted) -> NbrHeap {
+  NbrHeap repaired(graph.n_points, graph.n_nbrs);
+  const std::size_t n_points = graph.n_points;
+  for (std::size_t i = 0; i < n_points; i++) {
+    repair_deleted(graph, repaired, distance, deleted, i);
+  }
+  return repaired;
+}
+
+template <typename Parallel, typename NbrHeap, typename Distance,
+          typename Deleted>
+auto repair_deleted(const NbrHeap &graph, const Distance &distance,
+                    const Deleted &deleted, std::size_t n_threads)
+    -> NbrHeap {
+  NbrHeap repaired(graph.n_points, graph.n_nbrs);
+  auto worker = [&](std::size_t begin, std::size_t end) {
+    for (auto i = begin; i < end; i++) {
+      repair_deleted(graph, repaired, distance, deleted, i);
+    }
+  };
+  const std::size_t grain_size = 1;
+  Parallel::parallel_for(0, graph.n_points, worker, n_threads, grain_size);
+  return repaired;
+}
+
+// Remove the rows of the points of graph marked in its tombstones, numbering
+// the remaining points in their original order. A neighbor which was deleted
+// is left missing (npos). kept is filled with the original index of each
+// remaining point.
+template <typename NNGraph>
+auto compact_deleted(const NNGraph &graph,
+                     std::vector<typename NNGraph::Index> &kept) -> NNGraph {
+  using Idx = typename NNGraph::Index;
+
+  const std::size_t n_points = graph.n_points;
+  const std::size_t n_nbrs = graph.n_nbrs;
+  std::vector<Idx> new_idx(n_points, NNGraph::npos());
+  kept.clear();
+  for (std::size_t i = 0; i < n_points; i++) {
+    if (!graph.tombstones.is_deleted(i)) {
+      new_idx[i] = static_cast<Idx>(kept.size());
+      kept.push_back(static_cast<Idx>(i));
+    }
+  }
+
+  NNGraph compacted(kept.size(), n_nbrs);
+  for (std::size_t i = 0; i < kept.size(); i++) {
+    const std::size_t old_row = static_cast<std::size_t>(kept[i]) * n_nbrs;
+    const std::size_t new_row = i * n_nbrs;
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      const Idx nbr = graph.idx[old_row + j];
+      if (nbr == NNGraph::npos() || new_idx[nbr] == NNGraph::npos()) {
+        continue;
+      }
+      compacted.idx[new_row + j] = new_idx[nbr];
+      compacted.dist[new_row + j] = graph.dist[old_row + j];
+    }
+  }
+  return compacted;
+}
+
+} // namespace tdoann
+#endif // TDOANN_TOMBSTONES_H
@@ -11,8 +11,8 @@ Rcpp::Rostream<false>& Rcpp::Rcerr = Rcpp::Rcpp_cerr_get();
 #endif
 
 // rnn_brute_force
-List rnn_brute_force(NumericMatrix data, uint32_t k, const std::string& metric, std::size_t n_threads, bool verbose);
-RcppExport SEXP _rnndescent_rnn_brute_force(SEXP dataSEXP, SEXP kSEXP, SEXP metricSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+List rnn_brute_force(NumericMatrix data, uint32_t k, const std::string& metric, std::size_t n_threads, bool verbose, const std::string& precision, const std::string& layout);
+RcppExport SEXP _rnndescent_rnn_brute_force(SEXP dataSEXP, SEXP kSEXP, SEXP metricSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP precisionSEXP, SEXP layoutSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -21,13 +21,15 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
     Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
     Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
-    rcpp_result_gen = Rcpp::wrap(rnn_brute_force(data, k, metric, n_threads, verbose));
+    Rcpp::traits::input_parameter< const std::string& >::type precision(precisionSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type layout(layoutSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_brute_force(data, k, metric, n_threads, verbose, precision, layout));
     return rcpp_result_gen;
 END_RCPP
 }
 // rnn_brute_force_query
-List rnn_brute_force_query(NumericMatrix reference, NumericMatrix query, uint32_t k, const std::string& metric, std::size_t n_threads, bool verbose);
-RcppExport SEXP _rnndescent_rnn_brute_force_query(SEXP referenceSEXP, SEXP querySEXP, SEXP kSEXP, SEXP metricSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+List rnn_brute_force_query(NumericMatrix reference, NumericMatrix query, uint32_t k, const std::string& metric, std::size_t n_threads, bool verbose, const std::string& precision, const std::string& layout, std::size_t n_pivots);
+RcppExport SEXP _rnndescent_rnn_brute_force_query(SEXP referenceSEXP, SEXP querySEXP, SEXP kSEXP, SEXP metricSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP precisionSEXP, SEXP layoutSEXP, SEXP n_pivotsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -37,7 +39,161 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
     Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
     Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
-    rcpp_result_gen = Rcpp::wrap(rnn_brute_force_query(reference, query, k, metric, n_threads, verbose));
+    Rcpp::traits::input_parameter< const std::string& >::type precision(precisionSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type layout(layoutSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_pivots(n_pivotsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_brute_force_query(reference, query, k, metric, n_threads, verbose, precision, layout, n_pivots));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rnn_sparse_brute_force
+List rnn_sparse_brute_force(List data, uint32_t k, const std::string& metric, std::size_t n_threads, bool verbose, const std::string& precision);
+RcppExport SEXP _rnndescent_rnn_sparse_brute_force(SEXP dataSEXP, SEXP kSEXP, SEXP metricSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP precisionSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< uint32_t >::type k(kSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type precision(precisionSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_sparse_brute_force(data, k, metric, n_threads, verbose, precision));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rnn_sparse_brute_force_query
+List rnn_sparse_brute_force_query(List reference, List query, uint32_t k, const std::string& metric, std::size_t n_threads, bool verbose, const std::string& precision);
+RcppExport SEXP _rnndescent_rnn_sparse_brute_force_query(SEXP referenceSEXP, SEXP querySEXP, SEXP kSEXP, SEXP metricSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP precisionSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type reference(referenceSEXP);
+    Rcpp::traits::input_parameter< List >::type query(querySEXP);
+    Rcpp::traits::input_parameter< uint32_t >::type k(kSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type precision(precisionSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_sparse_brute_force_query(reference, query, k, metric, n_threads, verbose, precision));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rnn_delete_repair
+List rnn_delete_repair(NumericMatrix data, IntegerMatrix nn_idx, NumericMatrix nn_dist, IntegerVector deleted, double compact_threshold, const std::string& metric, std::size_t n_threads);
+RcppExport SEXP _rnndescent_rnn_delete_repair(SEXP dataSEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP deletedSEXP, SEXP compact_thresholdSEXP, SEXP metricSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericMatrix >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< IntegerMatrix >::type nn_idx(nn_idxSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type nn_dist(nn_distSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type deleted(deletedSEXP);
+    Rcpp::traits::input_parameter< double >::type compact_threshold(compact_thresholdSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_delete_repair(data, nn_idx, nn_dist, deleted, compact_threshold, metric, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// nnd_worker_create
+SEXP nnd_worker_create(NumericMatrix data, IntegerMatrix nn_idx, NumericMatrix nn_dist, const std::string& metric, std::size_t n_points, std::size_t n_workers, std::size_t worker, std::size_t max_candidates);
+RcppExport SEXP _rnndescent_nnd_worker_create(SEXP dataSEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP metricSEXP, SEXP n_pointsSEXP, SEXP n_workersSEXP, SEXP workerSEXP, SEXP max_candidatesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericMatrix >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< IntegerMatrix >::type nn_idx(nn_idxSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type nn_dist(nn_distSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_points(n_pointsSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_workers(n_workersSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type worker(workerSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type max_candidates(max_candidatesSEXP);
+    rcpp_result_gen = Rcpp::wrap(nnd_worker_create(data, nn_idx, nn_dist, metric, n_points, n_workers, worker, max_candidates));
+    return rcpp_result_gen;
+END_RCPP
+}
+// nnd_worker_bounds
+NumericVector nnd_worker_bounds(SEXP worker);
+RcppExport SEXP _rnndescent_nnd_worker_bounds(SEXP workerSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type worker(workerSEXP);
+    rcpp_result_gen = Rcpp::wrap(nnd_worker_bounds(worker));
+    return rcpp_result_gen;
+END_RCPP
+}
+// nnd_worker_candidates
+List nnd_worker_candidates(SEXP worker, IntegerVector seed);
+RcppExport SEXP _rnndescent_nnd_worker_candidates(SEXP workerSEXP, SEXP seedSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type worker(workerSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type seed(seedSEXP);
+    rcpp_result_gen = Rcpp::wrap(nnd_worker_candidates(worker, seed));
+    return rcpp_result_gen;
+END_RCPP
+}
+// nnd_worker_requests
+List nnd_worker_requests(SEXP worker, List inbox);
+RcppExport SEXP _rnndescent_nnd_worker_requests(SEXP workerSEXP, SEXP inboxSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type worker(workerSEXP);
+    Rcpp::traits::input_parameter< List >::type inbox(inboxSEXP);
+    rcpp_result_gen = Rcpp::wrap(nnd_worker_requests(worker, inbox));
+    return rcpp_result_gen;
+END_RCPP
+}
+// nnd_worker_rows
+List nnd_worker_rows(SEXP worker, List inbox);
+RcppExport SEXP _rnndescent_nnd_worker_rows(SEXP workerSEXP, SEXP inboxSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type worker(workerSEXP);
+    Rcpp::traits::input_parameter< List >::type inbox(inboxSEXP);
+    rcpp_result_gen = Rcpp::wrap(nnd_worker_rows(worker, inbox));
+    return rcpp_result_gen;
+END_RCPP
+}
+// nnd_worker_join
+List nnd_worker_join(SEXP worker, List inbox, NumericVector bounds);
+RcppExport SEXP _rnndescent_nnd_worker_join(SEXP workerSEXP, SEXP inboxSEXP, SEXP boundsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type worker(workerSEXP);
+    Rcpp::traits::input_parameter< List >::type inbox(inboxSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type bounds(boundsSEXP);
+    rcpp_result_gen = Rcpp::wrap(nnd_worker_join(worker, inbox, bounds));
+    return rcpp_result_gen;
+END_RCPP
+}
+// nnd_worker_apply
+double nnd_worker_apply(SEXP worker, List inbox);
+RcppExport SEXP _rnndescent_nnd_worker_apply(SEXP workerSEXP, SEXP inboxSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type worker(workerSEXP);
+    Rcpp::traits::input_parameter< List >::type inbox(inboxSEXP);
+    rcpp_result_gen = Rcpp::wrap(nnd_worker_apply(worker, inbox));
+    return rcpp_result_gen;
+END_RCPP
+}
+// nnd_worker_graph
+List nnd_worker_graph(SEXP worker);
+RcppExport SEXP _rnndescent_nnd_worker_graph(SEXP workerSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type worker(workerSEXP);
+    rcpp_result_gen = Rcpp::wrap(nnd_worker_graph(worker));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -86,6 +242,37 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// rnn_sparse_idx_to_graph_self
+List rnn_sparse_idx_to_graph_self(List data, IntegerMatrix idx, const std::string& metric, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_sparse_idx_to_graph_self(SEXP dataSEXP, SEXP idxSEXP, SEXP metricSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< IntegerMatrix >::type idx(idxSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_sparse_idx_to_graph_self(data, idx, metric, n_threads, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rnn_sparse_idx_to_graph_query
+List rnn_sparse_idx_to_graph_query(List reference, List query, IntegerMatrix idx, const std::string& metric, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_sparse_idx_to_graph_query(SEXP referenceSEXP, SEXP querySEXP, SEXP idxSEXP, SEXP metricSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type reference(referenceSEXP);
+    Rcpp::traits::input_parameter< List >::type query(querySEXP);
+    Rcpp::traits::input_parameter< IntegerMatrix >::type idx(idxSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_sparse_idx_to_graph_query(reference, query, idx, metric, n_threads, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
 // merge_nn
 List merge_nn(IntegerMatrix nn_idx1, NumericMatrix nn_dist1, IntegerMatrix nn_idx2, NumericMatrix nn_dist2, bool is_query, std::size_t n_threads, bool verbose);
 RcppExport SEXP _rnndescent_merge_nn(SEXP nn_idx1SEXP, SEXP nn_dist1SEXP, SEXP nn_idx2SEXP, SEXP nn_dist2SEXP, SEXP is_querySEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
@@ -118,8 +305,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // nn_descent
-List nn_descent(NumericMatrix data, IntegerMatrix nn_idx, NumericMatrix nn_dist, const std::string& metric, std::size_t max_candidates, std::size_t n_iters, double delta, bool low_memory, std::size_t n_threads, bool verbose, const std::string& progress);
-RcppExport SEXP _rnndescent_nn_descent(SEXP dataSEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP metricSEXP, SEXP max_candidatesSEXP, SEXP n_itersSEXP, SEXP deltaSEXP, SEXP low_memorySEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP progressSEXP) {
+List nn_descent(NumericMatrix data, IntegerMatrix nn_idx, NumericMatrix nn_dist, const std::string& metric, std::size_t max_candidates, std::size_t n_iters, double delta, bool low_memory, std::size_t n_threads, bool verbose, const std::string& progress, const std::string& checkpoint_file, bool resume, IntegerVector recall_ids, double target_recall, double max_time, double max_dist_evals, double sample_rate, bool adaptive_candidates, std::size_t max_reverse_candidates, const std::string& precision);
+RcppExport SEXP _rnndescent_nn_descent(SEXP dataSEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP metricSEXP, SEXP max_candidatesSEXP, SEXP n_itersSEXP, SEXP deltaSEXP, SEXP low_memorySEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP progressSEXP, SEXP checkpoint_fileSEXP, SEXP resumeSEXP, SEXP recall_idsSEXP, SEXP target_recallSEXP, SEXP max_timeSEXP, SEXP max_dist_evalsSEXP, SEXP sample_rateSEXP, SEXP adaptive_candidatesSEXP, SEXP max_reverse_candidatesSEXP, SEXP precisionSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -134,7 +321,138 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
     Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type progress(progressSEXP);
-    rcpp_result_gen = Rcpp::wrap(nn_descent(data, nn_idx, nn_dist, metric, max_candidates, n_iters, delta, low_memory, n_threads, verbose, progress));
+    Rcpp::traits::input_parameter< const std::string& >::type checkpoint_file(checkpoint_fileSEXP);
+    Rcpp::traits::input_parameter< bool >::type resume(resumeSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type recall_ids(recall_idsSEXP);
+    Rcpp::traits::input_parameter< double >::type target_recall(target_recallSEXP);
+    Rcpp::traits::input_parameter< double >::type max_time(max_timeSEXP);
+    Rcpp::traits::input_parameter< double >::type max_dist_evals(max_dist_evalsSEXP);
+    Rcpp::traits::input_parameter< double >::type sample_rate(sample_rateSEXP);
+    Rcpp::traits::input_parameter< bool >::type adaptive_candidates(adaptive_candidatesSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type max_reverse_candidates(max_reverse_candidatesSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type precision(precisionSEXP);
+    rcpp_result_gen = Rcpp::wrap(nn_descent(data, nn_idx, nn_dist, metric, max_candidates, n_iters, delta, low_memory, n_threads, verbose, progress, checkpoint_file, resume, recall_ids, target_recall, max_time, max_dist_evals, sample_rate, adaptive_candidates, max_reverse_candidates, precision));
+    return rcpp_result_gen;
+END_RCPP
+}
+// sparse_nn_descent
+List sparse_nn_descent(List data, IntegerMatrix nn_idx, NumericMatrix nn_dist, const std::string& metric, std::size_t max_candidates, std::size_t n_iters, double delta, bool low_memory, std::size_t n_threads, bool verbose, const std::string& progress, const std::string& checkpoint_file, bool resume, IntegerVector recall_ids, double target_recall, double max_time, double max_dist_evals, double sample_rate, bool adaptive_candidates, std::size_t max_reverse_candidates, const std::string& precision);
+RcppExport SEXP _rnndescent_sparse_nn_descent(SEXP dataSEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP metricSEXP, SEXP max_candidatesSEXP, SEXP n_itersSEXP, SEXP deltaSEXP, SEXP low_memorySEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP progressSEXP, SEXP checkpoint_fileSEXP, SEXP resumeSEXP, SEXP recall_idsSEXP, SEXP target_recallSEXP, SEXP max_timeSEXP, SEXP max_dist_evalsSEXP, SEXP sample_rateSEXP, SEXP adaptive_candidatesSEXP, SEXP max_reverse_candidatesSEXP, SEXP precisionSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< IntegerMatrix >::type nn_idx(nn_idxSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type nn_dist(nn_distSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type max_candidates(max_candidatesSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_iters(n_itersSEXP);
+    Rcpp::traits::input_parameter< double >::type delta(deltaSEXP);
+    Rcpp::traits::input_parameter< bool >::type low_memory(low_memorySEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type progress(progressSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type checkpoint_file(checkpoint_fileSEXP);
+    Rcpp::traits::input_parameter< bool >::type resume(resumeSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type recall_ids(recall_idsSEXP);
+    Rcpp::traits::input_parameter< double >::type target_recall(target_recallSEXP);
+    Rcpp::traits::input_parameter< double >::type max_time(max_timeSEXP);
+    Rcpp::traits::input_parameter< double >::type max_dist_evals(max_dist_evalsSEXP);
+    Rcpp::traits::input_parameter< double >::type sample_rate(sample_rateSEXP);
+    Rcpp::traits::input_parameter< bool >::type adaptive_candidates(adaptive_candidatesSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type max_reverse_candidates(max_reverse_candidatesSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type precision(precisionSEXP);
+    rcpp_result_gen = Rcpp::wrap(sparse_nn_descent(data, nn_idx, nn_dist, metric, max_candidates, n_iters, delta, low_memory, n_threads, verbose, progress, checkpoint_file, resume, recall_ids, target_recall, max_time, max_dist_evals, sample_rate, adaptive_candidates, max_reverse_candidates, precision));
+    return rcpp_result_gen;
+END_RCPP
+}
+// nn_descent_checkpoint_info
+List nn_descent_checkpoint_info(const std::string& checkpoint_file);
+RcppExport SEXP _rnndescent_nn_descent_checkpoint_info(SEXP checkpoint_fileSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type checkpoint_file(checkpoint_fileSEXP);
+    rcpp_result_gen = Rcpp::wrap(nn_descent_checkpoint_info(checkpoint_file));
+    return rcpp_result_gen;
+END_RCPP
+}
+// nn_descent_insert
+List nn_descent_insert(NumericMatrix data, IntegerMatrix nn_idx, NumericMatrix nn_dist, std::size_t n_old, const std::string& metric, std::size_t max_candidates, std::size_t n_iters, double delta, bool low_memory, bool verbose, const std::string& progress);
+RcppExport SEXP _rnndescent_nn_descent_insert(SEXP dataSEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP n_oldSEXP, SEXP metricSEXP, SEXP max_candidatesSEXP, SEXP n_itersSEXP, SEXP deltaSEXP, SEXP low_memorySEXP, SEXP verboseSEXP, SEXP progressSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericMatrix >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< IntegerMatrix >::type nn_idx(nn_idxSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type nn_dist(nn_distSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_old(n_oldSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type max_candidates(max_candidatesSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_iters(n_itersSEXP);
+    Rcpp::traits::input_parameter< double >::type delta(deltaSEXP);
+    Rcpp::traits::input_parameter< bool >::type low_memory(low_memorySEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type progress(progressSEXP);
+    rcpp_result_gen = Rcpp::wrap(nn_descent_insert(data, nn_idx, nn_dist, n_old, metric, max_candidates, n_iters, delta, low_memory, verbose, progress));
+    return rcpp_result_gen;
+END_RCPP
+}
+// nn_descent_refine
+List nn_descent_refine(NumericMatrix data, IntegerMatrix nn_idx, NumericMatrix nn_dist, IntegerVector seed_ids, const std::string& metric, std::size_t max_candidates, std::size_t n_iters, double delta, bool low_memory, bool verbose, const std::string& progress);
+RcppExport SEXP _rnndescent_nn_descent_refine(SEXP dataSEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP seed_idsSEXP, SEXP metricSEXP, SEXP max_candidatesSEXP, SEXP n_itersSEXP, SEXP deltaSEXP, SEXP low_memorySEXP, SEXP verboseSEXP, SEXP progressSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericMatrix >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< IntegerMatrix >::type nn_idx(nn_idxSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type nn_dist(nn_distSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type seed_ids(seed_idsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type max_candidates(max_candidatesSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_iters(n_itersSEXP);
+    Rcpp::traits::input_parameter< double >::type delta(deltaSEXP);
+    Rcpp::traits::input_parameter< bool >::type low_memory(low_memorySEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type progress(progressSEXP);
+    rcpp_result_gen = Rcpp::wrap(nn_descent_refine(data, nn_idx, nn_dist, seed_ids, metric, max_candidates, n_iters, delta, low_memory, verbose, progress));
+    return rcpp_result_gen;
+END_RCPP
+}
+// pq_encode_cpp
+List pq_encode_cpp(NumericMatrix train, NumericMatrix data, std::size_t n_subspaces, std::size_t n_iters, const std::string& metric, std::size_t n_threads);
+RcppExport SEXP _rnndescent_pq_encode_cpp(SEXP trainSEXP, SEXP dataSEXP, SEXP n_subspacesSEXP, SEXP n_itersSEXP, SEXP metricSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericMatrix >::type train(trainSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_subspaces(n_subspacesSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_iters(n_itersSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(pq_encode_cpp(train, data, n_subspaces, n_iters, metric, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// pq_query_cpp
+List pq_query_cpp(NumericMatrix centroids, RawMatrix codes, List reference_graph_list, NumericMatrix query, IntegerMatrix nn_idx, const std::string& metric, double epsilon, std::size_t n_threads, bool verbose, const std::string& rerank_file, std::size_t k);
+RcppExport SEXP _rnndescent_pq_query_cpp(SEXP centroidsSEXP, SEXP codesSEXP, SEXP reference_graph_listSEXP, SEXP querySEXP, SEXP nn_idxSEXP, SEXP metricSEXP, SEXP epsilonSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP rerank_fileSEXP, SEXP kSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericMatrix >::type centroids(centroidsSEXP);
+    Rcpp::traits::input_parameter< RawMatrix >::type codes(codesSEXP);
+    Rcpp::traits::input_parameter< List >::type reference_graph_list(reference_graph_listSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type query(querySEXP);
+    Rcpp::traits::input_parameter< IntegerMatrix >::type nn_idx(nn_idxSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< double >::type epsilon(epsilonSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type rerank_file(rerank_fileSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type k(kSEXP);
+    rcpp_result_gen = Rcpp::wrap(pq_query_cpp(centroids, codes, reference_graph_list, query, nn_idx, metric, epsilon, n_threads, verbose, rerank_file, k));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -211,9 +529,53 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// sparse_random_knn_cpp
+List sparse_random_knn_cpp(List data, uint32_t k, const std::string& metric, bool order_by_distance, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_sparse_random_knn_cpp(SEXP dataSEXP, SEXP kSEXP, SEXP metricSEXP, SEXP order_by_distanceSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< uint32_t >::type k(kSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< bool >::type order_by_distance(order_by_distanceSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(sparse_random_knn_cpp(data, k, metric, order_by_distance, n_threads, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
+// sparse_random_knn_query_cpp
+List sparse_random_knn_query_cpp(List reference, List query, uint32_t k, const std::string& metric, bool order_by_distance, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_sparse_random_knn_query_cpp(SEXP referenceSEXP, SEXP querySEXP, SEXP kSEXP, SEXP metricSEXP, SEXP order_by_distanceSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type reference(referenceSEXP);
+    Rcpp::traits::input_parameter< List >::type query(querySEXP);
+    Rcpp::traits::input_parameter< uint32_t >::type k(kSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< bool >::type order_by_distance(order_by_distanceSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(sparse_random_knn_query_cpp(reference, query, k, metric, order_by_distance, n_threads, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bfs_reorder_cpp
+List bfs_reorder_cpp(List graph_list);
+RcppExport SEXP _rnndescent_bfs_reorder_cpp(SEXP graph_listSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type graph_list(graph_listSEXP);
+    rcpp_result_gen = Rcpp::wrap(bfs_reorder_cpp(graph_list));
+    return rcpp_result_gen;
+END_RCPP
+}
 // nn_query
-List nn_query(NumericMatrix reference, List reference_graph_list, NumericMatrix query, IntegerMatrix nn_idx, NumericMatrix nn_dist, const std::string& metric, double epsilon, std::size_t n_threads, bool verbose);
-RcppExport SEXP _rnndescent_nn_query(SEXP referenceSEXP, SEXP reference_graph_listSEXP, SEXP querySEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP metricSEXP, SEXP epsilonSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+List nn_query(NumericMatrix reference, List reference_graph_list, NumericMatrix query, IntegerMatrix nn_idx, NumericMatrix nn_dist, IntegerVector deleted, const std::string& metric, double epsilon, std::size_t n_threads, bool verbose, std::size_t max_dist_evals, const std::string& precision, std::size_t sketch_bits);
+RcppExport SEXP _rnndescent_nn_query(SEXP referenceSEXP, SEXP reference_graph_listSEXP, SEXP querySEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP deletedSEXP, SEXP metricSEXP, SEXP epsilonSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP max_dist_evalsSEXP, SEXP precisionSEXP, SEXP sketch_bitsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -222,30 +584,115 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< NumericMatrix >::type query(querySEXP);
     Rcpp::traits::input_parameter< IntegerMatrix >::type nn_idx(nn_idxSEXP);
     Rcpp::traits::input_parameter< NumericMatrix >::type nn_dist(nn_distSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type deleted(deletedSEXP);
     Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
     Rcpp::traits::input_parameter< double >::type epsilon(epsilonSEXP);
     Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
     Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
-    rcpp_result_gen = Rcpp::wrap(nn_query(reference, reference_graph_list, query, nn_idx, nn_dist, metric, epsilon, n_threads, verbose));
+    Rcpp::traits::input_parameter< std::size_t >::type max_dist_evals(max_dist_evalsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type precision(precisionSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type sketch_bits(sketch_bitsSEXP);
+    rcpp_result_gen = Rcpp::wrap(nn_query(reference, reference_graph_list, query, nn_idx, nn_dist, deleted, metric, epsilon, n_threads, verbose, max_dist_evals, precision, sketch_bits));
+    return rcpp_result_gen;
+END_RCPP
+}
+// sparse_nn_query
+List sparse_nn_query(List reference, List reference_graph_list, List query, IntegerMatrix nn_idx, NumericMatrix nn_dist, IntegerVector deleted, const std::string& metric, double epsilon, std::size_t n_threads, bool verbose, std::size_t max_dist_evals, const std::string& precision, std::size_t sketch_bits);
+RcppExport SEXP _rnndescent_sparse_nn_query(SEXP referenceSEXP, SEXP reference_graph_listSEXP, SEXP querySEXP, SEXP nn_idxSEXP, SEXP nn_distSEXP, SEXP deletedSEXP, SEXP metricSEXP, SEXP epsilonSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP, SEXP max_dist_evalsSEXP, SEXP precisionSEXP, SEXP sketch_bitsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type reference(referenceSEXP);
+    Rcpp::traits::input_parameter< List >::type reference_graph_list(reference_graph_listSEXP);
+    Rcpp::traits::input_parameter< List >::type query(querySEXP);
+    Rcpp::traits::input_parameter< IntegerMatrix >::type nn_idx(nn_idxSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type nn_dist(nn_distSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type deleted(deletedSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< double >::type epsilon(epsilonSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type max_dist_evals(max_dist_evalsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type precision(precisionSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type sketch_bits(sketch_bitsSEXP);
+    rcpp_result_gen = Rcpp::wrap(sparse_nn_query(reference, reference_graph_list, query, nn_idx, nn_dist, deleted, metric, epsilon, n_threads, verbose, max_dist_evals, precision, sketch_bits));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rnn_tree_knn_query
+List rnn_tree_knn_query(NumericMatrix reference, NumericMatrix query, uint32_t k, const std::string& metric, const std::string& method, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_tree_knn_query(SEXP referenceSEXP, SEXP querySEXP, SEXP kSEXP, SEXP metricSEXP, SEXP methodSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericMatrix >::type reference(referenceSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type query(querySEXP);
+    Rcpp::traits::input_parameter< uint32_t >::type k(kSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type method(methodSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_tree_knn_query(reference, query, k, metric, method, n_threads, verbose));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rnn_tree_knn
+List rnn_tree_knn(NumericMatrix data, uint32_t k, const std::string& metric, const std::string& method, std::size_t n_threads, bool verbose);
+RcppExport SEXP _rnndescent_rnn_tree_knn(SEXP dataSEXP, SEXP kSEXP, SEXP metricSEXP, SEXP methodSEXP, SEXP n_threadsSEXP, SEXP verboseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericMatrix >::type data(dataSEXP);
+    Rcpp::traits::input_parameter< uint32_t >::type k(kSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type metric(metricSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type method(methodSEXP);
+    Rcpp::traits::input_parameter< std::size_t >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< bool >::type verbose(verboseSEXP);
+    rcpp_result_gen = Rcpp::wrap(rnn_tree_knn(data, k, metric, method, n_threads, verbose));
     return rcpp_result_gen;
 END_RCPP
 }
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_rnndescent_rnn_brute_force", (DL_FUNC) &_rnndescent_rnn_brute_force, 5},
-    {"_rnndescent_rnn_brute_force_query", (DL_FUNC) &_rnndescent_rnn_brute_force_query, 6},
+    {"_rnndescent_rnn_brute_force", (DL_FUNC) &_rnndescent_rnn_brute_force, 7},
+    {"_rnndescent_rnn_brute_force_query", (DL_FUNC) &_rnndescent_rnn_brute_force_query, 9},
+    {"_rnndescent_rnn_sparse_brute_force", (DL_FUNC) &_rnndescent_rnn_sparse_brute_force, 6},
+    {"_rnndescent_rnn_sparse_brute_force_query", (DL_FUNC) &_rnndescent_rnn_sparse_brute_force_query, 7},
+    {"_rnndescent_rnn_delete_repair", (DL_FUNC) &_rnndescent_rnn_delete_repair, 7},
+    {"_rnndescent_nnd_worker_create", (DL_FUNC) &_rnndescent_nnd_worker_create, 8},
+    {"_rnndescent_nnd_worker_bounds", (DL_FUNC) &_rnndescent_nnd_worker_bounds, 1},
+    {"_rnndescent_nnd_worker_candidates", (DL_FUNC) &_rnndescent_nnd_worker_candidates, 2},
+    {"_rnndescent_nnd_worker_requests", (DL_FUNC) &_rnndescent_nnd_worker_requests, 2},
+    {"_rnndescent_nnd_worker_rows", (DL_FUNC) &_rnndescent_nnd_worker_rows, 2},
+    {"_rnndescent_nnd_worker_join", (DL_FUNC) &_rnndescent_nnd_worker_join, 3},
+    {"_rnndescent_nnd_worker_apply", (DL_FUNC) &_rnndescent_nnd_worker_apply, 2},
+    {"_rnndescent_nnd_worker_graph", (DL_FUNC) &_rnndescent_nnd_worker_graph, 1},
     {"_rnndescent_reverse_nbr_size_impl", (DL_FUNC) &_rnndescent_reverse_nbr_size_impl, 4},
     {"_rnndescent_rnn_idx_to_graph_self", (DL_FUNC) &_rnndescent_rnn_idx_to_graph_self, 5},
     {"_rnndescent_rnn_idx_to_graph_query", (DL_FUNC) &_rnndescent_rnn_idx_to_graph_query, 6},
+    {"_rnndescent_rnn_sparse_idx_to_graph_self", (DL_FUNC) &_rnndescent_rnn_sparse_idx_to_graph_self, 5},
+    {"_rnndescent_rnn_sparse_idx_to_graph_query", (DL_FUNC) &_rnndescent_rnn_sparse_idx_to_graph_query, 6},
     {"_rnndescent_merge_nn", (DL_FUNC) &_rnndescent_merge_nn, 7},
     {"_rnndescent_merge_nn_all", (DL_FUNC) &_rnndescent_merge_nn_all, 4},
-    {"_rnndescent_nn_descent", (DL_FUNC) &_rnndescent_nn_descent, 11},
+    {"_rnndescent_nn_descent", (DL_FUNC) &_rnndescent_nn_descent, 21},
+    {"_rnndescent_sparse_nn_descent", (DL_FUNC) &_rnndescent_sparse_nn_descent, 21},
+    {"_rnndescent_nn_descent_checkpoint_info", (DL_FUNC) &_rnndescent_nn_descent_checkpoint_info, 1},
+    {"_rnndescent_nn_descent_insert", (DL_FUNC) &_rnndescent_nn_descent_insert, 11},
+    {"_rnndescent_nn_descent_refine", (DL_FUNC) &_rnndescent_nn_descent_refine, 11},
+    {"_rnndescent_pq_encode_cpp", (DL_FUNC) &_rnndescent_pq_encode_cpp, 6},
+    {"_rnndescent_pq_query_cpp", (DL_FUNC) &_rnndescent_pq_query_cpp, 11},
     {"_rnndescent_diversify_cpp", (DL_FUNC) &_rnndescent_diversify_cpp, 5},
     {"_rnndescent_merge_graph_lists_cpp", (DL_FUNC) &_rnndescent_merge_graph_lists_cpp, 2},
     {"_rnndescent_degree_prune_cpp", (DL_FUNC) &_rnndescent_degree_prune_cpp, 3},
     {"_rnndescent_random_knn_cpp", (DL_FUNC) &_rnndescent_random_knn_cpp, 6},
     {"_rnndescent_random_knn_query_cpp", (DL_FUNC) &_rnndescent_random_knn_query_cpp, 7},
-    {"_rnndescent_nn_query", (DL_FUNC) &_rnndescent_nn_query, 9},
+    {"_rnndescent_sparse_random_knn_cpp", (DL_FUNC) &_rnndescent_sparse_random_knn_cpp, 6},
+    {"_rnndescent_sparse_random_knn_query_cpp", (DL_FUNC) &_rnndescent_sparse_random_knn_query_cpp, 7},
+    {"_rnndescent_bfs_reorder_cpp", (DL_FUNC) &_rnndescent_bfs_reorder_cpp, 1},
+    {"_rnndescent_nn_query", (DL_FUNC) &_rnndescent_nn_query, 13},
+    {"_rnndescent_sparse_nn_query", (DL_FUNC) &_rnndescent_sparse_nn_query, 13},
+    {"_rnndescent_rnn_tree_knn_query", (DL_FUNC) &_rnndescent_rnn_tree_knn_query, 7},
+    {"_rnndescent_rnn_tree_knn", (DL_FUNC) &_rnndescent_rnn_tree_knn, 6},
     {NULL, NULL, 0}
 };
 
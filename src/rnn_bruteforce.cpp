@@ -30,31 +30,103 @@
 using namespace Rcpp;
 
 #define BRUTE_FORCE_BUILD()                                                    \
-  return bf_build_impl<Distance>(data, k, n_threads, verbose);
+  return bf_build_impl<Distance, NbrHeap, Data>(data, k, n_threads, verbose);
+
+#define BRUTE_FORCE_BUILD_HEAP()                                               \
+  DISPATCH_ON_K(tdoann::FixedNNHeap, tdoann::NNHeap, BRUTE_FORCE_BUILD)
+
+#define BRUTE_FORCE_BUILD_HALF()                                               \
+  using NbrHeap = tdoann::NNHeap<Distance::Output, Distance::Index>;           \
+  BRUTE_FORCE_BUILD()
 
 #define BRUTE_FORCE_QUERY()                                                    \
-  return bf_query_impl<Distance>(reference, query, k, n_threads, verbose);
+  return bf_query_impl<Distance, NbrHeap, Data>(reference, query, k,           \
+                                                n_threads, verbose);
+
+#define BRUTE_FORCE_QUERY_HEAP()                                               \
+  DISPATCH_ON_K(tdoann::FixedNNHeap, tdoann::NNHeap, BRUTE_FORCE_QUERY)
+
+#define BRUTE_FORCE_QUERY_HALF()                                               \
+  using NbrHeap = tdoann::NNHeap<Distance::Output, Distance::Index>;           \
+  BRUTE_FORCE_QUERY()
+
+// Euclidean-type distances use the origin as their first pivot, so the
+// reference items are sorted by their norm. Cosine distances are bounded via
+// the Euclidean distances between the normalized items, so only reference
+// items are used as pivots
+#define DISPATCH_ON_PIVOT_DISTANCES(NEXT_MACRO)                                \
+  if (metric == "euclidean") {                                                 \
+    using Distance = tdoann::Euclidean<float, float>;                          \
+    using Bound = tdoann::EuclideanBound<float>;                               \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "l2sqr") {                                              \
+    using Distance = tdoann::L2Sqr<float, float>;                              \
+    using Bound = tdoann::L2SqrBound<float>;                                   \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "manhattan") {                                          \
+    using Distance = tdoann::Manhattan<float, float>;                          \
+    using Bound = tdoann::EuclideanBound<float>;                               \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "cosine") {                                             \
+    using Distance = tdoann::CosineQuery<float, float>;                        \
+    using Bound = tdoann::CosineBound<float>;                                  \
+    NEXT_MACRO()                                                               \
+  } else {                                                                     \
+    Rcpp::stop("Bad metric for pivots: " + metric);                            \
+  }
+
+#define BRUTE_FORCE_PIVOT_QUERY()                                              \
+  return bf_pivot_query_impl<Distance, Bound, NbrHeap>(                        \
+      reference, query, k, n_pivots, metric == "cosine", n_threads, verbose);
 
-template <typename Distance>
-auto bf_query_impl(NumericMatrix reference, NumericMatrix query,
-                   typename Distance::Index k, std::size_t n_threads = 0,
-                   bool verbose = false) -> List {
-  auto ref_vec = r_to_dist_vect<Distance>(reference);
-  auto query_vec = r_to_dist_vect<Distance>(query);
+#define BRUTE_FORCE_PIVOT_QUERY_HEAP()                                         \
+  DISPATCH_ON_K(tdoann::FixedNNHeap, tdoann::NNHeap, BRUTE_FORCE_PIVOT_QUERY)
 
-  auto nn_graph = tdoann::brute_force_query<Distance, RPProgress, RParallel>(
-      ref_vec, reference.ncol(), query_vec, k, n_threads, verbose);
+template <typename Distance, typename Bound, typename NbrHeap>
+auto bf_pivot_query_impl(NumericMatrix reference, NumericMatrix query,
+                         typename Distance::Index k, std::size_t n_pivots,
+                         bool normalize, std::size_t n_threads = 0,
+                         bool verbose = false) -> List {
+  auto distance = r_to_dist<Distance>(reference, query);
+
+  auto ref_vec = r_to_vect<float>(reference);
+  auto query_vec = r_to_vect<float>(query);
+  const std::size_t ndim = reference.ncol();
+  if (normalize) {
+    ref_vec = tdoann::normalize(ref_vec, ndim);
+    query_vec = tdoann::normalize(query_vec, ndim);
+  }
+  tdoann::PivotBounds<typename Distance::Index> bounds(
+      ref_vec, query_vec, ndim, n_pivots, !normalize);
+
+  auto nn_graph =
+      tdoann::brute_force_query<Distance, Bound, RPProgress, RParallel,
+                                NbrHeap>(distance, bounds, k, n_threads,
+                                         verbose);
 
   return graph_to_r(nn_graph);
 }
 
-template <typename Distance>
-auto bf_build_impl(NumericMatrix data, typename Distance::Index k,
+template <typename Distance, typename NbrHeap, typename Data>
+auto bf_query_impl(Data reference, Data query, typename Distance::Index k,
                    std::size_t n_threads = 0, bool verbose = false) -> List {
-  auto data_vec = r_to_dist_vect<Distance>(data);
+  auto distance = r_to_dist<Distance>(reference, query);
 
-  auto nn_graph = tdoann::brute_force_build<Distance, RPProgress, RParallel>(
-      data_vec, data.ncol(), k, n_threads, verbose);
+  auto nn_graph =
+      tdoann::brute_force_query<Distance, RPProgress, RParallel, NbrHeap>(
+          distance, k, n_threads, verbose);
+
+  return graph_to_r(nn_graph);
+}
+
+template <typename Distance, typename NbrHeap, typename Data>
+auto bf_build_impl(Data data, typename Distance::Index k,
+                   std::size_t n_threads = 0, bool verbose = false) -> List {
+  auto distance = r_to_dist<Distance>(data);
+
+  auto nn_graph =
+      tdoann::brute_force_build<Distance, RPProgress, RParallel, NbrHeap>(
+          distance, k, n_threads, verbose);
 
   return graph_to_r(nn_graph);
 }
@@ -62,12 +134,49 @@ auto bf_build_impl(NumericMatrix data, typename Distance::Index k,
 // [[Rcpp::export]]
 List rnn_brute_force(NumericMatrix data, uint32_t k,
                      const std::string &metric = "euclidean",
-                     std::size_t n_threads = 0, bool verbose = false){
-    DISPATCH_ON_DISTANCES(BRUTE_FORCE_BUILD)}
+                     std::size_t n_threads = 0, bool verbose = false,
+                     const std::string &precision = "float",
+                     const std::string &layout = "row") {
+  using Data = NumericMatrix;
+  if (layout == "blocked") {
+    DISPATCH_ON_BLOCKED_PRECISION(BRUTE_FORCE_BUILD_HEAP)
+  } else {
+    DISPATCH_ON_PRECISION(BRUTE_FORCE_BUILD_HEAP, BRUTE_FORCE_BUILD_HALF)
+  }
+}
 
 // [[Rcpp::export]]
 List rnn_brute_force_query(NumericMatrix reference, NumericMatrix query,
                            uint32_t k, const std::string &metric = "euclidean",
-                           std::size_t n_threads = 0, bool verbose = false) {
-  DISPATCH_ON_QUERY_DISTANCES(BRUTE_FORCE_QUERY)
+                           std::size_t n_threads = 0, bool verbose = false,
+                           const std::string &precision = "float",
+                           const std::string &layout = "row",
+                           std::size_t n_pivots = 0) {
+  using Data = NumericMatrix;
+  if (n_pivots > 0) {
+    DISPATCH_ON_PIVOT_DISTANCES(BRUTE_FORCE_PIVOT_QUERY_HEAP)
+  } else if (layout == "blocked") {
+    DISPATCH_ON_BLOCKED_PRECISION(BRUTE_FORCE_QUERY_HEAP)
+  } else {
+    DISPATCH_ON_QUERY_PRECISION(BRUTE_FORCE_QUERY_HEAP, BRUTE_FORCE_QUERY_HALF)
+  }
+}
+
+// [[Rcpp::export]]
+List rnn_sparse_brute_force(List data, uint32_t k,
+                            const std::string &metric = "euclidean",
+                            std::size_t n_threads = 0, bool verbose = false,
+                            const std::string &precision = "float") {
+  using Data = RSparseData;
+  DISPATCH_ON_SPARSE_PRECISION(BRUTE_FORCE_BUILD_HEAP)
+}
+
+// [[Rcpp::export]]
+List rnn_sparse_brute_force_query(List reference, List query, uint32_t k,
+                                  const std::string &metric = "euclidean",
+                                  std::size_t n_threads = 0,
+                                  bool verbose = false,
+                                  const std::string &precision = "float") {
+  using Data = RSparseData;
+  DISPATCH_ON_SPARSE_PRECISION(BRUTE_FORCE_QUERY_HEAP)
 }
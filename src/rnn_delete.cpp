@@ -0,0 +1,105 @@
+//  rnndescent -- An R package for nearest neighbor descent
+//
+//  Copyright (C) 2021 James Melville
+//
+//  This file is part of rnndescent
+//
+//  rnndescent is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  rnndescent is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with rnndescent.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <Rcpp.h>
+
+#include "tdoann/tombstones.h"
+
+#include "rnn_distance.h"
+#include "rnn_macros.h"
+#include "rnn_parallel.h"
+#include "rnn_rtoheap.h"
+#include "rnn_util.h"
+
+using namespace Rcpp;
+
+#define DELETE_REPAIR_IMPL()                                                   \
+  return delete_repair_impl<Distance>(data, nn_idx, nn_dist, deleted,          \
+                                      compact_threshold, n_threads);
+
+// Neighbors which are missing because their row couldn't be refilled are NA
+template <typename NNGraph>
+auto deleted_graph_to_r(const NNGraph &graph) -> List {
+  const std::size_t n_points = graph.n_points;
+  const std::size_t n_nbrs = graph.n_nbrs;
+  IntegerMatrix nn_idx(n_points, n_nbrs);
+  NumericMatrix nn_dist(n_points, n_nbrs);
+  LogicalVector deleted(n_points);
+  for (std::size_t i = 0; i < n_points; i++) {
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      const std::size_t ij = i * n_nbrs + j;
+      if (graph.idx[ij] == graph.npos()) {
+        nn_idx(i, j) = NA_INTEGER;
+        nn_dist(i, j) = NA_REAL;
+      } else {
+        nn_idx(i, j) = graph.idx[ij] + 1;
+        nn_dist(i, j) = graph.dist[ij];
+      }
+    }
+    deleted[i] = graph.tombstones.is_deleted(i);
+  }
+  return List::create(_("idx") = nn_idx, _("dist") = nn_dist,
+                      _("deleted") = deleted);
+}
+
+template <typename Distance>
+auto delete_repair_impl(NumericMatrix data, IntegerMatrix nn_idx,
+                        NumericMatrix nn_dist, IntegerVector deleted,
+                        double compact_threshold, std::size_t n_threads)
+    -> List {
+  using NbrHeap =
+      tdoann::NNHeap<typename Distance::Output, typename Distance::Index>;
+  const std::size_t block_size = 1024;
+  // a graph from an earlier deletion can have missing neighbors (NA) where a
+  // row couldn't be refilled
+  auto nn_heap = r_to_heap_missing_ok<tdoann::HeapAddQuery, NbrHeap>(
+      nn_idx, nn_dist, block_size, data.nrow() - 1);
+  auto distance = r_to_dist<Distance>(data);
+  auto tombstones = r_to_tombstones(deleted, data.nrow());
+
+  auto repaired = n_threads > 0
+                      ? tdoann::repair_deleted<RParallel>(
+                            nn_heap, distance, tombstones, n_threads)
+                      : tdoann::repair_deleted(nn_heap, distance, tombstones);
+  if (n_threads > 0) {
+    tdoann::sort_heap<NbrHeap, RParallel>(repaired, n_threads);
+  } else {
+    tdoann::sort_heap(repaired);
+  }
+  auto graph = tdoann::heap_to_graph(repaired);
+  graph.tombstones = tombstones;
+
+  if (tombstones.n_deleted <= compact_threshold * graph.n_points) {
+    return deleted_graph_to_r(graph);
+  }
+  std::vector<typename Distance::Index> kept;
+  auto result = deleted_graph_to_r(tdoann::compact_deleted(graph, kept));
+  IntegerVector kept1(kept.begin(), kept.end());
+  result.push_back(kept1 + 1, "kept");
+  return result;
+}
+
+// [[Rcpp::export]]
+List rnn_delete_repair(NumericMatrix data, IntegerMatrix nn_idx,
+                       NumericMatrix nn_dist, IntegerVector deleted,
+                       double compact_threshold = 1.0,
+                       const std::string &metric = "euclidean",
+                       std::size_t n_threads = 0) {
+  DISPATCH_ON_DISTANCES(DELETE_REPAIR_IMPL)
+}
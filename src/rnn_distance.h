@@ -23,9 +23,30 @@
 #include <Rcpp.h>
 
 #include "tdoann/distance.h"
+#include "tdoann/sparse.h"
 
 #include "rnn_util.h"
 
+// Rcpp can't convert to the 16-bit floating point types, so each element is
+// rounded from double separately
+template <typename T>
+auto r_to_half_vect(Rcpp::NumericMatrix data) -> std::vector<T> {
+  Rcpp::NumericMatrix tdata = Rcpp::transpose(data);
+  return std::vector<T>(tdata.begin(), tdata.end());
+}
+
+template <>
+inline auto r_to_vect<tdoann::Float16>(Rcpp::NumericMatrix data)
+    -> std::vector<tdoann::Float16> {
+  return r_to_half_vect<tdoann::Float16>(data);
+}
+
+template <>
+inline auto r_to_vect<tdoann::BFloat16>(Rcpp::NumericMatrix data)
+    -> std::vector<tdoann::BFloat16> {
+  return r_to_half_vect<tdoann::BFloat16>(data);
+}
+
 template <typename Distance>
 auto r_to_dist_vect(Rcpp::NumericMatrix data)
     -> std::vector<typename Distance::Input> {
@@ -46,4 +67,44 @@ auto r_to_dist(Rcpp::NumericMatrix data) -> Distance {
   return Distance(data_vec, data.ncol());
 }
 
+// Sparse data in compressed sparse row format, passed from R as a list
+// containing the zero-based column indices (ind) and row pointers (ptr) of the
+// non-zero values (x), and the number of columns (ndim)
+struct RSparseData {
+  Rcpp::IntegerVector ind;
+  Rcpp::IntegerVector ptr;
+  Rcpp::NumericVector x;
+  std::size_t ndim;
+
+  RSparseData(Rcpp::List data)
+      : ind(Rcpp::as<Rcpp::IntegerVector>(data["ind"])),
+        ptr(Rcpp::as<Rcpp::IntegerVector>(data["ptr"])),
+        x(Rcpp::as<Rcpp::NumericVector>(data["x"])),
+        ndim(Rcpp::as<std::size_t>(data["ndim"])) {}
+
+  auto nrow() const -> int { return ptr.size() - 1; }
+  auto ncol() const -> int { return ndim; }
+};
+
+template <typename In>
+auto r_to_sparse(const RSparseData &data) -> tdoann::SparseData<In> {
+  return tdoann::SparseData<In>(Rcpp::as<std::vector<uint32_t>>(data.ind),
+                                Rcpp::as<std::vector<std::size_t>>(data.ptr),
+                                Rcpp::as<std::vector<In>>(data.x));
+}
+
+template <typename Distance>
+auto r_to_dist(const RSparseData &reference, const RSparseData &query)
+    -> Distance {
+  auto ref_sparse = r_to_sparse<typename Distance::Input>(reference);
+  auto query_sparse = r_to_sparse<typename Distance::Input>(query);
+  return Distance(ref_sparse, query_sparse, reference.ndim);
+}
+
+template <typename Distance>
+auto r_to_dist(const RSparseData &data) -> Distance {
+  auto data_sparse = r_to_sparse<typename Distance::Input>(data);
+  return Distance(data_sparse, data.ndim);
+}
+
 #endif // RNN_DISTANCE_H
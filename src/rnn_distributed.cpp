@@ -0,0 +1,294 @@
+//  rnndescent -- An R package for nearest neighbor descent
+//
+//  Copyright (C) 2021 James Melville
+//
+//  This file is part of rnndescent
+//
+//  rnndescent is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  rnndescent is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with rnndescent.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <limits>
+#include <memory>
+
+#include <Rcpp.h>
+
+#include "tdoann/nnddistributed.h"
+
+#include "rnn_distance.h"
+#include "rnn_heaptor.h"
+#include "rnn_macros.h"
+#include "rnn_rng.h"
+
+using namespace Rcpp;
+
+// The state of one worker in distributed nearest neighbor descent, held by R
+// as an external pointer between the steps of each iteration. The messages
+// between workers are R lists of vectors and matrices, with zero-based
+// indices, so they can be sent between processes by whatever means the R code
+// uses.
+struct RNNDWorker {
+  virtual ~RNNDWorker() = default;
+  virtual auto bounds() -> NumericVector = 0;
+  virtual auto candidates(uint64_t seed) -> List = 0;
+  virtual auto requests(List inbox) -> List = 0;
+  virtual auto rows(List inbox) -> List = 0;
+  virtual auto join(List inbox, NumericVector bounds) -> List = 0;
+  virtual auto apply(List inbox) -> std::size_t = 0;
+  virtual auto graph() -> List = 0;
+};
+
+template <typename Distance> struct RNNDWorkerImpl : public RNNDWorker {
+  using DistIn = typename Distance::Input;
+  using DistOut = typename Distance::Output;
+  using Idx = typename Distance::Index;
+
+  tdoann::NNDWorker<Distance> worker;
+
+  RNNDWorkerImpl(const std::vector<DistIn> &data, std::size_t ndim,
+                 const tdoann::RowPartition &partition, std::size_t w,
+                 std::size_t n_nbrs, std::size_t max_candidates)
+      : worker(data, ndim, partition, w, n_nbrs, max_candidates) {}
+
+  auto bounds() -> NumericVector override {
+    auto max_distances = worker.max_distances();
+    return NumericVector(max_distances.begin(), max_distances.end());
+  }
+
+  auto candidates(uint64_t seed) -> List override {
+    auto outbox = worker.candidates(seed);
+    List result(outbox.size());
+    for (std::size_t w = 0; w < outbox.size(); w++) {
+      const auto &msgs = outbox[w];
+      IntegerVector row(msgs.size());
+      IntegerVector nbr(msgs.size());
+      NumericVector priority(msgs.size());
+      IntegerVector flag(msgs.size());
+      for (std::size_t i = 0; i < msgs.size(); i++) {
+        row[i] = msgs[i].row;
+        nbr[i] = msgs[i].nbr;
+        priority[i] = msgs[i].priority;
+        flag[i] = msgs[i].flag;
+      }
+      result[w] = List::create(_("row") = row, _("nbr") = nbr,
+                               _("priority") = priority, _("flag") = flag);
+    }
+    return result;
+  }
+
+  auto requests(List inbox) -> List override {
+    std::vector<tdoann::CandidateMessage<Idx>> candidates;
+    for (R_xlen_t w = 0; w < inbox.size(); w++) {
+      List msgs = inbox[w];
+      IntegerVector row = msgs["row"];
+      IntegerVector nbr = msgs["nbr"];
+      NumericVector priority = msgs["priority"];
+      IntegerVector flag = msgs["flag"];
+      for (R_xlen_t i = 0; i < row.size(); i++) {
+        check_owned(row[i]);
+        check_index(nbr[i]);
+        candidates.emplace_back(row[i], nbr[i], priority[i], flag[i]);
+      }
+    }
+
+    auto outbox = worker.requests(candidates);
+    List result(outbox.size());
+    for (std::size_t w = 0; w < outbox.size(); w++) {
+      result[w] = IntegerVector(outbox[w].begin(), outbox[w].end());
+    }
+    return result;
+  }
+
+  // the rows of the data requested by each worker, one row per index
+  auto rows(List inbox) -> List override {
+    List result(inbox.size());
+    for (R_xlen_t w = 0; w < inbox.size(); w++) {
+      IntegerVector ids = inbox[w];
+      std::vector<Idx> owned_ids;
+      owned_ids.reserve(ids.size());
+      for (R_xlen_t i = 0; i < ids.size(); i++) {
+        check_owned(ids[i]);
+        owned_ids.push_back(ids[i]);
+      }
+      auto data = worker.rows(owned_ids);
+      NumericMatrix rows(worker.ndim, owned_ids.size(), data.begin());
+      result[w] = transpose(rows);
+    }
+    return result;
+  }
+
+  auto join(List inbox, NumericVector bounds) -> List override {
+    if (static_cast<std::size_t>(bounds.size()) != worker.bounds.size()) {
+      stop("Bad number of distance bounds");
+    }
+    for (std::size_t i = 0; i < worker.bounds.size(); i++) {
+      worker.bounds[i] = to_dist_out(bounds[i]);
+    }
+    std::vector<std::vector<DistIn>> received;
+    received.reserve(inbox.size());
+    for (R_xlen_t w = 0; w < inbox.size(); w++) {
+      NumericMatrix rows = inbox[w];
+      if (rows.nrow() > 0 &&
+          static_cast<std::size_t>(rows.ncol()) != worker.ndim) {
+        stop("Worker received rows with the wrong number of columns");
+      }
+      received.push_back(r_to_dist_vect<Distance>(rows));
+    }
+
+    auto outbox = worker.join(received);
+    List result(outbox.size());
+    for (std::size_t w = 0; w < outbox.size(); w++) {
+      const auto &updates = outbox[w];
+      IntegerVector p(updates.size());
+      IntegerVector q(updates.size());
+      NumericVector d(updates.size());
+      for (std::size_t i = 0; i < updates.size(); i++) {
+        p[i] = updates[i].p;
+        q[i] = updates[i].q;
+        d[i] = updates[i].d;
+      }
+      result[w] = List::create(_("p") = p, _("q") = q, _("d") = d);
+    }
+    return result;
+  }
+
+  auto apply(List inbox) -> std::size_t override {
+    std::size_t c = 0;
+    for (R_xlen_t w = 0; w < inbox.size(); w++) {
+      List msgs = inbox[w];
+      IntegerVector p = msgs["p"];
+      IntegerVector q = msgs["q"];
+      NumericVector d = msgs["d"];
+      std::vector<typename tdoann::NNDWorker<Distance>::Update> updates;
+      updates.reserve(p.size());
+      for (R_xlen_t i = 0; i < p.size(); i++) {
+        check_index(p[i]);
+        check_index(q[i]);
+        updates.emplace_back(p[i], q[i], to_dist_out(d[i]));
+      }
+      c += worker.apply(updates);
+    }
+    return c;
+  }
+
+  auto graph() -> List override {
+    auto heap = worker.current_graph;
+    return heap_to_r(heap);
+  }
+
+  void check_index(int i) const {
+    if (i < 0 || static_cast<std::size_t>(i) >= worker.partition.n_points) {
+      stop("Worker received a message with bad index " + std::to_string(i));
+    }
+  }
+
+  void check_owned(int i) const {
+    check_index(i);
+    if (!worker.owns(i)) {
+      stop("Worker received a message for row " + std::to_string(i) +
+           " which it does not own");
+    }
+  }
+
+  // the bound of a row which isn't full is the largest value of DistOut,
+  // which may not survive the round trip through a double
+  static auto to_dist_out(double d) -> DistOut {
+    const auto dmax = (std::numeric_limits<DistOut>::max)();
+    return d >= static_cast<double>(dmax) ? dmax : static_cast<DistOut>(d);
+  }
+};
+
+#define NND_WORKER_CREATE()                                                    \
+  return nnd_worker_create_impl<Distance>(data, nn_idx, nn_dist, n_points,     \
+                                          n_workers, worker, max_candidates);
+
+template <typename Distance>
+auto nnd_worker_create_impl(NumericMatrix data, IntegerMatrix nn_idx,
+                            NumericMatrix nn_dist, std::size_t n_points,
+                            std::size_t n_workers, std::size_t worker,
+                            std::size_t max_candidates) -> SEXP {
+  tdoann::RowPartition partition(n_points, n_workers);
+  const std::size_t n_rows = partition.end(worker) - partition.begin(worker);
+  if (static_cast<std::size_t>(data.nrow()) != n_rows ||
+      static_cast<std::size_t>(nn_idx.nrow()) != n_rows) {
+    stop("Worker " + std::to_string(worker + 1) + " should have " +
+         std::to_string(n_rows) + " rows of the data and the graph");
+  }
+
+  auto data_vec = r_to_dist_vect<Distance>(data);
+  std::unique_ptr<RNNDWorkerImpl<Distance>> impl(
+      new RNNDWorkerImpl<Distance>(data_vec, data.ncol(), partition, worker,
+                                   nn_idx.ncol(), max_candidates));
+  auto &current_graph = impl->worker.current_graph;
+  for (std::size_t i = 0; i < n_rows; i++) {
+    for (int j = 0; j < nn_idx.ncol(); j++) {
+      const int idx = nn_idx(i, j) - 1;
+      if (idx < 0 || static_cast<std::size_t>(idx) >= n_points) {
+        stop("Bad neighbor index: " + std::to_string(idx + 1));
+      }
+      current_graph.checked_push(i, nn_dist(i, j), idx);
+    }
+  }
+  return XPtr<RNNDWorker>(impl.release(), true);
+}
+
+// worker is 1-indexed, data contains only the rows owned by the worker, and
+// nn_idx and nn_dist are the same rows of the graph
+// [[Rcpp::export]]
+SEXP nnd_worker_create(NumericMatrix data, IntegerMatrix nn_idx,
+                       NumericMatrix nn_dist, const std::string &metric,
+                       std::size_t n_points, std::size_t n_workers,
+                       std::size_t worker, std::size_t max_candidates = 50) {
+  if (worker < 1 || worker > n_workers) {
+    stop("Bad worker index");
+  }
+  worker -= 1;
+  DISPATCH_ON_DISTANCES(NND_WORKER_CREATE);
+}
+
+// [[Rcpp::export]]
+NumericVector nnd_worker_bounds(SEXP worker) {
+  return XPtr<RNNDWorker>(worker)->bounds();
+}
+
+// [[Rcpp::export]]
+List nnd_worker_candidates(SEXP worker, IntegerVector seed) {
+  if (seed.size() != 2) {
+    stop("seed must contain two integers");
+  }
+  return XPtr<RNNDWorker>(worker)->candidates(combine_seeds(seed[0], seed[1]));
+}
+
+// [[Rcpp::export]]
+List nnd_worker_requests(SEXP worker, List inbox) {
+  return XPtr<RNNDWorker>(worker)->requests(inbox);
+}
+
+// [[Rcpp::export]]
+List nnd_worker_rows(SEXP worker, List inbox) {
+  return XPtr<RNNDWorker>(worker)->rows(inbox);
+}
+
+// [[Rcpp::export]]
+List nnd_worker_join(SEXP worker, List inbox, NumericVector bounds) {
+  return XPtr<RNNDWorker>(worker)->join(inbox, bounds);
+}
+
+// [[Rcpp::export]]
+double nnd_worker_apply(SEXP worker, List inbox) {
+  return static_cast<double>(XPtr<RNNDWorker>(worker)->apply(inbox));
+}
+
+// [[Rcpp::export]]
+List nnd_worker_graph(SEXP worker) {
+  return XPtr<RNNDWorker>(worker)->graph();
+}
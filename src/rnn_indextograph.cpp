@@ -29,18 +29,19 @@
 using namespace Rcpp;
 
 #define IDX_TO_GRAPH_SELF()                                                    \
-  auto distance = r_to_dist<Distance>(data);                                   \
+  auto distance = r_to_dist<Distance>(Data(data));                             \
   return idx_to_graph_impl(distance, idx, n_threads, verbose);
 
 #define IDX_TO_GRAPH_QUERY()                                                   \
-  auto distance = r_to_dist<Distance>(reference, query);                       \
+  auto distance = r_to_dist<Distance>(Data(reference), Data(query));           \
   return idx_to_graph_impl<Distance>(distance, idx, n_threads, verbose);
 
 template <typename Distance>
 auto idx_to_graph_impl(const Distance &distance, IntegerMatrix idx,
                        std::size_t n_threads = 0, bool verbose = false)
     -> List {
-  auto idx_vec = r_to_idxt<typename Distance::Index>(idx);
+  auto idx_vec = r_to_idxt<typename Distance::Index>(
+      idx, static_cast<int>(distance.nx) - 1);
   if (n_threads > 0) {
     auto nn_graph = tdoann::idx_to_graph<Distance, RPProgress, RParallel>(
         distance, idx_vec, n_threads, verbose);
@@ -55,13 +56,35 @@ auto idx_to_graph_impl(const Distance &distance, IntegerMatrix idx,
 // [[Rcpp::export]]
 List rnn_idx_to_graph_self(NumericMatrix data, IntegerMatrix idx,
                            const std::string &metric = "euclidean",
-                           std::size_t n_threads = 0, bool verbose = false){
-    DISPATCH_ON_DISTANCES(IDX_TO_GRAPH_SELF)}
+                           std::size_t n_threads = 0, bool verbose = false) {
+  using Data = NumericMatrix;
+  DISPATCH_ON_DISTANCES(IDX_TO_GRAPH_SELF)
+}
 
 // [[Rcpp::export]]
 List rnn_idx_to_graph_query(NumericMatrix reference, NumericMatrix query,
                             IntegerMatrix idx,
                             const std::string &metric = "euclidean",
                             std::size_t n_threads = 0, bool verbose = false) {
+  using Data = NumericMatrix;
   DISPATCH_ON_QUERY_DISTANCES(IDX_TO_GRAPH_QUERY)
 }
+
+// [[Rcpp::export]]
+List rnn_sparse_idx_to_graph_self(List data, IntegerMatrix idx,
+                                  const std::string &metric = "euclidean",
+                                  std::size_t n_threads = 0,
+                                  bool verbose = false) {
+  using Data = RSparseData;
+  DISPATCH_ON_SPARSE_DISTANCES(IDX_TO_GRAPH_SELF)
+}
+
+// [[Rcpp::export]]
+List rnn_sparse_idx_to_graph_query(List reference, List query,
+                                   IntegerMatrix idx,
+                                   const std::string &metric = "euclidean",
+                                   std::size_t n_threads = 0,
+                                   bool verbose = false) {
+  using Data = RSparseData;
+  DISPATCH_ON_SPARSE_DISTANCES(IDX_TO_GRAPH_QUERY)
+}
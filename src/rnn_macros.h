@@ -22,7 +22,11 @@
 
 #include <Rcpp.h>
 
+#include "tdoann/blocked.h"
 #include "tdoann/distance.h"
+#include "tdoann/fixedheap.h"
+#include "tdoann/heap.h"
+#include "tdoann/sparse.h"
 
 #define DISPATCH_ON_DISTANCES(NEXT_MACRO)                                      \
   if (metric == "euclidean") {                                                 \
@@ -37,6 +41,12 @@
   } else if (metric == "manhattan") {                                          \
     using Distance = tdoann::Manhattan<float, float>;                          \
     NEXT_MACRO()                                                               \
+  } else if (metric == "correlation") {                                        \
+    using Distance = tdoann::CorrelationSelf<float, float>;                    \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "inner_product") {                                      \
+    using Distance = tdoann::InnerProduct<float, float>;                       \
+    NEXT_MACRO()                                                               \
   } else if (metric == "hamming") {                                            \
     using Distance = tdoann::HammingSelf<uint8_t, std::size_t>;                \
     NEXT_MACRO()                                                               \
@@ -44,6 +54,8 @@
     Rcpp::stop("Bad metric");                                                  \
   }
 
+// "inner_product_l2" is the inner product reduced to a squared Euclidean
+// distance, for graph search, which needs a non-negative distance
 #define DISPATCH_ON_QUERY_DISTANCES(NEXT_MACRO)                                \
   if (metric == "euclidean") {                                                 \
     using Distance = tdoann::Euclidean<float, float>;                          \
@@ -57,6 +69,15 @@
   } else if (metric == "manhattan") {                                          \
     using Distance = tdoann::Manhattan<float, float>;                          \
     NEXT_MACRO()                                                               \
+  } else if (metric == "correlation") {                                        \
+    using Distance = tdoann::CorrelationQuery<float, float>;                   \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "inner_product") {                                      \
+    using Distance = tdoann::InnerProduct<float, float>;                       \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "inner_product_l2") {                                   \
+    using Distance = tdoann::InnerProductL2<float, float>;                     \
+    NEXT_MACRO()                                                               \
   } else if (metric == "hamming") {                                            \
     using Distance = tdoann::HammingQuery<uint8_t, std::size_t>;               \
     NEXT_MACRO()                                                               \
@@ -64,4 +85,208 @@
     Rcpp::stop("Bad metric");                                                  \
   }
 
+// Store the data in a 16-bit floating point type (IN) for the metrics which
+// support it: distances are still calculated in float
+#define DISPATCH_ON_HALF_DISTANCES(IN, NEXT_MACRO)                             \
+  if (metric == "euclidean") {                                                 \
+    using Distance = tdoann::Euclidean<IN, float>;                             \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "l2sqr") {                                              \
+    using Distance = tdoann::L2Sqr<IN, float>;                                 \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "cosine") {                                             \
+    using Distance = tdoann::CosineSelf<IN, float>;                            \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "manhattan") {                                          \
+    using Distance = tdoann::Manhattan<IN, float>;                             \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "correlation") {                                        \
+    using Distance = tdoann::CorrelationSelf<IN, float>;                       \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "inner_product") {                                      \
+    using Distance = tdoann::InnerProduct<IN, float>;                          \
+    NEXT_MACRO()                                                               \
+  } else {                                                                     \
+    Rcpp::stop("Bad metric for half precision: " + metric);                    \
+  }
+
+#define DISPATCH_ON_HALF_QUERY_DISTANCES(IN, NEXT_MACRO)                       \
+  if (metric == "euclidean") {                                                 \
+    using Distance = tdoann::Euclidean<IN, float>;                             \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "l2sqr") {                                              \
+    using Distance = tdoann::L2Sqr<IN, float>;                                 \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "cosine") {                                             \
+    using Distance = tdoann::CosineQuery<IN, float>;                           \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "manhattan") {                                          \
+    using Distance = tdoann::Manhattan<IN, float>;                             \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "correlation") {                                        \
+    using Distance = tdoann::CorrelationQuery<IN, float>;                      \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "inner_product") {                                      \
+    using Distance = tdoann::InnerProduct<IN, float>;                          \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "inner_product_l2") {                                   \
+    using Distance = tdoann::InnerProductL2<IN, float>;                        \
+    NEXT_MACRO()                                                               \
+  } else {                                                                     \
+    Rcpp::stop("Bad metric for half precision: " + metric);                    \
+  }
+
+// Choose the storage type of the data from precision. To limit the number of
+// instantiations, the 16-bit types use HALF_NEXT_MACRO, which e.g. need not
+// dispatch on the number of neighbors
+#define DISPATCH_ON_PRECISION(NEXT_MACRO, HALF_NEXT_MACRO)                     \
+  if (precision == "float") {                                                  \
+    DISPATCH_ON_DISTANCES(NEXT_MACRO)                                          \
+  } else if (precision == "float16") {                                         \
+    DISPATCH_ON_HALF_DISTANCES(tdoann::Float16, HALF_NEXT_MACRO)               \
+  } else if (precision == "bfloat16") {                                        \
+    DISPATCH_ON_HALF_DISTANCES(tdoann::BFloat16, HALF_NEXT_MACRO)              \
+  } else {                                                                     \
+    Rcpp::stop("Bad precision: " + precision);                                 \
+  }
+
+#define DISPATCH_ON_QUERY_PRECISION(NEXT_MACRO, HALF_NEXT_MACRO)               \
+  if (precision == "float") {                                                  \
+    DISPATCH_ON_QUERY_DISTANCES(NEXT_MACRO)                                    \
+  } else if (precision == "float16") {                                         \
+    DISPATCH_ON_HALF_QUERY_DISTANCES(tdoann::Float16, HALF_NEXT_MACRO)         \
+  } else if (precision == "bfloat16") {                                        \
+    DISPATCH_ON_HALF_QUERY_DISTANCES(tdoann::BFloat16, HALF_NEXT_MACRO)        \
+  } else {                                                                     \
+    Rcpp::stop("Bad precision: " + precision);                                 \
+  }
+
+// Store the data quantized to one byte per dimension. The neighbors found with
+// these distances must be re-ranked with their exact distances
+#define DISPATCH_ON_QUANTIZED_DISTANCES(NEXT_MACRO)                            \
+  if (metric == "euclidean") {                                                 \
+    using Distance = tdoann::QuantizedEuclidean<float, float>;                 \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "l2sqr") {                                              \
+    using Distance = tdoann::QuantizedL2Sqr<float, float>;                     \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "cosine") {                                             \
+    using Distance = tdoann::QuantizedCosineSelf<float, float>;                \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "manhattan") {                                          \
+    using Distance = tdoann::QuantizedManhattan<float, float>;                 \
+    NEXT_MACRO()                                                               \
+  } else {                                                                     \
+    Rcpp::stop("Bad metric for int8 precision: " + metric);                    \
+  }
+
+#define DISPATCH_ON_QUANTIZED_QUERY_DISTANCES(NEXT_MACRO)                      \
+  if (metric == "euclidean") {                                                 \
+    using Distance = tdoann::QuantizedEuclidean<float, float>;                 \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "l2sqr") {                                              \
+    using Distance = tdoann::QuantizedL2Sqr<float, float>;                     \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "cosine") {                                             \
+    using Distance = tdoann::QuantizedCosineQuery<float, float>;               \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "manhattan") {                                          \
+    using Distance = tdoann::QuantizedManhattan<float, float>;                 \
+    NEXT_MACRO()                                                               \
+  } else {                                                                     \
+    Rcpp::stop("Bad metric for int8 precision: " + metric);                    \
+  }
+
+// DISPATCH_ON_PRECISION, also accepting the "int8" precision, for the callers
+// which re-rank their neighbors with the exact distances
+#define DISPATCH_ON_QUANTIZED_PRECISION(NEXT_MACRO, HALF_NEXT_MACRO)           \
+  if (precision == "int8") {                                                   \
+    DISPATCH_ON_QUANTIZED_DISTANCES(HALF_NEXT_MACRO)                           \
+  } else {                                                                     \
+    DISPATCH_ON_PRECISION(NEXT_MACRO, HALF_NEXT_MACRO)                         \
+  }
+
+#define DISPATCH_ON_QUANTIZED_QUERY_PRECISION(NEXT_MACRO, HALF_NEXT_MACRO)     \
+  if (precision == "int8") {                                                   \
+    DISPATCH_ON_QUANTIZED_QUERY_DISTANCES(HALF_NEXT_MACRO)                     \
+  } else {                                                                     \
+    DISPATCH_ON_QUERY_PRECISION(NEXT_MACRO, HALF_NEXT_MACRO)                   \
+  }
+
+// Sparse data only supports the metrics with a sparse distance. The sparse
+// distances serve both for building and querying
+#define DISPATCH_ON_SPARSE_DISTANCES(NEXT_MACRO)                               \
+  if (metric == "euclidean") {                                                 \
+    using Distance = tdoann::SparseEuclidean<float, float>;                    \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "l2sqr") {                                              \
+    using Distance = tdoann::SparseL2Sqr<float, float>;                        \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "cosine") {                                             \
+    using Distance = tdoann::SparseCosine<float, float>;                       \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "manhattan") {                                          \
+    using Distance = tdoann::SparseManhattan<float, float>;                    \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "jaccard") {                                            \
+    using Distance = tdoann::SparseJaccard<float, float>;                      \
+    NEXT_MACRO()                                                               \
+  } else {                                                                     \
+    Rcpp::stop("Bad metric for sparse data: " + metric);                       \
+  }
+
+#define DISPATCH_ON_SPARSE_PRECISION(NEXT_MACRO)                               \
+  if (precision == "float") {                                                  \
+    DISPATCH_ON_SPARSE_DISTANCES(NEXT_MACRO)                                   \
+  } else {                                                                     \
+    Rcpp::stop("Sparse data requires precision = \"float\"");                  \
+  }
+
+// The data stored in blocks of rows, dimension by dimension, for brute force
+// search. The blocked distances serve both for building and querying
+#define DISPATCH_ON_BLOCKED_DISTANCES(NEXT_MACRO)                              \
+  if (metric == "euclidean") {                                                 \
+    using Distance = tdoann::BlockedEuclidean<float, float>;                   \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "l2sqr") {                                              \
+    using Distance = tdoann::BlockedL2Sqr<float, float>;                       \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "cosine") {                                             \
+    using Distance = tdoann::BlockedCosine<float, float>;                      \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "manhattan") {                                          \
+    using Distance = tdoann::BlockedManhattan<float, float>;                   \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "inner_product") {                                      \
+    using Distance = tdoann::BlockedInnerProduct<float, float>;                \
+    NEXT_MACRO()                                                               \
+  } else {                                                                     \
+    Rcpp::stop("Bad metric for blocked layout: " + metric);                    \
+  }
+
+#define DISPATCH_ON_BLOCKED_PRECISION(NEXT_MACRO)                              \
+  if (precision == "float") {                                                  \
+    DISPATCH_ON_BLOCKED_DISTANCES(NEXT_MACRO)                                  \
+  } else {                                                                     \
+    Rcpp::stop("Blocked layout requires precision = \"float\"");               \
+  }
+
+// Route the most commonly used numbers of neighbors to heaps with the size
+// fixed at compile time, falling back to HEAP otherwise. Requires Distance and
+// k to be in scope
+#define DISPATCH_ON_K(FIXED_HEAP, HEAP, NEXT_MACRO)                            \
+  if (k == 10) {                                                               \
+    using NbrHeap = FIXED_HEAP<Distance::Output, Distance::Index, 10>;         \
+    NEXT_MACRO()                                                               \
+  } else if (k == 15) {                                                        \
+    using NbrHeap = FIXED_HEAP<Distance::Output, Distance::Index, 15>;         \
+    NEXT_MACRO()                                                               \
+  } else if (k == 30) {                                                        \
+    using NbrHeap = FIXED_HEAP<Distance::Output, Distance::Index, 30>;         \
+    NEXT_MACRO()                                                               \
+  } else {                                                                     \
+    using NbrHeap = HEAP<Distance::Output, Distance::Index>;                   \
+    NEXT_MACRO()                                                               \
+  }
+
 #endif // #RNN_MACROS_H
@@ -17,24 +17,37 @@
 //  You should have received a copy of the GNU General Public License
 //  along with rnndescent.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <type_traits>
+
 #include <Rcpp.h>
 
+#include "tdoann/budget.h"
+#include "tdoann/checkpoint.h"
 #include "tdoann/graphupdate.h"
 #include "tdoann/nndescent.h"
+#include "tdoann/nndinsert.h"
 #include "tdoann/nndparallel.h"
+#include "tdoann/recall.h"
 
 #include "rnn_distance.h"
 #include "rnn_heaptor.h"
 #include "rnn_macros.h"
+#include "rnn_parallel.h"
 #include "rnn_progress.h"
+#include "rnn_rerank.h"
 #include "rnn_rng.h"
 #include "rnn_rtoheap.h"
 
 using namespace Rcpp;
 
 #define NND_IMPL()                                                             \
-  return nnd_impl.get_nn<GraphUpdate, Distance, Progress, NNDProgress>(        \
-      nn_idx, nn_dist, max_candidates, n_iters, delta, verbose);
+  return nnd_impl                                                              \
+      .get_nn<GraphUpdate, Distance, NbrHeap, Progress, NNDProgress>(          \
+          nn_idx, nn_dist, max_candidates, n_iters, delta, sample_rate,        \
+          adaptive_candidates, max_reverse_candidates, recall_ids,             \
+          target_recall, max_time, max_dist_evals, checkpoint_file, resume,    \
+          verbose);
 
 #define NND_PROGRESS()                                                         \
   if (progress == "bar") {                                                     \
@@ -47,88 +60,198 @@ using namespace Rcpp;
     NND_IMPL()                                                                 \
   }
 
+// The serial build (n_threads = 0) also uses the batch updaters and the
+// counter-based random numbers, so it gives the same graph as any number of
+// threads
 #define NND_BUILD_UPDATER()                                                    \
-  if (n_threads > 0) {                                                         \
-    using NNDImpl = NNDBuildParallel;                                          \
-    NNDImpl nnd_impl(data, n_threads);                                         \
-    if (low_memory) {                                                          \
-      using GraphUpdate = tdoann::upd::Factory<tdoann::upd::Batch>;            \
-      NND_PROGRESS()                                                           \
-    } else {                                                                   \
-      using GraphUpdate = tdoann::upd::Factory<tdoann::upd::BatchHiMem>;       \
-      NND_PROGRESS()                                                           \
-    }                                                                          \
+  NNDBuild<Data> nnd_impl(data, n_threads);                                    \
+  if (low_memory) {                                                            \
+    using GraphUpdate = tdoann::upd::Factory<tdoann::upd::Batch>;              \
+    NND_PROGRESS()                                                             \
   } else {                                                                     \
-    using NNDImpl = NNDBuildSerial;                                            \
-    NNDImpl nnd_impl(data);                                                    \
-    if (low_memory) {                                                          \
-      using GraphUpdate = tdoann::upd::Factory<tdoann::upd::Serial>;           \
-      NND_PROGRESS()                                                           \
-    } else {                                                                   \
-      using GraphUpdate = tdoann::upd::Factory<tdoann::upd::SerialHiMem>;      \
-      NND_PROGRESS()                                                           \
-    }                                                                          \
+    using GraphUpdate = tdoann::upd::Factory<tdoann::upd::BatchHiMem>;         \
+    NND_PROGRESS()                                                             \
   }
 
-struct NNDBuildSerial {
-  NumericMatrix data;
+#define NND_HEAP()                                                             \
+  DISPATCH_ON_K(tdoann::FixedNNDHeap, tdoann::NNDHeap, NND_BUILD_UPDATER)
 
-  NNDBuildSerial(NumericMatrix data) : data(data) {}
+#define NND_HALF_HEAP()                                                        \
+  using NbrHeap = tdoann::NNDHeap<Distance::Output, Distance::Index>;          \
+  NND_BUILD_UPDATER()
 
-  template <typename GraphUpdate, typename Distance, typename Progress,
-            typename NNDProgress>
-  auto get_nn(IntegerMatrix nn_idx, NumericMatrix nn_dist,
-              std::size_t max_candidates = 50, std::size_t n_iters = 10,
-              double delta = 0.001, bool verbose = false) -> List {
-    using Out = typename Distance::Output;
-    using Index = typename Distance::Index;
+#define NND_REFINE_IMPL()                                                      \
+  return nnd_refine_impl<GraphUpdate, Distance, Progress, NNDProgress>(        \
+      data, nn_idx, nn_dist, seeds, max_candidates, n_iters, delta, verbose);
 
-    auto nnd_heap =
-        r_to_heap<tdoann::HeapAddSymmetric, tdoann::NNDHeap<Out, Index>>(
-            nn_idx, nn_dist);
-    auto distance = r_to_dist<Distance>(data);
-    auto graph_updater = GraphUpdate::create(nnd_heap, distance);
-    Progress progress(n_iters, verbose);
-    NNDProgress nnd_progress(progress);
-    RRand rand;
+#define NND_REFINE_PROGRESS()                                                  \
+  if (progress == "bar") {                                                     \
+    using Progress = RPProgress;                                               \
+    using NNDProgress = tdoann::NNDProgress<Progress>;                         \
+    NND_REFINE_IMPL()                                                          \
+  } else {                                                                     \
+    using Progress = RIterProgress;                                            \
+    using NNDProgress = tdoann::HeapSumProgress<Progress>;                     \
+    NND_REFINE_IMPL()                                                          \
+  }
 
-    tdoann::nnd_build(graph_updater, max_candidates, n_iters, delta, rand,
-                      nnd_progress);
+#define NND_REFINE_UPDATER()                                                   \
+  if (low_memory) {                                                            \
+    using GraphUpdate = tdoann::upd::Factory<tdoann::upd::Serial>;             \
+    NND_REFINE_PROGRESS()                                                      \
+  } else {                                                                     \
+    using GraphUpdate = tdoann::upd::Factory<tdoann::upd::SerialHiMem>;        \
+    NND_REFINE_PROGRESS()                                                      \
+  }
+
+// Saves the state of nearest neighbor descent to filename at the end of each
+// iteration, including the state of R's RNG and the (1-indexed) recall sample,
+// so that a resumed run gives the same result as one that wasn't interrupted.
+// Does nothing if filename is empty
+struct RNNDCheckpoint {
+  std::string filename;
+  std::vector<int32_t> recall_ids;
+  std::size_t n_iters_done;
+
+  RNNDCheckpoint(const std::string &filename, IntegerVector recall_ids)
+      : filename(filename), recall_ids(recall_ids.begin(), recall_ids.end()),
+        n_iters_done(0) {}
+
+  auto start_iter() const -> std::size_t { return n_iters_done; }
+
+  template <typename NbrHeap>
+  void iter_finished(const NbrHeap &heap, std::size_t n_iters) {
+    if (filename.empty()) {
+      return;
+    }
+    if (!tdoann::save_nnd_checkpoint(filename, heap, n_iters, r_rng_state(),
+                                     recall_ids)) {
+      Rcpp::warning("Unable to write checkpoint file " + filename);
+    }
+  }
 
-    return heap_to_r(nnd_heap);
+  template <typename NbrHeap> void restore(NbrHeap &heap) {
+    std::vector<int32_t> rng_state;
+    std::vector<int32_t> saved_recall_ids;
+    if (!tdoann::load_nnd_checkpoint(filename, heap, n_iters_done, rng_state,
+                                     saved_recall_ids)) {
+      Rcpp::stop("Unable to read checkpoint file " + filename);
+    }
+    // keep the saved sample for later checkpoints, even if it isn't used now
+    recall_ids = saved_recall_ids;
+    set_r_rng_state(rng_state);
   }
 };
 
-struct NNDBuildParallel {
-  NumericMatrix data;
+// If resume is true, the heap is restored from the checkpoint and nn_idx and
+// nn_dist are only used for their dimensions
+template <typename NbrHeap, typename HeapInit>
+auto init_nnd_heap(IntegerMatrix nn_idx, RNNDCheckpoint &checkpoint,
+                   bool resume, HeapInit heap_init) -> NbrHeap {
+  if (!resume) {
+    return heap_init();
+  }
+  NbrHeap nnd_heap(nn_idx.nrow(), nn_idx.ncol());
+  checkpoint.restore(nnd_heap);
+  return nnd_heap;
+}
+
+// recall_ids is 1-indexed
+template <typename Idx>
+auto r_to_recall_sample(IntegerVector recall_ids, std::size_t n_points)
+    -> std::vector<Idx> {
+  std::vector<Idx> sample;
+  sample.reserve(recall_ids.size());
+  for (auto id : recall_ids) {
+    if (id < 1 || static_cast<std::size_t>(id) > n_points) {
+      stop("Bad recall sample index: " + std::to_string(id));
+    }
+    sample.push_back(static_cast<Idx>(id - 1));
+  }
+  return sample;
+}
+
+template <typename NNDProgress>
+void nnd_progress_start(NNDProgress &nnd_progress,
+                        const RNNDCheckpoint &checkpoint) {
+  // catch up with the iterations carried out before the checkpoint
+  for (std::size_t i = 0; i < checkpoint.start_iter(); i++) {
+    nnd_progress.iter_finished();
+  }
+}
+
+template <typename NNDProgress>
+void nnd_progress_finish(const NNDProgress &nnd_progress) {
+  if (nnd_progress.progress.is_aborted) {
+    Rcpp::warning("Nearest neighbor descent was interrupted: returning the "
+                  "current graph");
+  }
+}
+
+// the budget_exhausted item of the result is TRUE if the optimization stopped
+// because it ran out of time or distance calculations
+auto with_budget_flag(List nn, const tdoann::Budget &budget) -> List {
+  return List::create(_("idx") = nn["idx"], _("dist") = nn["dist"],
+                      _("budget_exhausted") = budget.exhausted);
+}
+
+// Data is the type of the data passed from R: NumericMatrix or RSparseData.
+// With n_threads = 0 everything runs on the calling thread
+template <typename Data> struct NNDBuild {
+  Data data;
 
   std::size_t n_threads;
 
-  NNDBuildParallel(NumericMatrix data, std::size_t n_threads)
+  NNDBuild(Data data, std::size_t n_threads)
       : data(data), n_threads(n_threads) {}
 
-  template <typename GraphUpdate, typename Distance, typename Progress,
-            typename NNDProgress>
+  template <typename GraphUpdate, typename Distance, typename NbrHeap,
+            typename Progress, typename NNDProgress>
   auto get_nn(IntegerMatrix nn_idx, NumericMatrix nn_dist,
               std::size_t max_candidates = 50, std::size_t n_iters = 10,
-              double delta = 0.001, bool verbose = false) -> List {
-    using Out = typename Distance::Output;
-    using Index = typename Distance::Index;
-
+              double delta = 0.001, double sample_rate = 1.0,
+              bool adaptive_candidates = false,
+              std::size_t max_reverse_candidates = 0,
+              IntegerVector recall_ids = IntegerVector::create(),
+              double target_recall = 1.0, double max_time = 0.0,
+              double max_dist_evals = 0.0,
+              const std::string &checkpoint_file = "", bool resume = false,
+              bool verbose = false) -> List {
     const std::size_t grain_size = 1;
-    auto nnd_heap =
-        r_to_heap<tdoann::LockingHeapAddSymmetric, tdoann::NNDHeap<Out, Index>>(
-            nn_idx, nn_dist, n_threads, grain_size);
+    const std::size_t block_size = 1024;
+    RNNDCheckpoint checkpoint(checkpoint_file, recall_ids);
+    auto nnd_heap = init_nnd_heap<NbrHeap>(nn_idx, checkpoint, resume, [&]() {
+      return r_to_heap<tdoann::LockingHeapAddSymmetric, NbrHeap>(
+          nn_idx, nn_dist, n_threads, grain_size, block_size,
+          data.nrow() - 1);
+    });
     auto distance = r_to_dist<Distance>(data);
     auto graph_updater = GraphUpdate::create(nnd_heap, distance);
+    auto recall = tdoann::sampled_recall<RParallel>(
+        distance,
+        r_to_recall_sample<typename Distance::Index>(recall_ids, data.nrow()),
+        nnd_heap.n_nbrs, n_threads);
     Progress progress(n_iters, verbose);
     NNDProgress nnd_progress(progress);
+    tdoann::RecallProgress<NNDProgress, decltype(recall)> recall_progress(
+        nnd_progress, recall, target_recall,
+        std::is_same<Progress, RIterProgress>::value);
+    nnd_progress_start(recall_progress, checkpoint);
+    tdoann::Budget budget(max_time, max_dist_evals);
+    tdoann::BudgetProgress<decltype(recall_progress)> budget_progress(
+        recall_progress, budget);
+    tdoann::CandidateSchedule schedule(
+        max_candidates, sample_rate, adaptive_candidates,
+        std::is_same<Progress, RIterProgress>::value, max_reverse_candidates);
     ParallelRand parallel_rand;
 
-    tdoann::nnd_build<RParallel>(graph_updater, max_candidates, n_iters, delta,
-                                 nnd_progress, parallel_rand, n_threads);
+    tdoann::nnd_build<RParallel>(graph_updater, schedule, n_iters, delta,
+                                 budget_progress, parallel_rand, n_threads,
+                                 checkpoint);
+    nnd_progress_finish(budget_progress.progress.progress);
 
-    return heap_to_r(nnd_heap, n_threads);
+    return with_budget_flag(
+        exact_heap_to_r<Distance>(nnd_heap, n_threads, data), budget);
   }
 };
 
@@ -138,6 +261,109 @@ List nn_descent(NumericMatrix data, IntegerMatrix nn_idx, NumericMatrix nn_dist,
                 std::size_t max_candidates = 50, std::size_t n_iters = 10,
                 double delta = 0.001, bool low_memory = true,
                 std::size_t n_threads = 0, bool verbose = false,
-                const std::string &progress = "bar") {
-  DISPATCH_ON_DISTANCES(NND_BUILD_UPDATER);
+                const std::string &progress = "bar",
+                const std::string &checkpoint_file = "", bool resume = false,
+                IntegerVector recall_ids = IntegerVector::create(),
+                double target_recall = 1.0, double max_time = 0.0,
+                double max_dist_evals = 0.0, double sample_rate = 1.0,
+                bool adaptive_candidates = false,
+                std::size_t max_reverse_candidates = 0,
+                const std::string &precision = "float") {
+  const auto k = nn_idx.ncol();
+  using Data = NumericMatrix;
+  DISPATCH_ON_QUANTIZED_PRECISION(NND_HEAP, NND_HALF_HEAP);
+}
+
+// [[Rcpp::export]]
+List sparse_nn_descent(
+    List data, IntegerMatrix nn_idx, NumericMatrix nn_dist,
+    const std::string &metric = "euclidean", std::size_t max_candidates = 50,
+    std::size_t n_iters = 10, double delta = 0.001, bool low_memory = true,
+    std::size_t n_threads = 0, bool verbose = false,
+    const std::string &progress = "bar",
+    const std::string &checkpoint_file = "", bool resume = false,
+    IntegerVector recall_ids = IntegerVector::create(),
+    double target_recall = 1.0, double max_time = 0.0,
+    double max_dist_evals = 0.0, double sample_rate = 1.0,
+    bool adaptive_candidates = false, std::size_t max_reverse_candidates = 0,
+    const std::string &precision = "float") {
+  const auto k = nn_idx.ncol();
+  using Data = RSparseData;
+  DISPATCH_ON_SPARSE_PRECISION(NND_HEAP);
+}
+
+// [[Rcpp::export]]
+List nn_descent_checkpoint_info(const std::string &checkpoint_file) {
+  tdoann::NNDCheckpointHeader header;
+  std::vector<int32_t> rng_state;
+  std::vector<int32_t> recall_ids;
+  if (!tdoann::read_nnd_checkpoint_state(checkpoint_file, header, rng_state,
+                                         recall_ids)) {
+    stop("Unable to read checkpoint file " + checkpoint_file);
+  }
+  return List::create(_("n_points") = static_cast<double>(header.n_points),
+                      _("n_nbrs") = static_cast<double>(header.n_nbrs),
+                      _("n_iters") = static_cast<double>(header.n_iters_done),
+                      _("recall_ids") = IntegerVector(recall_ids.begin(),
+                                                      recall_ids.end()));
+}
+
+template <typename GraphUpdate, typename Distance, typename Progress,
+          typename NNDProgress>
+auto nnd_refine_impl(NumericMatrix data, IntegerMatrix nn_idx,
+                     NumericMatrix nn_dist, const std::vector<char> &seeds,
+                     std::size_t max_candidates, std::size_t n_iters,
+                     double delta, bool verbose) -> List {
+  using NbrHeap =
+      tdoann::NNDHeap<typename Distance::Output, typename Distance::Index>;
+  const std::size_t block_size = 1024;
+  // symmetric initialization pushes the seeds into the rows of their
+  // neighbors
+  auto nnd_heap = r_to_heap<tdoann::HeapAddSymmetric, NbrHeap>(
+      nn_idx, nn_dist, block_size, data.nrow() - 1);
+  auto distance = r_to_dist<Distance>(data);
+  auto graph_updater = GraphUpdate::create(nnd_heap, distance);
+  Progress progress(n_iters, verbose);
+  NNDProgress nnd_progress(progress);
+  RRand rand;
+
+  const std::size_t n_seeds = std::count(seeds.begin(), seeds.end(), 1);
+  auto is_seed = [&seeds](std::size_t i) { return seeds[i] == 1; };
+  tdoann::nnd_refine(graph_updater, is_seed, n_seeds, max_candidates, n_iters,
+                     delta, rand, nnd_progress);
+
+  return heap_to_r(nnd_heap);
+}
+
+// [[Rcpp::export]]
+List nn_descent_insert(NumericMatrix data, IntegerMatrix nn_idx,
+                       NumericMatrix nn_dist, std::size_t n_old,
+                       const std::string &metric = "euclidean",
+                       std::size_t max_candidates = 50,
+                       std::size_t n_iters = 5, double delta = 0.001,
+                       bool low_memory = true, bool verbose = false,
+                       const std::string &progress = "bar") {
+  // the new items are the seeds
+  std::vector<char> seeds(data.nrow(), 0);
+  std::fill(seeds.begin() + std::min(n_old, seeds.size()), seeds.end(), 1);
+  DISPATCH_ON_DISTANCES(NND_REFINE_UPDATER);
+}
+
+// [[Rcpp::export]]
+List nn_descent_refine(NumericMatrix data, IntegerMatrix nn_idx,
+                       NumericMatrix nn_dist, IntegerVector seed_ids,
+                       const std::string &metric = "euclidean",
+                       std::size_t max_candidates = 50,
+                       std::size_t n_iters = 5, double delta = 0.001,
+                       bool low_memory = true, bool verbose = false,
+                       const std::string &progress = "bar") {
+  const std::size_t n_points = data.nrow();
+  std::vector<char> seeds(n_points, 0);
+  for (auto id : seed_ids) {
+    if (id < 1 || static_cast<std::size_t>(id) > n_points) {
+      stop("Bad seed index: " + std::to_string(id));
+    }
+    seeds[id - 1] = 1;
+  }
+  DISPATCH_ON_DISTANCES(NND_REFINE_UPDATER);
 }
@@ -0,0 +1,194 @@
+//  rnndescent -- An R package for nearest neighbor descent
+//
+//  Copyright (C) 2021 James Melville
+//
+//  This file is part of rnndescent
+//
+//  rnndescent is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  rnndescent is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with rnndescent.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <fstream>
+
+#include <Rcpp.h>
+
+#include "tdoann/pq.h"
+#include "tdoann/search.h"
+
+#include "rnn_heaptor.h"
+#include "rnn_parallel.h"
+#include "rnn_progress.h"
+#include "rnn_util.h"
+
+using namespace Rcpp;
+
+// The metrics are those of the quantized distances, with the cosine distance
+// calculated from normalized data
+#define DISPATCH_ON_PQ_DISTANCES(NEXT_MACRO)                                   \
+  if (metric == "l2sqr") {                                                     \
+    using Term = tdoann::SquaredDiff<float>;                                   \
+    using Finish = tdoann::Identity<float>;                                    \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "cosine") {                                             \
+    using Term = tdoann::Product<float>;                                       \
+    using Finish = tdoann::OneMinus<float>;                                    \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "manhattan") {                                          \
+    using Term = tdoann::AbsDiff<float>;                                       \
+    using Finish = tdoann::Identity<float>;                                    \
+    NEXT_MACRO()                                                               \
+  } else {                                                                     \
+    Rcpp::stop("Bad metric for product quantization: " + metric);              \
+  }
+
+#define PQ_QUERY_IMPL()                                                        \
+  return pq_query_impl<Term, Finish>(centroids, codes, reference_graph_list,   \
+                                     query, nn_idx, metric == "cosine",        \
+                                     epsilon, n_threads, verbose, rerank_file, \
+                                     k);
+
+auto r_to_pq_data(NumericMatrix data, bool normalize) -> std::vector<float> {
+  auto data_vec = r_to_vect<float>(data);
+  if (normalize) {
+    return tdoann::normalize(data_vec, data.ncol());
+  }
+  return data_vec;
+}
+
+// The centroid matrix has one row per centroid of each subspace, and a column
+// for each dimension of a subspace
+auto r_to_pq(NumericMatrix centroids, std::size_t n_subspaces)
+    -> tdoann::ProductQuantizer {
+  const std::size_t n_centroids = centroids.nrow() / n_subspaces;
+  return tdoann::ProductQuantizer(centroids.ncol() * n_subspaces, n_subspaces,
+                                  n_centroids, r_to_vect<float>(centroids));
+}
+
+auto r_to_codes(RawMatrix codes) -> std::vector<uint8_t> {
+  const std::size_t n_points = codes.nrow();
+  const std::size_t n_subspaces = codes.ncol();
+  std::vector<uint8_t> codes_vec(n_points * n_subspaces);
+  for (std::size_t i = 0; i < n_points; i++) {
+    for (std::size_t m = 0; m < n_subspaces; m++) {
+      codes_vec[i * n_subspaces + m] = codes(i, m);
+    }
+  }
+  return codes_vec;
+}
+
+// Stop unless filename contains n_points rows of ndim floats
+void check_row_file(const std::string &filename, std::size_t n_points,
+                    std::size_t ndim) {
+  std::ifstream stream(filename, std::ios::binary | std::ios::ate);
+  if (!stream) {
+    stop("Unable to read rerank file " + filename);
+  }
+  const auto expected = n_points * ndim * sizeof(float);
+  if (static_cast<std::size_t>(stream.tellg()) != expected) {
+    stop("Rerank file " + filename + " should contain " +
+         std::to_string(expected) + " bytes");
+  }
+}
+
+template <typename Term, typename Finish>
+auto pq_query_impl(NumericMatrix centroids, RawMatrix codes,
+                   List reference_graph_list, NumericMatrix query,
+                   IntegerMatrix nn_idx, bool normalize, double epsilon,
+                   std::size_t n_threads, bool verbose,
+                   const std::string &rerank_file, std::size_t k) -> List {
+  using Distance = tdoann::AdcDistance<float, float, uint32_t, Term, Finish>;
+  const std::size_t n_points = codes.nrow();
+  auto query_vec = r_to_pq_data(query, normalize);
+  Distance distance(r_to_pq(centroids, codes.ncol()), r_to_codes(codes),
+                    query_vec);
+
+  if (!rerank_file.empty()) {
+    check_row_file(rerank_file, n_points, distance.ndim);
+  }
+
+  const std::size_t n_queries = query.nrow();
+  const std::size_t n_nbrs = nn_idx.ncol();
+  auto idx_vec = r_to_idxt<uint32_t>(nn_idx, n_points - 1);
+  tdoann::NNHeap<float, uint32_t> nn_heap(n_queries, n_nbrs);
+  std::vector<float> dists(n_nbrs);
+  for (std::size_t i = 0; i < n_queries; i++) {
+    const uint32_t *nbrs = &idx_vec[i * n_nbrs];
+    distance.batch(i, nbrs, n_nbrs, dists.data());
+    for (std::size_t j = 0; j < n_nbrs; j++) {
+      if (nbrs[j] != nn_heap.npos()) {
+        nn_heap.checked_push(i, dists[j], nbrs[j]);
+      }
+    }
+  }
+
+  auto reference_graph = r_to_sparse_graph<Distance>(reference_graph_list);
+  if (n_threads > 0) {
+    tdoann::nn_query<RParallel, RPProgress>(reference_graph, nn_heap, distance,
+                                            epsilon, n_threads, verbose);
+  } else {
+    tdoann::nn_query<RPProgress>(reference_graph, nn_heap, distance, epsilon,
+                                 verbose);
+  }
+
+  if (rerank_file.empty()) {
+    return heap_to_r(nn_heap, n_threads);
+  }
+  tdoann::RowFileDistance<float, uint32_t, Term, Finish> exact(
+      rerank_file, query_vec, distance.ndim, n_points, normalize);
+  auto reranked = tdoann::rerank_heap<RParallel>(nn_heap, exact, n_threads, k);
+  try {
+    exact.rethrow_error();
+  } catch (const std::exception &e) {
+    stop(e.what());
+  }
+  return heap_to_r(reranked, n_threads);
+}
+
+// [[Rcpp::export]]
+List pq_encode_cpp(NumericMatrix train, NumericMatrix data,
+                   std::size_t n_subspaces, std::size_t n_iters = 10,
+                   const std::string &metric = "l2sqr",
+                   std::size_t n_threads = 0) {
+  const bool normalize = metric == "cosine";
+  const std::size_t ndim = data.ncol();
+  const std::size_t n_centroids =
+      std::min(std::size_t{256}, static_cast<std::size_t>(train.nrow()));
+  auto pq = tdoann::train_pq<RParallel>(r_to_pq_data(train, normalize), ndim,
+                                        n_subspaces, n_centroids, n_iters,
+                                        n_threads);
+  auto codes = pq.encode<RParallel>(r_to_pq_data(data, normalize), n_threads);
+
+  const std::size_t n_points = data.nrow();
+  RawMatrix codes_r(n_points, n_subspaces);
+  for (std::size_t i = 0; i < n_points; i++) {
+    for (std::size_t m = 0; m < n_subspaces; m++) {
+      codes_r(i, m) = codes[i * n_subspaces + m];
+    }
+  }
+  NumericMatrix centroids(pq.sub_ndim, n_subspaces * n_centroids,
+                          pq.centroids.begin());
+  return List::create(_("centroids") = transpose(centroids),
+                      _("codes") = codes_r);
+}
+
+// nn_idx contains the (1-indexed) initial neighbors of each query: their
+// distances are calculated here. If rerank_file is not empty, the k nearest
+// neighbors by their exact distances are returned
+// [[Rcpp::export]]
+List pq_query_cpp(NumericMatrix centroids, RawMatrix codes,
+                  List reference_graph_list, NumericMatrix query,
+                  IntegerMatrix nn_idx, const std::string &metric = "l2sqr",
+                  double epsilon = 0.1, std::size_t n_threads = 0,
+                  bool verbose = false, const std::string &rerank_file = "",
+                  std::size_t k = 0) {
+  DISPATCH_ON_PQ_DISTANCES(PQ_QUERY_IMPL)
+}
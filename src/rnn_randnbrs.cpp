@@ -33,41 +33,40 @@ using namespace Rcpp;
 /* Macros */
 
 #define RANDOM_NBRS_BUILD()                                                    \
-  return random_build_impl<Distance>(data, k, order_by_distance, n_threads,    \
-                                     verbose);
+  return random_build_impl<Distance, Data>(data, k, order_by_distance,         \
+                                           n_threads, verbose);
 
 #define RANDOM_NBRS_QUERY()                                                    \
-  return random_query_impl<Distance>(reference, query, k, order_by_distance,   \
-                                     n_threads, verbose);
+  return random_query_impl<Distance, Data>(reference, query, k,                \
+                                           order_by_distance, n_threads,       \
+                                           verbose);
 
 /* Functions */
 
-template <typename Distance>
-auto random_build_impl(NumericMatrix data, typename Distance::Index k,
+template <typename Distance, typename Data>
+auto random_build_impl(Data data, typename Distance::Index k,
                        bool order_by_distance, std::size_t n_threads,
                        bool verbose) -> List {
 
-  auto data_vec = r_to_dist_vect<Distance>(data);
+  auto distance = r_to_dist<Distance>(data);
 
   auto nn_graph =
       tdoann::random_build<Distance, DQIntSampler, RPProgress, RParallel>(
-          data_vec, data.ncol(), k, order_by_distance, n_threads, verbose);
+          distance, k, order_by_distance, n_threads, verbose);
 
   return graph_to_r(nn_graph);
 }
 
-template <typename Distance>
-auto random_query_impl(NumericMatrix reference, NumericMatrix query,
-                       typename Distance::Index k, bool order_by_distance,
-                       std::size_t n_threads, bool verbose) -> List {
+template <typename Distance, typename Data>
+auto random_query_impl(Data reference, Data query, typename Distance::Index k,
+                       bool order_by_distance, std::size_t n_threads,
+                       bool verbose) -> List {
 
-  auto ref_vec = r_to_dist_vect<Distance>(reference);
-  auto query_vec = r_to_dist_vect<Distance>(query);
+  auto distance = r_to_dist<Distance>(reference, query);
 
   auto nn_graph =
       tdoann::random_query<Distance, DQIntSampler, RPProgress, RParallel>(
-          ref_vec, reference.ncol(), query_vec, k, order_by_distance, n_threads,
-          verbose);
+          distance, k, order_by_distance, n_threads, verbose);
 
   return graph_to_r(nn_graph);
 }
@@ -78,13 +77,35 @@ auto random_query_impl(NumericMatrix reference, NumericMatrix query,
 List random_knn_cpp(Rcpp::NumericMatrix data, uint32_t k,
                     const std::string &metric = "euclidean",
                     bool order_by_distance = true, std::size_t n_threads = 0,
-                    bool verbose = false){
-    DISPATCH_ON_DISTANCES(RANDOM_NBRS_BUILD)}
+                    bool verbose = false) {
+  using Data = NumericMatrix;
+  DISPATCH_ON_DISTANCES(RANDOM_NBRS_BUILD)
+}
 
 // [[Rcpp::export]]
 List random_knn_query_cpp(NumericMatrix reference, NumericMatrix query,
                           uint32_t k, const std::string &metric = "euclidean",
                           bool order_by_distance = true,
                           std::size_t n_threads = 0, bool verbose = false) {
+  using Data = NumericMatrix;
   DISPATCH_ON_QUERY_DISTANCES(RANDOM_NBRS_QUERY)
 }
+
+// [[Rcpp::export]]
+List sparse_random_knn_cpp(List data, uint32_t k,
+                           const std::string &metric = "euclidean",
+                           bool order_by_distance = true,
+                           std::size_t n_threads = 0, bool verbose = false) {
+  using Data = RSparseData;
+  DISPATCH_ON_SPARSE_DISTANCES(RANDOM_NBRS_BUILD)
+}
+
+// [[Rcpp::export]]
+List sparse_random_knn_query_cpp(List reference, List query, uint32_t k,
+                                 const std::string &metric = "euclidean",
+                                 bool order_by_distance = true,
+                                 std::size_t n_threads = 0,
+                                 bool verbose = false) {
+  using Data = RSparseData;
+  DISPATCH_ON_SPARSE_DISTANCES(RANDOM_NBRS_QUERY)
+}
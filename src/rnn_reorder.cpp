@@ -0,0 +1,41 @@
+//  rnndescent -- An R package for nearest neighbor descent
+//
+//  Copyright (C) 2021 James Melville
+//
+//  This file is part of rnndescent
+//
+//  rnndescent is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  rnndescent is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with rnndescent.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <Rcpp.h>
+
+#include "tdoann/reorder.h"
+
+#include "rnn_util.h"
+
+using namespace Rcpp;
+
+// Returns the breadth-first search ordering of the graph (1-indexed) and the
+// graph with its items in that order
+// [[Rcpp::export]]
+List bfs_reorder_cpp(List graph_list) {
+  tdoann::SparseNNGraph<double, uint32_t> graph(
+      graph_list["row_ptr"], graph_list["col_idx"], graph_list["dist"]);
+
+  auto order = tdoann::bfs_order(graph);
+  auto reordered = tdoann::permute_graph(graph, order);
+
+  IntegerVector order_r(order.begin(), order.end());
+  return List::create(_("order") = order_r + 1,
+                      _("graph") = sparse_graph_to_r(reordered));
+}
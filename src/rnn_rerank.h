@@ -0,0 +1,59 @@
+//  rnndescent -- An R package for nearest neighbor descent
+//
+//  Copyright (C) 2019 James Melville
+//
+//  This file is part of rnndescent
+//
+//  rnndescent is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  rnndescent is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with rnndescent.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RNN_RERANK_H
+#define RNN_RERANK_H
+
+#include <type_traits>
+
+#include <Rcpp.h>
+
+#include "tdoann/distance.h"
+#include "tdoann/heap.h"
+
+#include "rnn_distance.h"
+#include "rnn_heaptor.h"
+#include "rnn_parallel.h"
+
+template <typename Distance, typename NbrHeap, typename... Data>
+auto rerank_heap_to_r(NbrHeap &heap, std::size_t n_threads, std::false_type,
+                      Data...) -> Rcpp::List {
+  return heap_to_r(heap, n_threads);
+}
+
+template <typename Distance, typename NbrHeap, typename... Data>
+auto rerank_heap_to_r(NbrHeap &heap, std::size_t n_threads, std::true_type,
+                      Data... data) -> Rcpp::List {
+  auto exact = r_to_dist<typename Distance::Exact>(data...);
+  auto reranked = tdoann::rerank_heap<RParallel>(heap, exact, n_threads);
+  return heap_to_r(reranked, n_threads);
+}
+
+// heap_to_r for neighbors found with Distance. The neighbors found with a
+// quantized (or other approximate) distance are first re-ranked by their exact
+// distances, calculated from data (the data, or the reference and query data),
+// which is only converted for this final step
+template <typename Distance, typename NbrHeap, typename... Data>
+auto exact_heap_to_r(NbrHeap &heap, std::size_t n_threads, Data... data)
+    -> Rcpp::List {
+  return rerank_heap_to_r<Distance>(heap, n_threads,
+                                    tdoann::NeedsRerank<Distance>(), data...);
+}
+
+#endif // RNN_RERANK_H
@@ -18,16 +18,12 @@
 //  You should have received a copy of the GNU General Public License
 //  along with rnndescent.  If not, see <http://www.gnu.org/licenses/>.
 
-#include <limits>
-
 #include "R_randgen.h"
 #include "Rcpp.h"
 #include "convert_seed.h"
 #include "dqrng_generator.h"
 #include <dqrng.h>
 
-#include "dqsample.h"
-
 #include "rnn_rng.h"
 
 // Uses R API: Not thread safe
@@ -44,26 +40,24 @@ auto combine_seeds(uint32_t msw, uint32_t lsw) -> uint64_t {
   return (static_cast<uint64_t>(msw) << 32) | static_cast<uint64_t>(lsw);
 }
 
-auto RRand::unif() -> double { return R::runif(0, 1); }
-
-TauRand::TauRand(uint64_t seed, uint64_t seed2) : prng(nullptr) {
-  dqrng::rng64_t rng = parallel_rng();
-  rng->seed(seed, seed2);
-
-  // Stitch together 3 64-bit ints from 6 32-bit ones
-  std::vector<uint32_t> tau_seeds32;
-  dqsample::sample<uint32_t>(tau_seeds32, rng,
-                             (std::numeric_limits<uint32_t>::max)(), 6, true);
+auto r_rng_state() -> std::vector<int32_t> {
+  // copy the current state of the generator into .Random.seed
+  PutRNGstate();
+  Rcpp::IntegerVector seed = Rcpp::Environment::global_env()[".Random.seed"];
+  return Rcpp::as<std::vector<int32_t>>(seed);
+}
 
-  prng.reset(
-      new tdoann::tau_prng(combine_seeds(tau_seeds32[0], tau_seeds32[1]),
-                           combine_seeds(tau_seeds32[2], tau_seeds32[3]),
-                           combine_seeds(tau_seeds32[4], tau_seeds32[5])));
+void set_r_rng_state(const std::vector<int32_t> &state) {
+  Rcpp::Environment::global_env().assign(
+      ".Random.seed", Rcpp::IntegerVector(state.begin(), state.end()));
+  GetRNGstate();
 }
-auto TauRand::unif() -> double { return prng->rand(); }
+
+auto RRand::unif() -> double { return R::runif(0, 1); }
 
 ParallelRand::ParallelRand() : seed(0) {}
 void ParallelRand::reseed() { seed = pseed(); }
-auto ParallelRand::get_rand(uint64_t seed2) -> TauRand {
-  return TauRand(seed, seed2);
+auto ParallelRand::get_rand(uint64_t key, uint64_t key2)
+    -> tdoann::PhiloxRand {
+  return tdoann::PhiloxRand(seed, key, key2);
 }
@@ -21,37 +21,33 @@
 #ifndef RNN_RNG_H
 #define RNN_RNG_H
 
-#include <memory>
 #include <vector>
 
 #include "dqrng_generator.h"
-#include "tdoann/tauprng.h"
+#include "tdoann/philox.h"
 
 auto pseed() -> uint64_t;
 auto parallel_rng() -> dqrng::rng64_t;
 auto combine_seeds(uint32_t, uint32_t) -> uint64_t;
 
+// Get and set the state of R's RNG (via .Random.seed): not thread safe
+auto r_rng_state() -> std::vector<int32_t>;
+void set_r_rng_state(const std::vector<int32_t> &state);
+
 // Use R API for RNG
 struct RRand {
   // a random uniform value between 0 and 1
   auto unif() -> double;
 };
 
-// Use Taus88 RNG
-struct TauRand {
-  std::unique_ptr<tdoann::tau_prng> prng;
-
-  TauRand(uint64_t seed, uint64_t seed2);
-  // a random uniform value between 0 and 1
-  auto unif() -> double;
-};
-
+// Hands out counter-based random streams: the stream for a given (key, key2)
+// only depends on the seed drawn in reseed, not on the thread that asks for it
 struct ParallelRand {
   uint64_t seed;
 
   ParallelRand();
   void reseed();
-  auto get_rand(uint64_t seed2) -> TauRand;
+  auto get_rand(uint64_t key, uint64_t key2 = 0) -> tdoann::PhiloxRand;
 };
 
 #endif // RNN_RNG_H
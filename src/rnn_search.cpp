@@ -17,6 +17,8 @@
 //  You should have received a copy of the GNU General Public License
 //  along with rnndescent.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <limits>
+
 #include <Rcpp.h>
 
 #include "tdoann/search.h"
@@ -25,89 +27,194 @@
 #include "rnn_heaptor.h"
 #include "rnn_macros.h"
 #include "rnn_progress.h"
+#include "rnn_rerank.h"
+#include "rnn_rng.h"
 #include "rnn_rtoheap.h"
 
 using namespace Rcpp;
 
 #define NN_QUERY_IMPL()                                                        \
-  return nn_impl.get_nn<Distance, RPProgress>(nn_idx, nn_dist, epsilon,        \
-                                              verbose);
+  return nn_impl.get_nn<Distance, RPProgress>(nn_idx, nn_dist, deleted,        \
+                                              epsilon, max_dist_evals,         \
+                                              sketch_bits, metric, verbose);
 
 #define NN_QUERY_UPDATER()                                                     \
   if (n_threads > 0) {                                                         \
-    using NNImpl = NNQueryParallel;                                            \
+    using NNImpl = NNQueryParallel<Data>;                                      \
     NNImpl nn_impl(reference, query, reference_graph_list, n_threads);         \
     NN_QUERY_IMPL()                                                            \
   } else {                                                                     \
-    using NNImpl = NNQuerySerial;                                              \
+    using NNImpl = NNQuerySerial<Data>;                                        \
     NNImpl nn_impl(reference, query, reference_graph_list);                    \
     NN_QUERY_IMPL()                                                            \
   }
 
-struct NNQuerySerial {
-  NumericMatrix reference;
-  NumericMatrix query;
+// 0 means no limit on the number of distance calculations per query
+auto max_query_dist_evals(std::size_t max_dist_evals) -> std::size_t {
+  return max_dist_evals == 0 ? (std::numeric_limits<std::size_t>::max)()
+                             : max_dist_evals;
+}
+
+// the budget_exhausted item of the result is TRUE if the search of any query
+// was stopped by the limit on distance calculations. sketch_rejection_rate is
+// the fraction of candidates whose distance calculation was skipped
+auto with_search_stats(List nn, std::size_t n_capped,
+                       double sketch_rejection_rate) -> List {
+  return List::create(_("idx") = nn["idx"], _("dist") = nn["dist"],
+                      _("budget_exhausted") = n_capped > 0,
+                      _("sketch_rejection_rate") = sketch_rejection_rate);
+}
+
+// Sign sketches can only bound Euclidean and cosine distances
+void check_sketch_metric(const std::string &metric) {
+  if (metric != "euclidean" && metric != "l2sqr" && metric != "cosine") {
+    stop("Sketches not supported for metric: " + metric);
+  }
+}
+
+// Sketches are built from the dense data
+template <typename SparseGraph>
+void build_sketch(tdoann::SignSketch &sketch, NumericMatrix reference,
+                  NumericMatrix query, const SparseGraph &reference_graph,
+                  std::size_t n_threads) {
+  RRand rand;
+  sketch.build<RParallel>(r_to_vect<float>(reference), r_to_vect<float>(query),
+                          reference.ncol(), reference_graph, rand, n_threads);
+}
+
+template <typename SparseGraph>
+void build_sketch(tdoann::SignSketch &, const RSparseData &,
+                  const RSparseData &, const SparseGraph &, std::size_t) {
+  stop("Sketches not supported for sparse data");
+}
+
+// Data is the type of the data passed from R: NumericMatrix or RSparseData
+template <typename Data> struct NNQuerySerial {
+  Data reference;
+  Data query;
 
   List reference_graph_list;
 
-  NNQuerySerial(NumericMatrix reference, NumericMatrix query,
-                List reference_graph_list)
+  NNQuerySerial(Data reference, Data query, List reference_graph_list)
       : reference(reference), query(query),
         reference_graph_list(reference_graph_list) {}
 
   template <typename Distance, typename Progress>
-  auto get_nn(IntegerMatrix nn_idx, NumericMatrix nn_dist, double epsilon = 0.1,
-              bool verbose = false) -> List {
+  auto get_nn(IntegerMatrix nn_idx, NumericMatrix nn_dist,
+              IntegerVector deleted, double epsilon = 0.1,
+              std::size_t max_dist_evals = 0, std::size_t sketch_bits = 0,
+              const std::string &metric = "euclidean", bool verbose = false)
+      -> List {
     using Out = typename Distance::Output;
     using Index = typename Distance::Index;
 
+    const std::size_t block_size = 1024;
     auto nn_heap =
         r_to_heap_missing_ok<tdoann::HeapAddQuery, tdoann::NNHeap<Out, Index>>(
-            nn_idx, nn_dist);
+            nn_idx, nn_dist, block_size, reference.nrow() - 1);
     auto distance = r_to_dist<Distance>(reference, query);
     auto reference_graph = r_to_sparse_graph<Distance>(reference_graph_list);
-    tdoann::nn_query<Progress>(reference_graph, nn_heap, distance, epsilon,
-                               verbose);
-
-    return heap_to_r(nn_heap);
+    reference_graph.tombstones = r_to_tombstones(deleted, reference.nrow());
+    std::size_t n_capped = 0;
+    double sketch_rejection_rate = 0.0;
+    if (sketch_bits > 0) {
+      tdoann::SignSketch sketch(sketch_bits, metric == "cosine",
+                                metric == "l2sqr");
+      build_sketch(sketch, reference, query, reference_graph, 0);
+      n_capped = tdoann::nn_query<Progress>(
+          reference_graph, nn_heap, distance, epsilon, verbose,
+          max_query_dist_evals(max_dist_evals), sketch);
+      sketch_rejection_rate = sketch.rejection_rate();
+    } else {
+      n_capped = tdoann::nn_query<Progress>(
+          reference_graph, nn_heap, distance, epsilon, verbose,
+          max_query_dist_evals(max_dist_evals));
+    }
+
+    return with_search_stats(
+        exact_heap_to_r<Distance>(nn_heap, 0, reference, query), n_capped,
+        sketch_rejection_rate);
   }
 };
 
-struct NNQueryParallel {
-  NumericMatrix reference;
-  NumericMatrix query;
+template <typename Data> struct NNQueryParallel {
+  Data reference;
+  Data query;
 
   List reference_graph_list;
 
   std::size_t n_threads;
 
-  NNQueryParallel(NumericMatrix reference, NumericMatrix query,
-                  List reference_graph_list, std::size_t n_threads)
+  NNQueryParallel(Data reference, Data query, List reference_graph_list,
+                  std::size_t n_threads)
       : reference(reference), query(query),
         reference_graph_list(reference_graph_list), n_threads(n_threads) {}
 
   template <typename Distance, typename Progress>
-  auto get_nn(IntegerMatrix nn_idx, NumericMatrix nn_dist, double epsilon = 0.1,
-              bool verbose = false) -> List {
+  auto get_nn(IntegerMatrix nn_idx, NumericMatrix nn_dist,
+              IntegerVector deleted, double epsilon = 0.1,
+              std::size_t max_dist_evals = 0, std::size_t sketch_bits = 0,
+              const std::string &metric = "euclidean", bool verbose = false)
+      -> List {
     using Out = typename Distance::Output;
     using Index = typename Distance::Index;
 
+    const std::size_t block_size = 1024;
     auto nn_heap =
         r_to_heap_missing_ok<tdoann::HeapAddQuery, tdoann::NNHeap<Out, Index>>(
-            nn_idx, nn_dist);
+            nn_idx, nn_dist, block_size, reference.nrow() - 1);
     auto distance = r_to_dist<Distance>(reference, query);
     auto reference_graph = r_to_sparse_graph<Distance>(reference_graph_list);
-    tdoann::nn_query<RParallel, Progress>(reference_graph, nn_heap, distance,
-                                          epsilon, n_threads, verbose);
-
-    return heap_to_r(nn_heap, n_threads);
+    reference_graph.tombstones = r_to_tombstones(deleted, reference.nrow());
+    std::size_t n_capped = 0;
+    double sketch_rejection_rate = 0.0;
+    if (sketch_bits > 0) {
+      tdoann::SignSketch sketch(sketch_bits, metric == "cosine",
+                                metric == "l2sqr");
+      build_sketch(sketch, reference, query, reference_graph, n_threads);
+      n_capped = tdoann::nn_query<RParallel, Progress>(
+          reference_graph, nn_heap, distance, epsilon, n_threads, verbose,
+          max_query_dist_evals(max_dist_evals), sketch);
+      sketch_rejection_rate = sketch.rejection_rate();
+    } else {
+      n_capped = tdoann::nn_query<RParallel, Progress>(
+          reference_graph, nn_heap, distance, epsilon, n_threads, verbose,
+          max_query_dist_evals(max_dist_evals));
+    }
+
+    return with_search_stats(
+        exact_heap_to_r<Distance>(nn_heap, n_threads, reference, query),
+        n_capped, sketch_rejection_rate);
   }
 };
 
 // [[Rcpp::export]]
 List nn_query(NumericMatrix reference, List reference_graph_list,
               NumericMatrix query, IntegerMatrix nn_idx, NumericMatrix nn_dist,
-              const std::string &metric = "euclidean", double epsilon = 0.1,
-              std::size_t n_threads = 0, bool verbose = false) {
-  DISPATCH_ON_QUERY_DISTANCES(NN_QUERY_UPDATER)
+              IntegerVector deleted, const std::string &metric = "euclidean",
+              double epsilon = 0.1, std::size_t n_threads = 0,
+              bool verbose = false, std::size_t max_dist_evals = 0,
+              const std::string &precision = "float",
+              std::size_t sketch_bits = 0) {
+  if (sketch_bits > 0) {
+    check_sketch_metric(metric);
+  }
+  using Data = NumericMatrix;
+  DISPATCH_ON_QUANTIZED_QUERY_PRECISION(NN_QUERY_UPDATER, NN_QUERY_UPDATER)
+}
+
+// [[Rcpp::export]]
+List sparse_nn_query(List reference, List reference_graph_list, List query,
+                     IntegerMatrix nn_idx, NumericMatrix nn_dist,
+                     IntegerVector deleted,
+                     const std::string &metric = "euclidean",
+                     double epsilon = 0.1, std::size_t n_threads = 0,
+                     bool verbose = false, std::size_t max_dist_evals = 0,
+                     const std::string &precision = "float",
+                     std::size_t sketch_bits = 0) {
+  if (sketch_bits > 0) {
+    stop("Sketches not supported for sparse data");
+  }
+  using Data = RSparseData;
+  DISPATCH_ON_SPARSE_PRECISION(NN_QUERY_UPDATER)
 }
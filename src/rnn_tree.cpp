@@ -0,0 +1,141 @@
+//  rnndescent -- An R package for nearest neighbor descent
+//
+//  Copyright (C) 2019 James Melville
+//
+//  This file is part of rnndescent
+//
+//  rnndescent is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  rnndescent is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with rnndescent.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <Rcpp.h>
+
+#include "tdoann/knntree.h"
+
+#include "rnn_distance.h"
+#include "rnn_macros.h"
+#include "rnn_parallel.h"
+#include "rnn_progress.h"
+#include "rnn_util.h"
+
+using namespace Rcpp;
+
+// Squared Euclidean distances don't obey the triangle inequality, so the
+// vantage point tree is searched with Euclidean distances, which are squared
+// afterwards
+#define DISPATCH_ON_VP_TREE_DISTANCES(NEXT_MACRO)                              \
+  if (metric == "euclidean" || metric == "l2sqr") {                            \
+    using RefDistance = tdoann::Euclidean<float, float>;                       \
+    using Distance = RefDistance;                                              \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "manhattan") {                                          \
+    using RefDistance = tdoann::Manhattan<float, float>;                       \
+    using Distance = RefDistance;                                              \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "hamming") {                                            \
+    using RefDistance = tdoann::HammingSelf<uint8_t, std::size_t>;             \
+    using Distance = tdoann::HammingQuery<uint8_t, std::size_t>;               \
+    NEXT_MACRO()                                                               \
+  } else {                                                                     \
+    Rcpp::stop("Bad metric for vp_tree: " + metric);                           \
+  }
+
+#define DISPATCH_ON_KD_TREE_DISTANCES(NEXT_MACRO)                              \
+  if (metric == "euclidean") {                                                 \
+    using Distance = tdoann::Euclidean<float, float>;                          \
+    using PlaneTerm = tdoann::AbsDiff<float>;                                  \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "l2sqr") {                                              \
+    using Distance = tdoann::L2Sqr<float, float>;                              \
+    using PlaneTerm = tdoann::SquaredDiff<float>;                              \
+    NEXT_MACRO()                                                               \
+  } else if (metric == "manhattan") {                                          \
+    using Distance = tdoann::Manhattan<float, float>;                          \
+    using PlaneTerm = tdoann::AbsDiff<float>;                                  \
+    NEXT_MACRO()                                                               \
+  } else {                                                                     \
+    Rcpp::stop("Bad metric for kd_tree: " + metric);                           \
+  }
+
+#define VP_TREE_QUERY()                                                        \
+  return vp_tree_query_impl<RefDistance, Distance, NbrHeap>(                   \
+      reference, query, k, metric == "l2sqr", n_threads, verbose);
+
+#define VP_TREE_QUERY_HEAP()                                                   \
+  DISPATCH_ON_K(tdoann::FixedNNHeap, tdoann::NNHeap, VP_TREE_QUERY)
+
+#define KD_TREE_QUERY()                                                        \
+  return kd_tree_query_impl<PlaneTerm, Distance, NbrHeap>(reference, query, k, \
+                                                          n_threads, verbose);
+
+#define KD_TREE_QUERY_HEAP()                                                   \
+  DISPATCH_ON_K(tdoann::FixedNNHeap, tdoann::NNHeap, KD_TREE_QUERY)
+
+// maximum number of items in a leaf of the trees
+const std::size_t tree_leaf_size = 16;
+
+template <typename RefDistance, typename Distance, typename NbrHeap>
+auto vp_tree_query_impl(NumericMatrix reference, NumericMatrix query,
+                        typename Distance::Index k, bool square,
+                        std::size_t n_threads, bool verbose) -> List {
+  auto ref_distance = r_to_dist<RefDistance>(reference);
+  auto distance = r_to_dist<Distance>(reference, query);
+
+  auto nn_graph =
+      tdoann::vp_tree_query<Distance, RPProgress, RParallel, NbrHeap>(
+          ref_distance, distance, k, tree_leaf_size, n_threads, verbose);
+  if (square) {
+    for (auto &dist : nn_graph.dist) {
+      dist *= dist;
+    }
+  }
+
+  return graph_to_r(nn_graph);
+}
+
+template <typename PlaneTerm, typename Distance, typename NbrHeap>
+auto kd_tree_query_impl(NumericMatrix reference, NumericMatrix query,
+                        typename Distance::Index k, std::size_t n_threads,
+                        bool verbose) -> List {
+  auto distance = r_to_dist<Distance>(reference, query);
+
+  auto nn_graph =
+      tdoann::kd_tree_query<PlaneTerm, Distance, RPProgress, RParallel,
+                            NbrHeap>(distance, k, tree_leaf_size, n_threads,
+                                     verbose);
+
+  return graph_to_r(nn_graph);
+}
+
+// [[Rcpp::export]]
+List rnn_tree_knn_query(NumericMatrix reference, NumericMatrix query,
+                        uint32_t k, const std::string &metric = "euclidean",
+                        const std::string &method = "vp_tree",
+                        std::size_t n_threads = 0, bool verbose = false) {
+  if (method == "vp_tree") {
+    DISPATCH_ON_VP_TREE_DISTANCES(VP_TREE_QUERY_HEAP)
+  } else if (method == "kd_tree") {
+    DISPATCH_ON_KD_TREE_DISTANCES(KD_TREE_QUERY_HEAP)
+  } else {
+    Rcpp::stop("Unknown tree method: " + method);
+  }
+}
+
+// The neighbors of the data are found by querying the tree with the data
+// itself, so each item is its own first neighbor, as with brute force
+// [[Rcpp::export]]
+List rnn_tree_knn(NumericMatrix data, uint32_t k,
+                  const std::string &metric = "euclidean",
+                  const std::string &method = "vp_tree",
+                  std::size_t n_threads = 0, bool verbose = false) {
+  return rnn_tree_knn_query(data, data, k, metric, method, n_threads, verbose);
+}
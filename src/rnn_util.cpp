@@ -49,10 +49,15 @@ void ts(const std::string &msg) {
   Rcerr << msg << std::endl;
 }
 
+// if missing_ok, missing neighbors can be NA or 0, and become -1
 void zero_index(IntegerMatrix m, int max_idx, bool missing_ok) {
   const int min_idx = missing_ok ? -1 : 0;
   for (auto j = 0; j < m.ncol(); j++) {
     for (auto i = 0; i < m.nrow(); i++) {
+      if (missing_ok && m(i, j) == NA_INTEGER) {
+        m(i, j) = -1;
+        continue;
+      }
       auto idx0 = m(i, j) - 1;
       if (idx0 < min_idx || idx0 > max_idx) {
         stop("Bad indexes in input: " + std::to_string(idx0));
@@ -61,3 +66,16 @@ void zero_index(IntegerMatrix m, int max_idx, bool missing_ok) {
     }
   }
 }
+
+// deleted is a vector of 1-indexed ids
+auto r_to_tombstones(IntegerVector deleted, std::size_t n_points)
+    -> tdoann::Tombstones {
+  tdoann::Tombstones tombstones(n_points);
+  for (auto id : deleted) {
+    if (id < 1 || static_cast<std::size_t>(id) > n_points) {
+      stop("Bad deleted index: " + std::to_string(id));
+    }
+    tombstones.mark(id - 1);
+  }
+  return tombstones;
+}
@@ -25,13 +25,22 @@
 #include <Rcpp.h>
 
 #include "tdoann/nngraph.h"
+#include "tdoann/tombstones.h"
 
-#define RNND_MAX_IDX (std::numeric_limits<int>::max)()
+// Largest zero-based index that can be read from or written to an R integer
+// matrix. An R matrix can't have more than INT_MAX rows, so this is never a
+// limitation on the number of points, but the total number of neighbors
+// (n_points * n_nbrs) can exceed it, so offsets must always use std::size_t.
+// Where the number of points is known, pass n_points - 1 as the max_idx to
+// zero_index instead, so out of range indices are caught.
+#define RNND_MAX_IDX ((std::numeric_limits<int>::max)() - 1)
 
 void print_time(bool print_date = false);
 void ts(const std::string &);
 void zero_index(Rcpp::IntegerMatrix, int max_idx = RNND_MAX_IDX,
                 bool missing_ok = false);
+auto r_to_tombstones(Rcpp::IntegerVector deleted, std::size_t n_points)
+    -> tdoann::Tombstones;
 
 template <typename DistOut>
 auto graph_to_r(const tdoann::NNGraph<DistOut> &graph, bool unzero = false)